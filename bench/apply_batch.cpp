@@ -0,0 +1,91 @@
+/**
+ * Mixed insert / assign / erase / find batches: one call at a time versus
+ * apply_batch().
+ *
+ *   g++ -O2 -std=c++11 -I../src apply_batch.cpp -o apply_batch
+ *   ./apply_batch [n [batch ...]]     (default: 1000000  1000 10000 100000 1000000)
+ *
+ * The map starts with n keys drawn from [0, 2n); every batch draws its
+ * keys from the same range, a quarter of the ops of each kind.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "map.hpp"
+#include "bench_util.hpp"
+
+typedef sjtu::map<int, int> Map;
+typedef Map::batch_op Op;
+
+static long randomKey(long range) {
+    return ((long)rand() * RAND_MAX + rand()) % range;
+}
+
+static void fill(Map &m, long n) {
+    srand(1);
+    for (long i = 0; i < n; ++i) {
+        m.insert(Map::value_type((int)randomKey(2 * n), (int)i));
+    }
+}
+
+static void run(long n, long batch) {
+    Map one, many;
+    fill(one, n);
+    fill(many, n);
+    int value = 42;
+    std::vector<Op> ops;
+    srand(7);
+    for (long i = 0; i < batch; ++i) {
+        ops.push_back(Op(Op::kind_type(rand() % 4), (int)randomKey(2 * n), &value));
+    }
+    std::vector<Map::batch_result> results(batch);
+
+    long a = 0;
+    double t0 = seconds();
+    for (long i = 0; i < batch; ++i) {
+        const Op &op = ops[i];
+        switch (op.kind) {
+        case Op::INSERT:
+            a += one.insert(Map::value_type(op.key, *op.mapped)).second;
+            break;
+        case Op::ASSIGN:
+            one[op.key] = *op.mapped;
+            break;
+        case Op::ERASE: {
+            Map::iterator it = one.find(op.key);
+            if (it != one.end()) {
+                one.erase(it);
+                ++a;
+            }
+            break;
+        }
+        case Op::FIND:
+            a += one.find(op.key) != one.end();
+            break;
+        }
+    }
+    double t1 = seconds();
+    many.apply_batch(&ops[0], batch, &results[0]);
+    double t2 = seconds();
+
+    long b = 0;
+    for (long i = 0; i < batch; ++i) {
+        if (ops[i].kind != Op::ASSIGN) b += results[i].done;
+    }
+    if (a != b || one.size() != many.size()) {
+        printf("n = %ld, batch = %ld: result mismatch\n", n, batch);
+        exit(1);
+    }
+    printf("n = %-8ld batch = %-8ld one at a time %8.2f ms   apply_batch %8.2f ms\n",
+           n, batch, (t1 - t0) * 1e3, (t2 - t1) * 1e3);
+}
+
+int main(int argc, char **argv) {
+    long n = argc > 1 ? atol(argv[1]) : 1000000;
+    if (argc > 2) {
+        for (int i = 2; i < argc; ++i) run(n, atol(argv[i]));
+    } else {
+        for (long batch = 1000; batch <= 1000000; batch *= 10) run(n, batch);
+    }
+    return 0;
+}
@@ -0,0 +1,163 @@
+/**
+ * Red-black versus AVL balancing (map_traits::avl_balancing).
+ *
+ *   g++ -O2 -std=c++11 -I../src balancing.cpp -o balancing
+ *   ./balancing [n]                   (default: 1000000)
+ *
+ * The operations of the data/ tests, at scale: ns per operation of
+ *   ascending   n inserts of 0, 1, ..., n - 1
+ *   scrambled   n inserts in scrambled order
+ *   find        n finds of present keys, in shuffled order
+ *   churn       n rounds of erasing a present key and inserting a new one
+ *   erase       erasing all n keys in shuffled order
+ *   iterate     a full begin() to end() traversal
+ * plus the average and maximum node depth after the ascending inserts,
+ * the scrambled inserts and the churn.
+ * Best of 3.  Each configuration runs in a forked child (Linux only) so
+ * both trees start from the same heap.
+ *
+ * The data/ tests themselves run under AVL balancing when built with
+ * -DSJTU_MAP_AVL_BALANCING=1, e.g. from data/two:
+ *   g++ -O2 -std=c++11 -I../../src -I.. code.cpp -o code && time ./code
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include "map.hpp"
+#include "bench_util.hpp"
+
+struct red_black_traits : sjtu::map_traits {
+    static const bool avl_balancing = false;
+};
+
+struct avl_traits : sjtu::map_traits {
+    static const bool avl_balancing = true;
+};
+
+static const int OPS = 6, SHAPES = 3, RESULTS = OPS + 2 * SHAPES + 1;
+static const char *names[OPS] = {"ascending", "scrambled", "find", "churn", "erase", "iterate"};
+
+// odd multiplier: a permutation of [0, n) in scrambled order
+static int scrambled(long i, int n) {
+    return (int)((i * 2654435761u) % n);
+}
+
+template<class Map>
+static void shape(const Map &m, double *result) {
+    typename Map::depth_stats depth = m.tree_depth();
+    result[0] = depth.average;
+    result[1] = depth.maximum;
+}
+
+// Writes ns per operation of every workload, the average and maximum
+// depths and a checksum to fd
+template<class Map>
+static void measure(int n, int fd) {
+    double result[RESULTS];
+    for (int op = 0; op < OPS; ++op) result[op] = 1e30;
+    result[RESULTS - 1] = 0;
+    // another order for finds and the final erases
+    std::vector<int> shuffled(n);
+    srand(3);
+    for (int i = 0; i < n; ++i) shuffled[i] = i;
+    for (int i = n - 1; i > 0; --i) {
+        int j = rand() % (i + 1), k = shuffled[i];
+        shuffled[i] = shuffled[j];
+        shuffled[j] = k;
+    }
+    for (int pass = 0; pass < 3; ++pass) {
+        Map *m = new Map;
+        double t0 = seconds();
+        for (int i = 0; i < n; ++i) m->insert(typename Map::value_type(i, i));
+        double t[OPS];
+        t[0] = seconds() - t0;
+        shape(*m, result + OPS);
+        m->clear();
+
+        t0 = seconds();
+        for (long i = 0; i < n; ++i) {
+            int k = scrambled(i, n);
+            m->insert(typename Map::value_type(k, k));
+        }
+        t[1] = seconds() - t0;
+        shape(*m, result + OPS + 2);
+
+        long sum = 0;
+        t0 = seconds();
+        for (int i = 0; i < n; ++i) sum += m->find(shuffled[i])->second;
+        t[2] = seconds() - t0;
+
+        // erase key i, insert key n + i
+        t0 = seconds();
+        for (long i = 0; i < n; ++i) {
+            m->erase(m->find(scrambled(i, n)));
+            m->insert(typename Map::value_type(n + scrambled(i, n), 1));
+        }
+        t[3] = seconds() - t0;
+        shape(*m, result + OPS + 4);
+
+        t0 = seconds();
+        for (typename Map::const_iterator it = m->cbegin(); it != m->cend(); ++it) {
+            sum += it->first;
+        }
+        t[5] = seconds() - t0;
+
+        t0 = seconds();
+        for (int i = 0; i < n; ++i) m->erase(m->find(n + shuffled[i]));
+        t[4] = seconds() - t0;
+        sum += m->size();
+        delete m;
+
+        for (int op = 0; op < OPS; ++op) {
+            if (t[op] < result[op]) result[op] = t[op];
+        }
+        result[RESULTS - 1] += sum;
+    }
+    for (int op = 0; op < OPS; ++op) result[op] *= 1e9 / n;
+    if (write(fd, result, sizeof(result)) != sizeof(result)) _exit(1);
+}
+
+template<class Map>
+static bool run(int n, double *result) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        measure<Map>(n, fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+    size_t size = RESULTS * sizeof(double);
+    bool ok = read(fds[0], result, size) == (ssize_t)size;
+    close(fds[0]);
+    waitpid(pid, nullptr, 0);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    double rb[RESULTS], avl[RESULTS];
+    if (!run<sjtu::map<int, int, std::less<int>, red_black_traits> >(n, rb) ||
+        !run<sjtu::map<int, int, std::less<int>, avl_traits> >(n, avl)) {
+        return 1;
+    }
+    if (rb[RESULTS - 1] != avl[RESULTS - 1]) {
+        printf("result mismatch\n");
+        return 1;
+    }
+    printf("ns per operation   red-black      AVL\n");
+    for (int op = 0; op < OPS; ++op) {
+        printf("%-12s        %7.1f  %7.1f\n", names[op], rb[op], avl[op]);
+    }
+    printf("depth, average / maximum\n");
+    for (int s = 0; s < SHAPES; ++s) {
+        const double *a = rb + OPS + 2 * s, *b = avl + OPS + 2 * s;
+        printf("%-12s   %6.2f / %2.0f  %6.2f / %2.0f\n", names[s == 2 ? 3 : s], a[0], a[1], b[0],
+               b[1]);
+    }
+    return 0;
+}
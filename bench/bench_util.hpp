@@ -0,0 +1,29 @@
+/**
+ * Timing and memory helpers shared by the benchmarks in this directory.
+ * Linux only: CLOCK_MONOTONIC and /proc/self/statm.
+ */
+#ifndef SJTU_BENCH_UTIL_HPP
+#define SJTU_BENCH_UTIL_HPP
+
+#include <cstdio>
+#include <ctime>
+#include <unistd.h>
+
+// Monotonic wall clock, in seconds
+inline double seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Resident set size of the process, or 0 if it cannot be read
+inline long residentBytes() {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+#endif
@@ -0,0 +1,136 @@
+/**
+ * sjtu::btree_map with several node sizes versus sjtu::map (red-black).
+ *
+ *   g++ -O2 -std=c++11 -I../src btree_map.cpp -o btree_map
+ *   ./btree_map [n ...]               (default: 1000000 10000000)
+ *
+ * For map<int, int> of n elements, ns per operation of
+ *   insert      n inserts in shuffled order
+ *   find        n finds of present keys, in the reverse order
+ *   range       n / 64 lower_bound() calls at shuffled keys, each followed
+ *               by 64 iterator steps; ns per element visited
+ *   scan        a full begin() to end() traversal, per element
+ *   erase       erasing all n keys in the order inserted
+ * plus the resident bytes per element after the inserts (read from
+ * /proc/self/statm).  Best of 3.  Each configuration runs in a forked
+ * child (Linux only) so all of them start from the same heap.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include "btree_map.hpp"
+#include "map.hpp"
+#include "bench_util.hpp"
+
+static const int OPS = 5, RESULTS = OPS + 2, SPAN = 64;
+static const char *names[OPS] = {"insert", "find", "range", "scan", "erase"};
+
+// Writes ns per operation of every workload, bytes per element and a
+// checksum to fd
+template<class Map>
+static void measure(int n, int fd) {
+    double result[RESULTS];
+    for (int op = 0; op < OPS; ++op) result[op] = 1e30;
+    result[RESULTS - 1] = 0;
+    std::vector<int> shuffled(n);
+    srand(3);
+    for (int i = 0; i < n; ++i) shuffled[i] = i;
+    for (int i = n - 1; i > 0; --i) {
+        int j = rand() % (i + 1), k = shuffled[i];
+        shuffled[i] = shuffled[j];
+        shuffled[j] = k;
+    }
+    for (int pass = 0; pass < 3; ++pass) {
+        long before = residentBytes();
+        Map *m = new Map;
+        double t[OPS], t0 = seconds();
+        for (int i = 0; i < n; ++i) m->insert(typename Map::value_type(shuffled[i], i));
+        t[0] = seconds() - t0;
+        if (pass == 0) result[OPS] = (double)(residentBytes() - before) / n;
+
+        long sum = 0;
+        t0 = seconds();
+        for (int i = 0; i < n; ++i) sum += m->find(shuffled[n - 1 - i])->second;
+        t[1] = seconds() - t0;
+
+        long visited = 0;
+        t0 = seconds();
+        for (int i = 0; i < n / SPAN; ++i) {
+            typename Map::const_iterator it = static_cast<const Map *>(m)->lower_bound(shuffled[i]);
+            for (int s = 0; s < SPAN && it != m->cend(); ++s, ++it, ++visited) sum += it->second;
+        }
+        t[2] = (seconds() - t0) * n / (visited ? visited : 1);
+
+        t0 = seconds();
+        for (typename Map::const_iterator it = m->cbegin(); it != m->cend(); ++it) sum += it->first;
+        t[3] = seconds() - t0;
+
+        t0 = seconds();
+        for (int i = 0; i < n; ++i) m->erase(m->find(shuffled[i]));
+        t[4] = seconds() - t0;
+        sum += m->size();
+        delete m;
+
+        for (int op = 0; op < OPS; ++op) {
+            if (t[op] < result[op]) result[op] = t[op];
+        }
+        result[RESULTS - 1] += sum;
+    }
+    for (int op = 0; op < OPS; ++op) result[op] *= 1e9 / n;
+    if (write(fd, result, sizeof(result)) != sizeof(result)) _exit(1);
+}
+
+template<class Map>
+static bool run(int n, double *result) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        measure<Map>(n, fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+    size_t size = RESULTS * sizeof(double);
+    bool ok = read(fds[0], result, size) == (ssize_t)size;
+    close(fds[0]);
+    waitpid(pid, nullptr, 0);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    long sizes[] = {1000000, 10000000};
+    int count = 2;
+    if (argc > 1) count = 0;
+    for (int i = 1; i < argc && i <= 2; ++i) sizes[count++] = atol(argv[i]);
+    static const int MAPS = 4;
+    static const char *maps[MAPS] = {"sjtu::map", "btree 256 B", "btree 1 KiB", "btree 4 KiB"};
+    for (int c = 0; c < count; ++c) {
+        int n = (int)sizes[c];
+        double r[MAPS][RESULTS];
+        if (!run<sjtu::map<int, int> >(n, r[0]) ||
+            !run<sjtu::btree_map<int, int, std::less<int>, 256> >(n, r[1]) ||
+            !run<sjtu::btree_map<int, int, std::less<int>, 1024> >(n, r[2]) ||
+            !run<sjtu::btree_map<int, int, std::less<int>, 4096> >(n, r[3])) {
+            return 1;
+        }
+        for (int m = 1; m < MAPS; ++m) {
+            if (r[m][RESULTS - 1] != r[0][RESULTS - 1]) {
+                printf("result mismatch\n");
+                return 1;
+            }
+        }
+        printf("n=%d, ns per operation\n%-12s", n, "");
+        for (int m = 0; m < MAPS; ++m) printf("%13s", maps[m]);
+        printf("\n");
+        for (int op = 0; op <= OPS; ++op) {
+            printf("%-12s", op < OPS ? names[op] : "bytes/elem");
+            for (int m = 0; m < MAPS; ++m) printf("%13.1f", r[m][op]);
+            printf("\n");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+/**
+ * Bulk erase by predicate: the erase(it++) loop versus erase_if().
+ *
+ *   g++ -O2 -std=c++11 -I../src erase_if.cpp -o erase_if
+ *   ./erase_if [n]                    (default: 1000000)
+ *
+ * Each run fills a fresh map in scrambled order (not timed), so nodes lie
+ * scattered in memory as after a long series of inserts, and erases the
+ * keys whose hash falls below a given share, spread evenly over the key
+ * range.  Best of 3.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include "map.hpp"
+#include "bench_util.hpp"
+
+typedef sjtu::map<int, int> Map;
+
+// True for about permille / 1000 of the keys
+struct Doomed {
+    unsigned permille;
+
+    bool operator()(const Map::value_type &v) const {
+        return (unsigned)v.first * 2654435761u % 1000 < permille;
+    }
+};
+
+static size_t eraseLoop(Map &m, Doomed pred) {
+    size_t erased = 0;
+    for (Map::iterator it = m.begin(); it != m.end();) {
+        if (pred(*it)) {
+            m.erase(it++);
+            ++erased;
+        } else {
+            ++it;
+        }
+    }
+    return erased;
+}
+
+static void fill(Map &m, int n) {
+    // odd multiplier: a permutation of [0, n) in scrambled order
+    for (long i = 0; i < n; ++i) {
+        int k = (int)((i * 2654435761u) % n);
+        m.insert(Map::value_type(k, k));
+    }
+}
+
+int main(int argc, char **argv) {
+    static const unsigned shares[] = {10, 50, 100, 125, 200, 300, 500, 900};
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    for (size_t s = 0; s < sizeof(shares) / sizeof(shares[0]); ++s) {
+        Doomed pred = {shares[s]};
+        double best[2] = {1e30, 1e30};
+        size_t erased[2] = {0, 0};
+        for (int pass = 0; pass < 3; ++pass) {
+            for (int how = 0; how < 2; ++how) {
+                Map x;
+                fill(x, n);
+                double t0 = seconds();
+                erased[how] = how ? x.erase_if(pred) : eraseLoop(x, pred);
+                double t = seconds() - t0;
+                if (t < best[how]) best[how] = t;
+            }
+        }
+        if (erased[0] != erased[1]) {
+            printf("result mismatch\n");
+            return 1;
+        }
+        printf("erase %4.1f%%   erase(it++) loop %7.2f ms   erase_if %7.2f ms\n",
+               erased[0] * 100.0 / n, best[0] * 1e3, best[1] * 1e3);
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+/**
+ * Random-probe lookups: find() one key at a time versus find_many().
+ *
+ *   g++ -O2 -std=c++11 -I../src find_many.cpp -o find_many
+ *   ./find_many [n ...]               (default: 1000000 10000000)
+ *
+ * Half of the probed keys are absent, as in the random find/count
+ * phases of data/two.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "map.hpp"
+#include "bench_util.hpp"
+
+typedef sjtu::map<int, int> Map;
+
+static const int BATCH = 1024;
+
+static void run(long n) {
+    Map m;
+    // odd multiplier: a permutation of [0, n) in scrambled order
+    for (long i = 0; i < n; ++i) {
+        int k = (int)((i * 2654435761u) % n);
+        m.insert(Map::value_type(2 * k, k));
+    }
+    const Map &cm = m;
+    long probes = 4000000;
+    std::vector<int> keys(probes);
+    srand(12345);
+    for (long i = 0; i < probes; ++i) keys[i] = (int)(((long)rand() * RAND_MAX + rand()) % (2 * n));
+
+    long hits = 0;
+    double t0 = seconds();
+    for (long i = 0; i < probes; ++i) {
+        if (cm.find(keys[i]) != cm.cend()) ++hits;
+    }
+    double t1 = seconds();
+    long batchHits = 0;
+    Map::const_iterator out[BATCH];
+    for (long i = 0; i < probes; i += BATCH) {
+        int len = probes - i < BATCH ? (int)(probes - i) : BATCH;
+        cm.find_many(&keys[i], len, out);
+        for (int j = 0; j < len; ++j) {
+            if (out[j] != cm.cend()) ++batchHits;
+        }
+    }
+    double t2 = seconds();
+    if (hits != batchHits) {
+        printf("n = %ld: result mismatch\n", n);
+        exit(1);
+    }
+    double ns = 1e9 / probes;
+    printf("n = %-9ld find %7.1f ns   find_many %7.1f ns   speedup %.2fx\n",
+           n, (t1 - t0) * ns, (t2 - t1) * ns, (t1 - t0) / (t2 - t1));
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) run(atol(argv[i]));
+    } else {
+        run(1000000);
+        run(10000000);
+    }
+    return 0;
+}
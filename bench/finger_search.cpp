@@ -0,0 +1,78 @@
+/**
+ * find() from the root versus find_from() starting at the previous result.
+ *
+ *   g++ -O2 -std=c++11 -I../src finger_search.cpp -o finger_search
+ *   ./finger_search [n]               (default: 1000000)
+ *
+ * The map holds the even keys 0, 2, ..., 2n - 2, so half of the probes
+ * miss.  Probe patterns:
+ *   sequential  ascending keys, step 1
+ *   walk        each key within +-16 of the previous one
+ *   clustered   runs of 64 keys within +-256 of a random centre
+ *   random      uniform keys, the worst case for a finger
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "map.hpp"
+#include "bench_util.hpp"
+
+typedef sjtu::map<int, int> Map;
+
+static void run(const char *name, const Map &m, const std::vector<int> &probes) {
+    long hits = 0;
+    double t0 = seconds();
+    for (size_t i = 0; i < probes.size(); ++i) {
+        if (m.find(probes[i]) != m.cend()) ++hits;
+    }
+    double t1 = seconds();
+    long fingerHits = 0;
+    Map::const_iterator hint = m.cbegin();
+    for (size_t i = 0; i < probes.size(); ++i) {
+        hint = m.lower_bound_from(hint, probes[i]);
+        if (hint != m.cend() && hint->first == probes[i]) ++fingerHits;
+    }
+    double t2 = seconds();
+    if (hits != fingerHits) {
+        printf("%s: result mismatch\n", name);
+        exit(1);
+    }
+    double ns = 1e9 / probes.size();
+    printf("%-11s find %7.1f ns   find_from %7.1f ns\n", name, (t1 - t0) * ns, (t2 - t1) * ns);
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    Map m;
+    // odd multiplier: a permutation of [0, n) in scrambled order
+    for (long i = 0; i < n; ++i) {
+        int k = (int)((i * 2654435761u) % n);
+        m.insert(Map::value_type(2 * k, k));
+    }
+    srand(12345);
+    std::vector<int> probes;
+
+    for (int i = 0; i < 2 * n; ++i) probes.push_back(i);
+    run("sequential", m, probes);
+
+    probes.clear();
+    int key = n;
+    for (int i = 0; i < 2 * n; ++i) {
+        key += rand() % 33 - 16;
+        if (key < 0 || key >= 2 * n) key = n;
+        probes.push_back(key);
+    }
+    run("walk", m, probes);
+
+    probes.clear();
+    while ((int)probes.size() < 2 * n) {
+        int centre = rand() % (2 * n);
+        for (int j = 0; j < 64; ++j) probes.push_back(centre + rand() % 513 - 256);
+    }
+    run("clustered", m, probes);
+
+    probes.clear();
+    for (int i = 0; i < 2 * n; ++i) probes.push_back(rand() % (2 * n));
+    run("random", m, probes);
+    return 0;
+}
@@ -0,0 +1,146 @@
+/**
+ * sjtu::flat_map versus sjtu::map by map size: where the sorted arrays
+ * stop paying off, and where linear search gives way to binary search.
+ *
+ *   g++ -O2 -std=c++11 -I../src flat_map.cpp -o flat_map
+ *   ./flat_map [total]                (default: 1048576)
+ *
+ * For each size s, total / s maps of s int -> int elements (keys 0 to
+ * s - 1, inserted in shuffled order), then per element or operation:
+ *   build   ns to fill the maps: one insert per element for sjtu::map,
+ *           one insert(first, last) per map for flat_map
+ *   hot     ns per find() of a random key in one of the first 64 maps,
+ *           which stay in cache; flat_map with linear search only (up to
+ *           4096 elements), binary search only and the default switch at
+ *           LinearSearchMax = 8
+ *   cold    ns per find() of a random key in any of the maps
+ *   scan    ns per element of a begin() to end() traversal of every map
+ *   bytes   resident bytes per element (read from /proc/self/statm),
+ *           including the map objects themselves
+ * Best of 3.  Each configuration runs in a forked child (Linux only) so
+ * all of them start from the same heap.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include "flat_map.hpp"
+#include "map.hpp"
+#include "bench_util.hpp"
+
+typedef sjtu::map<int, int> TreeMap;
+typedef sjtu::flat_map<int, int> FlatMap;
+typedef sjtu::flat_map<int, int, std::less<int>, size_t(-1)> LinearMap;
+typedef sjtu::flat_map<int, int, std::less<int>, 0> BinaryMap;
+
+static const int RESULTS = 6, LOOKUPS = 1 << 22, HOT_MAPS = 64, LINEAR_MAX = 4096;
+
+static void fill(TreeMap &m, const std::vector<std::pair<int, int> > &in) {
+    for (size_t i = 0; i < in.size(); ++i) m.insert(TreeMap::value_type(in[i].first, in[i].second));
+}
+
+template<class Flat>
+static void fill(Flat &m, const std::vector<std::pair<int, int> > &in) {
+    m.insert(in.begin(), in.end());
+}
+
+// Writes ns per element built, per hot and cold find and per element
+// scanned, bytes per element and a checksum to fd
+template<class Map>
+static void measure(int size, int total, int fd) {
+    double result[RESULTS] = {1e30, 1e30, 1e30, 1e30, 0, 0};
+    int count = total / size > 0 ? total / size : 1;
+    srand(9);
+    std::vector<std::pair<int, int> > in(size);
+    for (int i = 0; i < size; ++i) in[i] = std::make_pair(i, i);
+    for (int i = size - 1; i > 0; --i) std::swap(in[i], in[rand() % (i + 1)]);
+    std::vector<int> hot(LOOKUPS), cold(LOOKUPS), keys(LOOKUPS);
+    for (int i = 0; i < LOOKUPS; ++i) {
+        hot[i] = rand() % (count < HOT_MAPS ? count : HOT_MAPS);
+        cold[i] = rand() % count;
+        keys[i] = rand() % size;
+    }
+    for (int pass = 0; pass < 3; ++pass) {
+        long before = residentBytes();
+        double t0 = seconds();
+        std::vector<Map> *maps = new std::vector<Map>(count);
+        for (int j = 0; j < count; ++j) fill((*maps)[j], in);
+        double t = seconds() - t0;
+        if (t < result[0]) result[0] = t;
+        if (pass == 0) result[4] = (double)(residentBytes() - before) / ((double)count * size);
+
+        long sum = 0;
+        for (int c = 0; c < 2; ++c) {
+            const std::vector<int> &which = c == 0 ? hot : cold;
+            t0 = seconds();
+            for (int i = 0; i < LOOKUPS; ++i) sum += (*maps)[which[i]].find(keys[i])->second;
+            t = seconds() - t0;
+            if (t < result[1 + c]) result[1 + c] = t;
+        }
+
+        t0 = seconds();
+        for (int j = 0; j < count; ++j) {
+            const Map &m = (*maps)[j];
+            for (typename Map::const_iterator it = m.cbegin(); it != m.cend(); ++it) sum += it->first;
+        }
+        t = seconds() - t0;
+        if (t < result[3]) result[3] = t;
+        delete maps;
+        result[5] += sum;
+    }
+    result[0] *= 1e9 / ((double)count * size);
+    result[1] *= 1e9 / LOOKUPS;
+    result[2] *= 1e9 / LOOKUPS;
+    result[3] *= 1e9 / ((double)count * size);
+    if (write(fd, result, sizeof(result)) != sizeof(result)) _exit(1);
+}
+
+template<class Map>
+static bool run(int size, int total, double *result) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        measure<Map>(size, total, fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+    size_t bytes = RESULTS * sizeof(double);
+    bool ok = read(fds[0], result, bytes) == (ssize_t)bytes;
+    close(fds[0]);
+    waitpid(pid, nullptr, 0);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int total = argc > 1 ? atoi(argv[1]) : 1 << 20;
+    printf("%6s  %-15s  %-31s  %-15s  %-13s  %s\n", "", "build ns/elem", "hot find ns", "cold find ns",
+           "scan ns/elem", "bytes/elem");
+    printf("%6s  %7s %7s  %7s %7s %7s %7s  %7s %7s  %6s %6s  %6s %6s\n", "size", "map", "flat",
+           "map", "linear", "binary", "flat", "map", "flat", "map", "flat", "map", "flat");
+    for (int size = 1; size <= total; size *= 2) {
+        double tree[RESULTS], flat[RESULTS], linear[RESULTS], binary[RESULTS];
+        if (!run<TreeMap>(size, total, tree) || !run<FlatMap>(size, total, flat) ||
+            (size <= LINEAR_MAX && !run<LinearMap>(size, total, linear)) ||
+            !run<BinaryMap>(size, total, binary)) {
+            return 1;
+        }
+        if (flat[5] != tree[5] || (size <= LINEAR_MAX && linear[5] != tree[5]) ||
+            binary[5] != tree[5]) {
+            printf("result mismatch\n");
+            return 1;
+        }
+        char linearFind[16] = "      -";
+        if (size <= LINEAR_MAX) snprintf(linearFind, sizeof(linearFind), "%7.1f", linear[1]);
+        printf("%6d  %7.1f %7.1f  %7.1f %s %7.1f %7.1f  %7.1f %7.1f  %6.1f %6.1f  %6.1f %6.1f\n",
+               size, tree[0], flat[0], tree[1], linearFind, binary[1], flat[1], tree[2], flat[2],
+               tree[3], flat[3], tree[4], flat[4]);
+        // Past 4096 elements, only every fourth size
+        if (size >= 4096) size *= 2;
+    }
+    return 0;
+}
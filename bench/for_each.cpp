@@ -0,0 +1,102 @@
+/**
+ * Scans by iterator loops versus the visitor API (for_each and friends).
+ *
+ *   g++ -O2 -std=c++11 -I../src for_each.cpp -o for_each
+ *   ./for_each [n]                    (default: 1000000)
+ *
+ * The map is filled in scrambled order, like the shuffled inserts of
+ * data/two and data/three, and then scanned the way those tests do:
+ *   forward     begin() to end() with ++it / for_each()
+ *   backward    --end() to begin() with --it / reverse_for_each()
+ *   range       the middle tenth of the keys from lower_bound(lo) while
+ *               key < hi / for_each_in_range(lo, hi)
+ * Every scan sums the mapped values; best of 5 passes, plain and threaded.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include "map.hpp"
+#include "bench_util.hpp"
+
+struct threaded_traits : sjtu::map_traits {
+    static const bool threaded = true;
+};
+
+struct Sum {
+    long *total;
+
+    template<class V>
+    bool operator()(V &v) const {
+        *total += v.second;
+        return true;
+    }
+};
+
+// ns per visited element of scan s, by iterator (0) or visitor (1)
+template<class Map>
+static long scan(const Map &m, int s, int how, int lo, int hi) {
+    long total = 0;
+    Sum f = {&total};
+    typedef typename Map::const_iterator It;
+    if (s == 0) {
+        if (how) {
+            m.for_each(f);
+        } else {
+            for (It it = m.cbegin(); it != m.cend(); ++it) total += it->second;
+        }
+    } else if (s == 1) {
+        if (how) {
+            m.reverse_for_each(f);
+        } else {
+            It first = m.cbegin();
+            for (It it = m.cend(); it != first;) total += (--it)->second;
+        }
+    } else {
+        if (how) {
+            m.for_each_in_range(lo, hi, f);
+        } else {
+            for (It it = m.lower_bound(lo); it != m.cend() && it->first < hi; ++it) {
+                total += it->second;
+            }
+        }
+    }
+    return total;
+}
+
+template<class Map>
+static bool run(const char *name, int n) {
+    static const char *scans[] = {"forward", "backward", "range"};
+    Map m;
+    // odd multiplier: a permutation of [0, n) in scrambled order
+    for (long i = 0; i < n; ++i) {
+        int k = (int)((i * 2654435761u) % n);
+        m.insert(typename Map::value_type(k, k));
+    }
+    int lo = n / 2 - n / 20, hi = n / 2 + n / 20;
+    for (int s = 0; s < 3; ++s) {
+        double best[2] = {1e30, 1e30};
+        long check[2] = {0, 0};
+        for (int pass = 0; pass < 5; ++pass) {
+            for (int how = 0; how < 2; ++how) {
+                double t0 = seconds();
+                check[how] = scan(m, s, how, lo, hi);
+                double t = seconds() - t0;
+                if (t < best[how]) best[how] = t;
+            }
+        }
+        if (check[0] != check[1]) {
+            printf("%s %s: result mismatch\n", name, scans[s]);
+            return false;
+        }
+        double count = s == 2 ? hi - lo : n;
+        printf("%-9s %-9s iterator %6.1f ns   visitor %6.1f ns\n", name, scans[s],
+               best[0] * 1e9 / count, best[1] * 1e9 / count);
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    if (!run<sjtu::map<int, int> >("plain", n)) return 1;
+    if (!run<sjtu::map<int, int, std::less<int>, threaded_traits> >("threaded", n)) return 1;
+    return 0;
+}
@@ -0,0 +1,115 @@
+/**
+ * Lookups under skewed (Zipf) key popularity: the tree as built, after
+ * optimize() and after rebuild_by_frequency(), keeping and changing the
+ * node layout.
+ *
+ *   g++ -O2 -std=c++11 -I../src frequency.cpp -o frequency
+ *   ./frequency [n] [skew...]         (default: 1000000, 0 0.8 1 1.2)
+ *
+ * n keys are inserted in scrambled order with access_sample = 16; the
+ * rank of each key in popularity is a random permutation, so hot keys lie
+ * anywhere in key order.  For each skew s the k-th most popular key is
+ * looked up with probability proportional to 1 / k^s: n find() calls
+ * train the counters on the tree as built, then a fresh stream of n
+ * find() calls is timed on that tree, on a copy after
+ * optimize(VAN_EMDE_BOAS), after rebuild_by_frequency() and after a
+ * second rebuild_by_frequency(VAN_EMDE_BOAS) (on the halved counters,
+ * which give nearly the same shape).  Prints comparisons and ns per find,
+ * best of 3; the comparator counts its calls, which the times include.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "map.hpp"
+#include "bench_util.hpp"
+
+static unsigned long long compares;
+
+struct CountingLess {
+    bool operator()(int a, int b) const {
+        ++compares;
+        return a < b;
+    }
+};
+
+struct sampled_traits : sjtu::map_traits {
+    static const size_t access_sample = 16;
+};
+
+typedef sjtu::map<int, int, CountingLess, sampled_traits> Map;
+
+// n keys drawn by popularity: byRank[k] is the k-th most popular key
+static void draw(const std::vector<int> &byRank, const std::vector<double> &cdf, int n,
+                 std::vector<int> &out) {
+    out.resize(n);
+    for (int i = 0; i < n; ++i) {
+        double u = rand() / (RAND_MAX + 1.0) * cdf.back();
+        out[i] = byRank[std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin()];
+    }
+}
+
+// Comparisons and ns per find over the queries; false on a missing key
+static bool measure(const Map &m, const std::vector<int> &queries, double &perFind, double &ns) {
+    double best = 1e30;
+    for (int pass = 0; pass < 3; ++pass) {
+        compares = 0;
+        double t0 = seconds();
+        for (size_t i = 0; i < queries.size(); ++i) {
+            if (m.find(queries[i]) == m.cend()) return false;
+        }
+        double t = seconds() - t0;
+        if (t < best) best = t;
+    }
+    perFind = (double)compares / queries.size();
+    ns = best * 1e9 / queries.size();
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    static const double defaults[] = {0, 0.8, 1, 1.2};
+    int count = argc > 2 ? argc - 2 : 4;
+    srand(5);
+    std::vector<int> byRank(n);
+    for (int i = 0; i < n; ++i) byRank[i] = i;
+    for (int i = n - 1; i > 0; --i) std::swap(byRank[i], byRank[rand() % (i + 1)]);
+
+    printf("%52s%s\n", "", "rebuild_by_frequency()");
+    printf("skew    %-22s%-22s%-22s%s\n", "as built", "optimize(vEB)", "keep layout", "vEB layout");
+    for (int c = 0; c < count; ++c) {
+        double skew = argc > 2 ? atof(argv[c + 2]) : defaults[c];
+        std::vector<double> cdf(n);
+        double total = 0;
+        for (int k = 0; k < n; ++k) cdf[k] = total += 1 / pow(k + 1.0, skew);
+
+        Map m;
+        // odd multiplier: a permutation of [0, n) in scrambled order
+        for (long i = 0; i < n; ++i) {
+            int k = (int)((i * 2654435761u) % n);
+            m.insert(Map::value_type(k, k));
+        }
+        std::vector<int> queries;
+        draw(byRank, cdf, n, queries);
+        for (int i = 0; i < n; ++i) m.find(queries[i]);
+        draw(byRank, cdf, n, queries);
+
+        double perFind[4], ns[4];
+        Map balanced(m);
+        balanced.optimize(Map::VAN_EMDE_BOAS);
+        bool ok = measure(m, queries, perFind[0], ns[0]) &&
+                  measure(balanced, queries, perFind[1], ns[1]);
+        m.rebuild_by_frequency();
+        ok = ok && measure(m, queries, perFind[2], ns[2]);
+        m.rebuild_by_frequency(Map::VAN_EMDE_BOAS);
+        if (!ok || !measure(m, queries, perFind[3], ns[3])) {
+            printf("missing key\n");
+            return 1;
+        }
+        printf("%4.1f", skew);
+        for (int v = 0; v < 4; ++v) printf("   %5.1f cmp %6.1f ns", perFind[v], ns[v]);
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+/**
+ * Full traversals with checked and unchecked iterators
+ * (map_traits::checked_iterators).
+ *
+ *   g++ -O2 -std=c++11 -I../src iterator_policy.cpp -o iterator_policy
+ *   ./iterator_policy [n]             (default: 10000000)
+ *
+ * For the plain and the threaded layout: ns per element of a forward
+ * (begin() to end()) and a backward (end() to begin()) traversal summing
+ * every mapped value, best of 5 passes.  Keys are inserted in ascending
+ * order (nodes lie in memory roughly in key order, so the steps themselves
+ * dominate) and in scrambled order (every step is a cache miss).
+ *
+ * Each configuration runs in a forked child (Linux only) that performs the
+ * same allocations, so all maps of one layout get the same node layout.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "map.hpp"
+#include "bench_util.hpp"
+
+struct unchecked_traits : sjtu::map_traits {
+    static const bool checked_iterators = false;
+};
+
+struct threaded_traits : sjtu::map_traits {
+    static const bool threaded = true;
+};
+
+struct threaded_unchecked_traits : threaded_traits {
+    static const bool checked_iterators = false;
+};
+
+typedef sjtu::map<int, int> Checked;
+typedef sjtu::map<int, int, std::less<int>, unchecked_traits> Unchecked;
+typedef sjtu::map<int, int, std::less<int>, threaded_traits> ThreadedChecked;
+typedef sjtu::map<int, int, std::less<int>, threaded_unchecked_traits> ThreadedUnchecked;
+
+// Writes ns per element forward and backward plus a checksum to fd
+template<class Map>
+static void measure(int n, bool scrambled, int fd) {
+    Map *m = new Map;
+    // odd multiplier: a permutation of [0, n) in scrambled order
+    for (long i = 0; i < n; ++i) {
+        int k = scrambled ? (int)((i * 2654435761u) % n) : (int)i;
+        m->insert(typename Map::value_type(k, k));
+    }
+    double result[3] = {1e30, 1e30, 0};
+    for (int pass = 0; pass < 5; ++pass) {
+        long sum = 0;
+        double t0 = seconds();
+        for (typename Map::const_iterator it = m->cbegin(); it != m->cend(); ++it) {
+            sum += it->second;
+        }
+        double t1 = seconds();
+        typename Map::const_iterator it = m->cend(), first = m->cbegin();
+        while (it != first) {
+            --it;
+            sum -= it->second;
+        }
+        double t2 = seconds();
+        if (t1 - t0 < result[0]) result[0] = t1 - t0;
+        if (t2 - t1 < result[1]) result[1] = t2 - t1;
+        result[2] += sum + m->cbegin()->second;
+    }
+    result[0] *= 1e9 / n;
+    result[1] *= 1e9 / n;
+    if (write(fd, result, sizeof(result)) != sizeof(result)) _exit(1);
+}
+
+template<class Map>
+static bool run(int n, bool scrambled, double *result) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        measure<Map>(n, scrambled, fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+    bool ok = read(fds[0], result, 3 * sizeof(double)) == 3 * sizeof(double);
+    close(fds[0]);
+    waitpid(pid, nullptr, 0);
+    return ok;
+}
+
+template<class CheckedMap, class UncheckedMap>
+static bool compare(const char *name, int n, bool scrambled) {
+    double checked[3], unchecked[3];
+    if (!run<CheckedMap>(n, scrambled, checked) || !run<UncheckedMap>(n, scrambled, unchecked)) {
+        return false;
+    }
+    if (checked[2] != unchecked[2]) {
+        printf("%s: result mismatch\n", name);
+        return false;
+    }
+    printf("%-9s checked (%2d bytes) %6.1f / %6.1f ns   unchecked (%2d bytes) %6.1f / %6.1f ns\n",
+           name, (int)sizeof(typename CheckedMap::iterator), checked[0], checked[1],
+           (int)sizeof(typename UncheckedMap::iterator), unchecked[0], unchecked[1]);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 10000000;
+    for (int scrambled = 0; scrambled < 2; ++scrambled) {
+        printf("%s keys, forward / backward traversal, ns per element\n",
+               scrambled ? "scrambled" : "ascending");
+        if (!compare<Checked, Unchecked>("plain", n, scrambled)) return 1;
+        if (!compare<ThreadedChecked, ThreadedUnchecked>("threaded", n, scrambled)) return 1;
+    }
+    return 0;
+}
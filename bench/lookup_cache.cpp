@@ -0,0 +1,109 @@
+/**
+ * find() with and without the lookup cache (map_traits::lookup_cache_slots).
+ *
+ *   g++ -O2 -std=c++11 -I../src lookup_cache.cpp -o lookup_cache
+ *   ./lookup_cache [n]                (default: 1000000)
+ *
+ * Workloads, 4*10^6 lookups each on map<int, int> with n keys:
+ *   hot 16      90% of the probes go to 16 hot keys
+ *   hot 4096    90% of the probes go to 4096 hot keys (cache too small)
+ *   uniform     every key equally likely: nearly every probe misses
+ *   []+insert   operator[] followed by insert() of the same key, as in
+ *               data/one
+ *
+ * Each configuration runs in a forked child (Linux only) that performs the
+ * same allocations, so both maps get the same node layout; where nodes land
+ * in memory moves these timings by more than the cache itself does.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "map.hpp"
+#include "bench_util.hpp"
+
+struct cached_traits : sjtu::map_traits {
+    static const size_t lookup_cache_slots = 256;
+};
+
+typedef sjtu::map<int, int> Plain;
+typedef sjtu::map<int, int, std::less<int>, cached_traits> Cached;
+
+static const char *names[] = {"hot 16", "hot 4096", "uniform", "[]+insert"};
+
+static int randomKey(int n) {
+    return (int)(((long)rand() * RAND_MAX + rand()) % n);
+}
+
+static std::vector<int> probes(int n, int hot) {
+    std::vector<int> keys(4000000);
+    srand(3);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        keys[i] = hot && rand() % 10 ? randomKey(hot) * (n / hot) : randomKey(n);
+    }
+    return keys;
+}
+
+// Writes ns per lookup of workload w, the hit rate and a checksum to fd
+template<class Map>
+static void measure(int n, int w, int fd) {
+    Map *m = new Map;
+    // odd multiplier: a permutation of [0, n) in scrambled order
+    for (long i = 0; i < n; ++i) {
+        int k = (int)((i * 2654435761u) % n);
+        m->insert(typename Map::value_type(k, k));
+    }
+    int hot[] = {16, 4096, 0, 0};
+    std::vector<int> keys = probes(w == 3 ? 2 * n : n, hot[w]);
+    m->reset_lookup_cache_stats();
+    long found = 0;
+    double t0 = seconds();
+    if (w < 3) {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            found += m->find(keys[i]) != m->cend();
+        }
+    } else {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            (*m)[keys[i]] += 1;
+            found += m->insert(typename Map::value_type(keys[i], 0)).second;
+        }
+    }
+    double result[3] = {(seconds() - t0) * 1e9 / keys.size(), 0, (double)found};
+    typename Map::lookup_stats st = m->lookup_cache_stats();
+    if (st.hits + st.misses) result[1] = 100.0 * st.hits / (st.hits + st.misses);
+    if (write(fd, result, sizeof(result)) != sizeof(result)) _exit(1);
+}
+
+template<class Map>
+static bool run(int n, int w, double *result) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        measure<Map>(n, w, fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+    bool ok = read(fds[0], result, 3 * sizeof(double)) == 3 * sizeof(double);
+    close(fds[0]);
+    waitpid(pid, nullptr, 0);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    for (int w = 0; w < 4; ++w) {
+        double plain[3], cached[3];
+        if (!run<Plain>(n, w, plain) || !run<Cached>(n, w, cached)) return 1;
+        if (plain[2] != cached[2]) {
+            printf("%s: result mismatch\n", names[w]);
+            return 1;
+        }
+        printf("%-10s plain %7.1f ns   cached %7.1f ns   hit rate %5.1f%%\n",
+               names[w], plain[0], cached[0], cached[1]);
+    }
+    return 0;
+}
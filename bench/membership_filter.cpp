@@ -0,0 +1,124 @@
+/**
+ * Lookups of mostly absent keys with and without the membership filter
+ * (map_traits::filter_bits_per_key).
+ *
+ *   g++ -O2 -std=c++11 -I../src membership_filter.cpp -o membership_filter
+ *   ./membership_filter [n]           (default: 1000000)
+ *
+ * The map holds n even keys.  Workloads:
+ *   find 90%    4*10^6 find_ptr() calls, 90% of them for odd (absent)
+ *               keys (lookups through a const map, count() among them,
+ *               are filtered alike but not counted in the statistics)
+ *   find 10%    the same with 10% absent keys
+ *   at() miss   10^6 at() calls, half absent, each miss caught, as in
+ *               data/four
+ *   churn       2n random erase/insert pairs first, then "find 90%"
+ *
+ * Each configuration runs in a forked child (Linux only) that performs the
+ * same allocations, so both maps get the same node layout.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "map.hpp"
+#include "bench_util.hpp"
+
+struct filtered_traits : sjtu::map_traits {
+    static const size_t filter_bits_per_key = 10;
+};
+
+typedef sjtu::map<int, int> Plain;
+typedef sjtu::map<int, int, std::less<int>, filtered_traits> Filtered;
+
+static const char *names[] = {"find 90%", "find 10%", "at() miss", "churn"};
+
+static int randomKey(int n) {
+    return (int)(((long)rand() * RAND_MAX + rand()) % n);
+}
+
+// Even keys are present, odd ones absent
+static std::vector<int> probes(int n, size_t count, int absentPercent) {
+    std::vector<int> keys(count);
+    for (size_t i = 0; i < count; ++i) {
+        keys[i] = 2 * randomKey(n) + (rand() % 100 < absentPercent);
+    }
+    return keys;
+}
+
+// Writes ns per lookup, the false-positive rate among absent keys that
+// reached the tree, rebuilds and a checksum to fd
+template<class Map>
+static void measure(int n, int w, int fd) {
+    Map *m = new Map;
+    // odd multiplier: a permutation of [0, n) in scrambled order
+    for (long i = 0; i < n; ++i) {
+        int k = (int)((i * 2654435761u) % n);
+        m->insert(typename Map::value_type(2 * k, k));
+    }
+    srand(5);
+    if (w == 3) {
+        for (long i = 0; i < 2L * n; ++i) {
+            typename Map::iterator it = m->find(2 * randomKey(n));
+            if (it != m->end()) m->erase(it);
+            m->insert(typename Map::value_type(2 * randomKey(n), 0));
+        }
+    }
+    std::vector<int> keys = probes(n, w == 2 ? 1000000 : 4000000, w == 1 ? 10 : w == 2 ? 50 : 90);
+    m->reset_membership_filter_stats();
+    long found = 0;
+    double t0 = seconds();
+    if (w == 2) {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            try {
+                found += m->at(keys[i]);
+            } catch (sjtu::index_out_of_bound &) {
+                --found;
+            }
+        }
+    } else {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            found += m->find_ptr(keys[i]) != nullptr;
+        }
+    }
+    double t = (seconds() - t0) * 1e9 / keys.size();
+    typename Map::filter_stats st = m->membership_filter_stats();
+    size_t absent = st.rejected + st.false_positives;
+    double result[4] = {t, absent ? 100.0 * st.false_positives / absent : 0,
+                        (double)st.rebuilds, (double)found};
+    if (write(fd, result, sizeof(result)) != sizeof(result)) _exit(1);
+}
+
+template<class Map>
+static bool run(int n, int w, double *result) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        measure<Map>(n, w, fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+    bool ok = read(fds[0], result, 4 * sizeof(double)) == 4 * sizeof(double);
+    close(fds[0]);
+    waitpid(pid, nullptr, 0);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    for (int w = 0; w < 4; ++w) {
+        double plain[4], filtered[4];
+        if (!run<Plain>(n, w, plain) || !run<Filtered>(n, w, filtered)) return 1;
+        if (plain[3] != filtered[3]) {
+            printf("%s: result mismatch\n", names[w]);
+            return 1;
+        }
+        printf("%-10s plain %7.1f ns   filtered %7.1f ns   false positives %5.2f%%\n",
+               names[w], plain[0], filtered[0], filtered[1]);
+    }
+    return 0;
+}
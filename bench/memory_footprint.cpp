@@ -0,0 +1,52 @@
+/**
+ * Memory footprint of map<int, int> per node layout.
+ *
+ *   g++ -O2 -std=c++11 -I../src memory_footprint.cpp -o memory_footprint
+ *   ./memory_footprint [n ...]        (default: 1000000 10000000)
+ *
+ * Each measurement runs in a forked child so that the resident set size
+ * (read from /proc/self/statm, Linux only) starts from a clean heap.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "map.hpp"
+#include "bench_util.hpp"
+
+struct compact_traits : sjtu::map_traits {
+    static const bool compact_color = true;
+};
+
+template<class Map>
+static void measure(const char *name, long n) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0) {
+        waitpid(pid, nullptr, 0);
+        return;
+    }
+    long before = residentBytes();
+    Map *m = new Map;
+    // odd multiplier: a permutation of [0, n) in scrambled order
+    for (long i = 0; i < n; ++i) (*m)[(int)((i * 2654435761L) % n)] = (int)i;
+    long after = residentBytes();
+    printf("%-22s n=%-9ld %8.1f MiB  %6.1f bytes/element\n", name, n,
+           (after - before) / 1048576.0, (double)(after - before) / n);
+    fflush(stdout);
+    _exit(0);
+}
+
+int main(int argc, char **argv) {
+    long sizes[] = {1000000, 10000000};
+    int count = 2;
+    if (argc > 1) count = 0;
+    for (int i = 1; i < argc && i <= 2; ++i) sizes[count++] = atol(argv[i]);
+    for (int i = 0; i < count; ++i) {
+        measure<sjtu::map<int, int> >("sjtu::map", sizes[i]);
+        measure<sjtu::map<int, int, std::less<int>, compact_traits> >("sjtu::map compact", sizes[i]);
+        measure<std::map<int, int> >("std::map", sizes[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,59 @@
+/**
+ * Cost of a lookup miss through at() + catch versus the non-throwing
+ * try_at() and find_ptr().
+ *
+ *   g++ -O2 -std=c++11 -I../src miss_paths.cpp -o miss_paths
+ *   ./miss_paths [n]                  (default: 10000)
+ *
+ * Like data/four: the map holds the even keys below 2n and each probe
+ * asks for a random key in [0, 2n), so half of them miss.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "map.hpp"
+#include "bench_util.hpp"
+
+typedef sjtu::map<int, int> Map;
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 10000;
+    Map m;
+    for (int i = 0; i < n; ++i) m[2 * i] = i;
+    std::vector<int> keys(2000000);
+    srand(9);
+    for (size_t i = 0; i < keys.size(); ++i) keys[i] = rand() % (2 * n);
+
+    long sum[3] = {0, 0, 0};
+    double t0 = seconds();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        try {
+            sum[0] += m.at(keys[i]);
+        } catch (sjtu::exception &e) {
+            --sum[0];
+        }
+    }
+    double t1 = seconds();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        int *v;
+        if (m.try_at(keys[i], v) == sjtu::errc::none) {
+            sum[1] += *v;
+        } else {
+            --sum[1];
+        }
+    }
+    double t2 = seconds();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const int *v = m.find_ptr(keys[i]);
+        sum[2] += v ? *v : -1;
+    }
+    double t3 = seconds();
+    if (sum[0] != sum[1] || sum[1] != sum[2]) {
+        printf("result mismatch\n");
+        return 1;
+    }
+    double ns = 1e9 / keys.size();
+    printf("at() + catch %7.1f ns   try_at %7.1f ns   find_ptr %7.1f ns\n",
+           (t1 - t0) * ns, (t2 - t1) * ns, (t3 - t2) * ns);
+    return 0;
+}
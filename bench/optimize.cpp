@@ -0,0 +1,105 @@
+/**
+ * Lookups before and after optimize(), for each node layout.
+ *
+ *   g++ -O2 -std=c++11 -I../src optimize.cpp -o optimize
+ *   ./optimize [n]                    (default: 1000000)
+ *
+ * The map first goes through a long insert/erase history: n scrambled
+ * inserts, then rounds that erase a random half and insert fresh keys,
+ * which leaves nodes scattered over the pool.  Then, for the tree as it
+ * is and after optimize() with each layout (every layout on its own copy
+ * of the history, in a forked child; Linux only): average and maximum
+ * node depth, the time optimize() took, and ns per find() of random
+ * present keys, best of 3.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "map.hpp"
+#include "bench_util.hpp"
+
+typedef sjtu::map<int, int> Map;
+
+// Average depth, maximum depth, ms in optimize(), ns per find, checksum
+static void measure(int n, int layout, int fd) {
+    Map m;
+    std::vector<int> keys;
+    srand(11);
+    // odd multiplier: a permutation of [0, n) in scrambled order
+    for (long i = 0; i < n; ++i) {
+        int k = (int)((i * 2654435761u) % n);
+        m.insert(Map::value_type(k, k));
+        keys.push_back(k);
+    }
+    int fresh = n;
+    for (int round = 0; round < 4; ++round) {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            size_t j = i + rand() % (keys.size() - i);
+            int t = keys[i];
+            keys[i] = keys[j];
+            keys[j] = t;
+        }
+        for (size_t i = 0; i < keys.size() / 2; ++i) {
+            m.erase(m.find(keys[i]));
+            keys[i] = fresh++;
+            m.insert(Map::value_type(keys[i], keys[i]));
+        }
+    }
+    double result[5] = {0, 0, 0, 1e30, 0};
+    if (layout >= 0) {
+        double t0 = seconds();
+        m.optimize(Map::node_layout(layout));
+        result[2] = (seconds() - t0) * 1e3;
+    }
+    Map::depth_stats d = m.tree_depth();
+    result[0] = d.average;
+    result[1] = (double)d.maximum;
+    std::vector<int> probes(2000000);
+    for (size_t i = 0; i < probes.size(); ++i) probes[i] = keys[rand() % keys.size()];
+    for (int pass = 0; pass < 3; ++pass) {
+        long sum = 0;
+        double t0 = seconds();
+        for (size_t i = 0; i < probes.size(); ++i) sum += m.find(probes[i])->second;
+        double t = (seconds() - t0) * 1e9 / probes.size();
+        if (t < result[3]) result[3] = t;
+        result[4] = (double)sum;
+    }
+    if (write(fd, result, sizeof(result)) != sizeof(result)) _exit(1);
+}
+
+static bool run(int n, int layout, double *result) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        measure(n, layout, fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+    bool ok = read(fds[0], result, 5 * sizeof(double)) == 5 * sizeof(double);
+    close(fds[0]);
+    waitpid(pid, nullptr, 0);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    static const char *names[] = {"as is", "KEEP_LAYOUT", "BREADTH_FIRST", "VAN_EMDE_BOAS"};
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    double expect = 0;
+    for (int layout = -1; layout < 3; ++layout) {
+        double r[5];
+        if (!run(n, layout, r)) return 1;
+        if (layout == -1) expect = r[4];
+        if (r[4] != expect) {
+            printf("result mismatch\n");
+            return 1;
+        }
+        printf("%-14s depth avg %5.2f max %2d   optimize %7.1f ms   find %6.1f ns\n",
+               names[layout + 1], r[0], (int)r[1], r[2], r[3]);
+    }
+    return 0;
+}
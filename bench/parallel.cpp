@@ -0,0 +1,101 @@
+/**
+ * Whole-map statistics: sequential for_each() versus parallel_reduce() and
+ * parallel_for_each() on a work_stealing_pool.
+ *
+ *   g++ -O2 -std=c++11 -pthread -I../src parallel.cpp -o parallel
+ *   ./parallel [n] [threads...]       (default: 10000000, 1 2 4 8)
+ *
+ * Statistic: count, sum and sum of squares of the mapped values, as one
+ * reduction.  Also times parallel_for_each() scaling every value in place.
+ * Best of 3 passes.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include "map.hpp"
+#include "work_stealing_pool.hpp"
+#include "bench_util.hpp"
+
+typedef sjtu::map<int, int> Map;
+
+struct Stats {
+    long long count, sum, squares;
+};
+
+struct ToStats {
+    Stats operator()(const Map::value_type &v) const {
+        Stats s = {1, v.second, (long long)v.second * v.second};
+        return s;
+    }
+};
+
+struct AddStats {
+    Stats operator()(const Stats &a, const Stats &b) const {
+        Stats s = {a.count + b.count, a.sum + b.sum, a.squares + b.squares};
+        return s;
+    }
+};
+
+struct Accumulate {
+    Stats *total;
+
+    bool operator()(const Map::value_type &v) const {
+        *total = AddStats()(*total, ToStats()(v));
+        return true;
+    }
+};
+
+struct Flip {
+    void operator()(Map::value_type &v) const {
+        v.second = -v.second;
+    }
+};
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 10000000;
+    Map m;
+    // odd multiplier: a permutation of [0, n) in scrambled order
+    for (long i = 0; i < n; ++i) {
+        int k = (int)((i * 2654435761u) % n);
+        m.insert(Map::value_type(k, k % 1000));
+    }
+    const Stats zero = {0, 0, 0};
+
+    double best = 1e30;
+    Stats expect = zero;
+    for (int pass = 0; pass < 3; ++pass) {
+        Stats total = zero;
+        Accumulate f = {&total};
+        double t0 = seconds();
+        m.for_each(f);
+        double t = seconds() - t0;
+        if (t < best) best = t;
+        expect = total;
+    }
+    printf("sequential for_each        %7.1f ms\n", best * 1e3);
+
+    static const unsigned defaults[] = {1, 2, 4, 8};
+    int count = argc > 2 ? argc - 2 : 4;
+    for (int c = 0; c < count; ++c) {
+        unsigned threads = argc > 2 ? (unsigned)atoi(argv[c + 2]) : defaults[c];
+        sjtu::work_stealing_pool pool(threads);
+        double reduce = 1e30, visit = 1e30;
+        for (int pass = 0; pass < 3; ++pass) {
+            double t0 = seconds();
+            Stats s = m.parallel_reduce(pool, zero, ToStats(), AddStats());
+            double t1 = seconds();
+            m.parallel_for_each(pool, Flip());
+            double t2 = seconds();
+            if (s.count != expect.count || s.sum != expect.sum * (pass % 2 ? -1 : 1) ||
+                s.squares != expect.squares) {
+                printf("result mismatch\n");
+                return 1;
+            }
+            if (t1 - t0 < reduce) reduce = t1 - t0;
+            if (t2 - t1 < visit) visit = t2 - t1;
+        }
+        m.parallel_for_each(pool, Flip());
+        printf("%2u threads  parallel_reduce %7.1f ms   parallel_for_each %7.1f ms\n",
+               threads, reduce * 1e3, visit * 1e3);
+    }
+    return 0;
+}
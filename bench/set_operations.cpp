@@ -0,0 +1,113 @@
+/**
+ * Join-based merge_union(), intersect() and difference() versus the same
+ * operations element by element (insert()/find()/erase() per key of the
+ * other map), across size ratios.
+ *
+ *   g++ -O2 -std=c++11 -pthread -I../src set_operations.cpp -o set_operations
+ *   ./set_operations [n] [threads]    (default: 1000000, hardware threads)
+ *
+ * The larger map holds n keys and the smaller n / ratio, drawn from the
+ * same scrambled range so that about half of the smaller map's keys also
+ * appear in the larger one.  Each row reports ms for the element-by-element
+ * loop, the sequential join-based operation and the pool overload; the
+ * operation always modifies a copy of the larger map (copying is not timed).
+ */
+#include <cstdio>
+#include <cstdlib>
+#include "map.hpp"
+#include "work_stealing_pool.hpp"
+#include "bench_util.hpp"
+
+typedef sjtu::map<int, int> Map;
+
+struct Add {
+    int operator()(const int &mine, const int &theirs) const {
+        return mine + theirs;
+    }
+};
+
+// n keys from [0, 2 * range): a scrambled walk with stride step
+static void fill(Map &m, int n, long range, unsigned step) {
+    for (long i = 0; i < n; ++i) {
+        int k = (int)((i * step) % (2 * range));
+        m.insert(Map::value_type(k, 1));
+    }
+}
+
+static long checksum(const Map &m) {
+    long sum = 0;
+    for (Map::const_iterator it = m.cbegin(); it != m.cend(); ++it) sum += it->first ^ it->second;
+    return sum + (long)m.size();
+}
+
+static void byElement(Map &big, const Map &small, int op) {
+    if (op == 0) {
+        for (Map::const_iterator it = small.cbegin(); it != small.cend(); ++it) {
+            Map::iterator at = big.find(it->first);
+            if (at != big.end()) {
+                at->second += it->second;
+            } else {
+                big.insert(*it);
+            }
+        }
+    } else if (op == 1) {
+        Map kept;
+        for (Map::const_iterator it = small.cbegin(); it != small.cend(); ++it) {
+            Map::const_iterator at = big.find(it->first);
+            if (at != big.cend()) kept.insert(*at);
+        }
+        big = kept;
+    } else {
+        for (Map::const_iterator it = small.cbegin(); it != small.cend(); ++it) {
+            Map::iterator at = big.find(it->first);
+            if (at != big.end()) big.erase(at);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    static const char *ops[] = {"union", "intersect", "difference"};
+    static const int ratios[] = {1, 4, 16, 256, 4096};
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    sjtu::work_stealing_pool pool(argc > 2 ? (unsigned)atoi(argv[2]) : 0);
+    printf("n = %d, %u pool threads; ms per operation (best of 3)\n", n, pool.size());
+    for (size_t r = 0; r < sizeof(ratios) / sizeof(ratios[0]); ++r) {
+        int m = n / ratios[r];
+        Map big, small;
+        // odd multipliers: scrambled keys from [0, 2n), n apart per map
+        fill(big, n, n, 2654435761u);
+        fill(small, m, n, 40503u * 2 + 1);
+        for (int op = 0; op < 3; ++op) {
+            double best[3] = {1e30, 1e30, 1e30};
+            long check[3] = {0, 0, 0};
+            for (int pass = 0; pass < 3; ++pass) {
+                for (int how = 0; how < 3; ++how) {
+                    Map x(big);
+                    double t0 = seconds();
+                    if (how == 0) {
+                        byElement(x, small, op);
+                    } else if (op == 0) {
+                        if (how == 1) x.merge_union(small, Add());
+                        else x.merge_union(pool, small, Add());
+                    } else if (op == 1) {
+                        if (how == 1) x.intersect(small);
+                        else x.intersect(pool, small);
+                    } else {
+                        if (how == 1) x.difference(small);
+                        else x.difference(pool, small);
+                    }
+                    double t = seconds() - t0;
+                    if (t < best[how]) best[how] = t;
+                    check[how] = checksum(x);
+                }
+            }
+            if (check[0] != check[1] || check[1] != check[2]) {
+                printf("%s 1:%d: result mismatch\n", ops[op], ratios[r]);
+                return 1;
+            }
+            printf("1:%-5d %-10s  by element %8.2f   join %8.2f   join on pool %8.2f\n",
+                   ratios[r], ops[op], best[0] * 1e3, best[1] * 1e3, best[2] * 1e3);
+        }
+    }
+    return 0;
+}
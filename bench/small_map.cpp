@@ -0,0 +1,122 @@
+/**
+ * Millions of tiny maps: sjtu::small_map with 4 and 8 inline elements
+ * versus sjtu::map.
+ *
+ *   g++ -O2 -std=c++11 -I../src small_map.cpp -o small_map
+ *   ./small_map [maps]                (default: 1048576)
+ *
+ * For each size s, a vector of maps of s int -> int elements each
+ * (keys inserted in shuffled order), then per map or operation:
+ *   build   ns per map to construct it and insert its elements
+ *   bytes   resident bytes per map (read from /proc/self/statm),
+ *           including the map object itself
+ *   find    ns per find() of a random key in a random map
+ *   free    ns per map to destroy it
+ * Sizes past 4 and 8 show the cost of moving to the tree.  Best of 3.
+ * Each configuration runs in a forked child (Linux only) so all of them
+ * start from the same heap.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include "map.hpp"
+#include "small_map.hpp"
+#include "bench_util.hpp"
+
+typedef sjtu::map<int, int> TreeMap;
+typedef sjtu::small_map<int, int, std::less<int>, 4> Small4;
+typedef sjtu::small_map<int, int, std::less<int>, 8> Small8;
+
+static const int OPS = 4, RESULTS = OPS + 1, LOOKUPS = 1 << 22, CONFIGS = 3;
+static const char *names[OPS] = {"build ns", "bytes", "find ns", "free ns"};
+
+// Writes ns per map built, bytes per map, ns per find, ns per map freed
+// and a checksum to fd
+template<class Map>
+static void measure(int size, int count, int fd) {
+    double result[RESULTS] = {1e30, 0, 1e30, 1e30, 0};
+    srand(11);
+    std::vector<int> order(size > 0 ? size : 1);
+    for (int i = 0; i < size; ++i) order[i] = i;
+    for (int i = size - 1; i > 0; --i) std::swap(order[i], order[rand() % (i + 1)]);
+    std::vector<int> which(LOOKUPS), keys(LOOKUPS);
+    for (int i = 0; i < LOOKUPS; ++i) {
+        which[i] = rand() % count;
+        keys[i] = size > 0 ? rand() % size : 0;
+    }
+    for (int pass = 0; pass < 3; ++pass) {
+        long before = residentBytes();
+        double t0 = seconds();
+        std::vector<Map> *maps = new std::vector<Map>(count);
+        for (int j = 0; j < count; ++j) {
+            for (int i = 0; i < size; ++i) (*maps)[j].insert(typename Map::value_type(order[i], j + i));
+        }
+        double t = seconds() - t0;
+        if (t < result[0]) result[0] = t;
+        if (pass == 0) result[1] = (double)(residentBytes() - before) / count;
+
+        long sum = 0;
+        t0 = seconds();
+        for (int i = 0; i < LOOKUPS; ++i) {
+            typename Map::const_iterator it = static_cast<const Map &>((*maps)[which[i]]).find(keys[i]);
+            if (it != (*maps)[which[i]].cend()) sum += it->second;
+        }
+        t = seconds() - t0;
+        if (t < result[2]) result[2] = t;
+
+        t0 = seconds();
+        delete maps;
+        t = seconds() - t0;
+        if (t < result[3]) result[3] = t;
+        result[4] += sum;
+    }
+    result[0] *= 1e9 / count;
+    result[2] *= 1e9 / LOOKUPS;
+    result[3] *= 1e9 / count;
+    if (write(fd, result, sizeof(result)) != sizeof(result)) _exit(1);
+}
+
+template<class Map>
+static bool run(int size, int count, double *result) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        measure<Map>(size, count, fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+    size_t bytes = RESULTS * sizeof(double);
+    bool ok = read(fds[0], result, bytes) == (ssize_t)bytes;
+    close(fds[0]);
+    waitpid(pid, nullptr, 0);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 1 << 20;
+    static const int sizes[] = {0, 1, 2, 4, 5, 8, 9, 16};
+    printf("%d maps of each size; sjtu::map / small_map<4> / small_map<8>\n%4s", count, "size");
+    for (int op = 0; op < OPS; ++op) printf("  %-23s", names[op]);
+    printf("\n");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        double r[CONFIGS][RESULTS];
+        if (!run<TreeMap>(sizes[s], count, r[0]) || !run<Small4>(sizes[s], count, r[1]) ||
+            !run<Small8>(sizes[s], count, r[2])) {
+            return 1;
+        }
+        if (r[1][OPS] != r[0][OPS] || r[2][OPS] != r[0][OPS]) {
+            printf("result mismatch\n");
+            return 1;
+        }
+        printf("%4d", sizes[s]);
+        for (int op = 0; op < OPS; ++op) printf("  %7.1f %7.1f %7.1f", r[0][op], r[1][op], r[2][op]);
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,142 @@
+/**
+ * Splay tree (map_traits::splay_tree) versus red-black tree on access
+ * traces with temporal locality.
+ *
+ *   g++ -O2 -std=c++11 -I../src splay.cpp -o splay
+ *   ./splay [n] [burst]               (default: 1000000, 100)
+ *
+ * n keys are inserted in scrambled order, then each trace runs n
+ * operations:
+ *   bursts    find() of one of 8 keys, the 8 redrawn at random from all n
+ *             keys every burst operations
+ *   window    find() of a key among the 1024 above a base that moves up
+ *             by one every burst operations
+ *   counters  ++m[k] on the keys of "bursts", half of them new keys
+ *   uniform   find() of a key drawn uniformly from all n (no locality)
+ *   const     "bursts" through a const reference, which never splays
+ * ns per operation and comparisons per operation, best of 3; the
+ * comparator counts its calls, which the times include.  Each tree runs
+ * in a forked child (Linux only) so both start from the same heap.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include "map.hpp"
+#include "bench_util.hpp"
+
+static unsigned long long compares;
+
+struct CountingLess {
+    bool operator()(int a, int b) const {
+        ++compares;
+        return a < b;
+    }
+};
+
+struct red_black_traits : sjtu::map_traits {
+    static const bool avl_balancing = false;
+};
+
+struct splay_traits : sjtu::map_traits {
+    static const bool splay_tree = true;
+};
+
+static const int TRACES = 5, RESULTS = 2 * TRACES + 1;
+static const char *names[TRACES] = {"bursts", "window", "counters", "uniform", "const"};
+static const int HOT = 8, WINDOW = 1024;
+
+// The keys of a trace; the counters trace draws from twice the key range
+static void trace(int kind, int n, int burst, std::vector<int> &keys) {
+    keys.resize(n);
+    srand(7 + kind);
+    int hot[HOT], base = 0;
+    for (int i = 0; i < n; ++i) {
+        if (i % burst == 0) {
+            for (int h = 0; h < HOT; ++h) hot[h] = rand() % (kind == 2 ? 2 * n : n);
+            if (i > 0) ++base;
+        }
+        if (kind == 1) keys[i] = (base + rand() % WINDOW) % n;
+        else if (kind == 3) keys[i] = rand() % n;
+        else keys[i] = hot[rand() % HOT];
+    }
+}
+
+// Writes ns and comparisons per operation of every trace and a checksum
+// to fd
+template<class Map>
+static void measure(int n, int burst, int fd) {
+    double result[RESULTS];
+    result[RESULTS - 1] = 0;
+    Map m;
+    // odd multiplier: a permutation of [0, n) in scrambled order
+    for (long i = 0; i < n; ++i) {
+        int k = (int)((i * 2654435761u) % n);
+        m.insert(typename Map::value_type(k, k));
+    }
+    std::vector<int> keys;
+    for (int kind = 0; kind < TRACES; ++kind) {
+        trace(kind == 4 ? 0 : kind, n, burst, keys);
+        double best = 1e30;
+        long sum = 0;
+        for (int pass = 0; pass < 3; ++pass) {
+            Map copy(m);
+            const Map &reader = copy;
+            compares = 0;
+            double t0 = seconds();
+            if (kind == 2) {
+                for (int i = 0; i < n; ++i) sum += ++copy[keys[i]];
+            } else if (kind == 4) {
+                for (int i = 0; i < n; ++i) sum += reader.find(keys[i])->second;
+            } else {
+                for (int i = 0; i < n; ++i) sum += copy.find(keys[i])->second;
+            }
+            double t = seconds() - t0;
+            if (t < best) best = t;
+        }
+        result[2 * kind] = best * 1e9 / n;
+        result[2 * kind + 1] = (double)compares / n;
+        result[RESULTS - 1] += sum;
+    }
+    if (write(fd, result, sizeof(result)) != sizeof(result)) _exit(1);
+}
+
+template<class Map>
+static bool run(int n, int burst, double *result) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        measure<Map>(n, burst, fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+    size_t size = RESULTS * sizeof(double);
+    bool ok = read(fds[0], result, size) == (ssize_t)size;
+    close(fds[0]);
+    waitpid(pid, nullptr, 0);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    int burst = argc > 2 ? atoi(argv[2]) : 100;
+    double rb[RESULTS], splay[RESULTS];
+    if (!run<sjtu::map<int, int, CountingLess, red_black_traits> >(n, burst, rb) ||
+        !run<sjtu::map<int, int, CountingLess, splay_traits> >(n, burst, splay)) {
+        return 1;
+    }
+    if (rb[RESULTS - 1] != splay[RESULTS - 1]) {
+        printf("result mismatch\n");
+        return 1;
+    }
+    printf("per operation      red-black          splay\n");
+    for (int t = 0; t < TRACES; ++t) {
+        printf("%-12s  %6.1f ns %5.1f cmp  %6.1f ns %5.1f cmp\n", names[t], rb[2 * t],
+               rb[2 * t + 1], splay[2 * t], splay[2 * t + 1]);
+    }
+    return 0;
+}
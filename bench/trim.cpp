@@ -0,0 +1,91 @@
+/**
+ * Retention trimming of a time series: erase(begin()) loops versus
+ * pop_front() and trim_before().
+ *
+ *   g++ -O2 -std=c++11 -I../src trim.cpp -o trim
+ *   ./trim [n] [window]               (default: 1000000, 100000)
+ *
+ * Timestamps 0, 1, 2, ... are inserted in order; after every batch of
+ * window / 10 inserts everything older than the last window timestamps
+ * is dropped, by
+ *   loop        while (begin()->first < cutoff) erase(begin())
+ *   pop_front   while (begin()->first < cutoff) pop_front()
+ *   trim        trim_before(cutoff)
+ * Also drains a full map of n elements front to back, like data/one:
+ * erase(begin()) until empty versus pop_front() until empty.
+ * ms per run, best of 3; only the erasing is timed.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include "map.hpp"
+#include "bench_util.hpp"
+
+typedef sjtu::map<int, int> Map;
+
+// Returns the seconds spent trimming; *check gets a digest of the result
+static double retain(int n, int window, int how, long *check) {
+    Map m;
+    double spent = 0;
+    int batch = window / 10 > 0 ? window / 10 : 1;
+    for (int t = 0; t < n;) {
+        for (int end = t + batch; t < end && t < n; ++t) m.insert(Map::value_type(t, t));
+        int cutoff = t - window;
+        double t0 = seconds();
+        if (how == 2) {
+            m.trim_before(cutoff);
+        } else {
+            while (!m.empty() && m.begin()->first < cutoff) {
+                if (how == 0) {
+                    m.erase(m.begin());
+                } else {
+                    m.pop_front();
+                }
+            }
+        }
+        spent += seconds() - t0;
+    }
+    *check = (long)m.size() * n + m.cbegin()->first;
+    return spent;
+}
+
+static double drain(int n, int how) {
+    Map m;
+    for (int t = 0; t < n; ++t) m.insert(Map::value_type(t, t));
+    double t0 = seconds();
+    if (how == 0) {
+        while (m.begin() != m.end()) m.erase(m.begin());
+    } else {
+        while (!m.empty()) m.pop_front();
+    }
+    return seconds() - t0;
+}
+
+int main(int argc, char **argv) {
+    static const char *names[] = {"erase(begin()) loop", "pop_front loop", "trim_before"};
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    int window = argc > 2 ? atoi(argv[2]) : 100000;
+    long expect = 0;
+    for (int how = 0; how < 3; ++how) {
+        double best = 1e30;
+        for (int pass = 0; pass < 3; ++pass) {
+            long check;
+            double t = retain(n, window, how, &check);
+            if (t < best) best = t;
+            if (how == 0) expect = check;
+            if (check != expect) {
+                printf("result mismatch\n");
+                return 1;
+            }
+        }
+        printf("retention  %-20s %8.2f ms\n", names[how], best * 1e3);
+    }
+    for (int how = 0; how < 2; ++how) {
+        double best = 1e30;
+        for (int pass = 0; pass < 3; ++pass) {
+            double t = drain(n, how);
+            if (t < best) best = t;
+        }
+        printf("drain      %-20s %8.2f ms\n", names[how], best * 1e3);
+    }
+    return 0;
+}
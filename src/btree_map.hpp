@@ -0,0 +1,775 @@
+/**
+* a container like sjtu::map, kept in a B+ tree of wide nodes
+*/
+#ifndef SJTU_BTREE_MAP_HPP
+#define SJTU_BTREE_MAP_HPP
+
+// only for std::less<T>
+#include <functional>
+#include <cstddef>
+// placement new for the slots of a node
+#include <new>
+#include "utility.hpp"
+#include "exceptions.hpp"
+// errc and the SJTU_THROW / SJTU_TRY macros
+#include "map.hpp"
+
+namespace sjtu {
+
+/**
+ * Sorted map with the interface of sjtu::map, kept in a B+ tree: the
+ * elements sit in leaves of many elements each, linked in key order,
+ * under inner nodes of many separator keys each.  Every node takes
+ * about NodeBytes bytes (sixteen cache lines by default; 4096 gives
+ * a page), so a lookup misses the cache once or twice per level over
+ * log_B(n) levels, instead of once per level over about log2(n) levels
+ * of sjtu::map.  A node holds at most 255 keys.
+ *
+ * A node keeps its elements in fixed slots plus a byte permutation of
+ * the slots in key order, so an insert or erase inside a node shifts
+ * bytes and never moves an element; Key and T are only ever copied.
+ *
+ * Iterator invalidation differs from sjtu::map, where only erasing an
+ * element invalidates its iterators:
+ *  - insert() and operator[] that add an element to a full leaf split
+ *    it, moving the upper half of its elements to a new leaf; iterators,
+ *    pointers and references to the moved elements become invalid.  An
+ *    insert that finds room in its leaf, or finds the key already
+ *    present, invalidates nothing.
+ *  - erase() invalidates only the erased element.  It never moves the
+ *    others: a leaf is not merged with its neighbours but freed once it
+ *    is empty, so erase never throws and a map that shrinks keeps its
+ *    sparse leaves until it is cleared.
+ *  - end() stays valid throughout.
+ * Iterators check for the end and for the wrong map like sjtu::map's,
+ * but an iterator made invalid by a split is not detected.
+ */
+template<
+   class Key,
+   class T,
+   class Compare = std::less <Key>,
+   size_t NodeBytes = 1024
+   > class btree_map {
+  public:
+   typedef pair<const Key, T> value_type;
+
+  private:
+   // Slots that fit in Room bytes at Each bytes apiece, within what a
+   // byte permutation can index and no fewer than a split needs
+   template<size_t Room, size_t Each>
+   struct Fit {
+       static const size_t value = Room < 4 * Each ? 4 : Room / Each > 255 ? 255 : Room / Each;
+   };
+
+   // Elements of a leaf: a value slot and two permutation bytes each
+   // after the count and the two list links
+   static const size_t LEAF_SLOTS =
+       Fit<(NodeBytes > 3 * sizeof(void *) ? NodeBytes - 3 * sizeof(void *) : 0),
+           sizeof(value_type) + 2>::value;
+   // Separator keys of an inner node, each with a child link and a
+   // permutation byte, after the count and the first child link
+   static const size_t INNER_KEYS =
+       Fit<(NodeBytes > 2 * sizeof(void *) ? NodeBytes - 2 * sizeof(void *) : 0),
+           sizeof(Key) + sizeof(void *) + 1>::value;
+   // Bound on the height.  Each new level takes at least twice as many
+   // splits of the level below as the one before it did, so a height of
+   // 64 would take some 2^64 inserts.
+   static const int MAX_HEIGHT = 64;
+
+   struct Node {
+       unsigned count;
+   };
+
+   // order[i] is the slot of the i-th smallest element and rank[s] the
+   // position of slot s in order; order[count..] lists the free slots
+   struct Leaf : Node {
+       Leaf *prev, *next;
+       unsigned char order[LEAF_SLOTS];
+       unsigned char rank[LEAF_SLOTS];
+       alignas(value_type) unsigned char storage[LEAF_SLOTS * sizeof(value_type)];
+
+       Leaf() : prev(nullptr), next(nullptr) {
+           this->count = 0;
+           for (size_t s = 0; s < LEAF_SLOTS; ++s) order[s] = rank[s] = (unsigned char)s;
+       }
+
+       value_type *slot(unsigned s) { return reinterpret_cast<value_type *>(storage) + s; }
+   };
+
+   // Child i holds the keys from separator i - 1 (inclusive) up to
+   // separator i; count is the number of separators
+   struct Inner : Node {
+       Node *child[INNER_KEYS + 1];
+       unsigned char order[INNER_KEYS];
+       alignas(Key) unsigned char storage[INNER_KEYS * sizeof(Key)];
+
+       Inner() {
+           this->count = 0;
+           for (size_t s = 0; s < INNER_KEYS; ++s) order[s] = (unsigned char)s;
+       }
+
+       Key *slot(unsigned s) { return reinterpret_cast<Key *>(storage) + s; }
+   };
+
+   Node *root;      // null when the map is empty
+   Leaf *head, *tail;
+   int height;      // levels of inner nodes above the leaves
+   size_t elementCount;
+   Compare comp;
+
+   const Key &leafKey(Leaf *l, unsigned i) const {
+       return l->slot(l->order[i])->first;
+   }
+
+   const Key &innerKey(Inner *n, unsigned i) const {
+       return *n->slot(n->order[i]);
+   }
+
+   // Position of the first element of l not less than k.  The halving
+   // steps pick the next base without a branch, so the search costs no
+   // mispredictions however the comparisons fall.
+   unsigned lowerBound(Leaf *l, const Key &k) const {
+       if (l->count == 0) return 0;
+       unsigned base = 0, n = l->count;
+       while (n > 1) {
+           unsigned half = n / 2;
+           base = comp(leafKey(l, base + half), k) ? base + half : base;
+           n -= half;
+       }
+       return base + comp(leafKey(l, base), k);
+   }
+
+   // Child of n whose range holds k: the number of separators <= k
+   unsigned childIndex(Inner *n, const Key &k) const {
+       if (n->count == 0) return 0;
+       unsigned base = 0, len = n->count;
+       while (len > 1) {
+           unsigned half = len / 2;
+           base = comp(k, innerKey(n, base + half)) ? base : base + half;
+           len -= half;
+       }
+       return base + !comp(k, innerKey(n, base));
+   }
+
+   // Request every cache line of a node at once, so that the probes of
+   // its binary search do not miss one after another.  Needs a builtin,
+   // so like sjtu::map it prefetches only under SJTU_MAP_USE_BUILTINS.
+#if SJTU_MAP_USE_BUILTINS
+   static void prefetchNode(const Node *x, size_t bytes) {
+       const char *p = reinterpret_cast<const char *>(x);
+       for (size_t b = 0; b < bytes; b += 64) __builtin_prefetch(p + b);
+   }
+#else
+   static void prefetchNode(const Node *, size_t) {}
+#endif
+
+   // Leaf whose range holds k (null when empty), recording the inner
+   // nodes passed and the child taken in each when path is given
+   Leaf *descend(const Key &k, Inner **path = nullptr, unsigned *index = nullptr) const {
+       Node *x = root;
+       for (int h = 0; x && h < height; ++h) {
+           Inner *n = static_cast<Inner *>(x);
+           unsigned i = childIndex(n, k);
+           if (path) {
+               path[h] = n;
+               index[h] = i;
+           }
+           x = n->child[i];
+           prefetchNode(x, h + 1 < height ? sizeof(Inner) : sizeof(Leaf));
+       }
+       return static_cast<Leaf *>(x);
+   }
+
+   // Slot of k in leaf, or false if k is absent
+   bool findSlot(const Key &k, Leaf *&leaf, unsigned &s) const {
+       leaf = descend(k);
+       if (!leaf) return false;
+       unsigned i = lowerBound(leaf, k);
+       if (i == leaf->count || comp(k, leafKey(leaf, i))) return false;
+       s = leaf->order[i];
+       return true;
+   }
+
+   // Iterator steps; false where there is no next / previous element
+   static bool stepForward(Leaf *&l, unsigned &s) {
+       if (!l) return false;
+       unsigned i = l->rank[s] + 1u;
+       if (i < l->count) {
+           s = l->order[i];
+       } else {
+           l = l->next;
+           s = l ? l->order[0] : 0;
+       }
+       return true;
+   }
+
+   bool stepBackward(Leaf *&l, unsigned &s) const {
+       if (!l) {
+           if (!tail) return false;
+           l = tail;
+           s = l->order[l->count - 1];
+           return true;
+       }
+       unsigned i = l->rank[s];
+       if (i > 0) {
+           s = l->order[i - 1];
+       } else {
+           if (!l->prev) return false;
+           l = l->prev;
+           s = l->order[l->count - 1];
+       }
+       return true;
+   }
+
+   bool isFull(Node *x, int level) const {
+       return x->count == (level == 0 ? LEAF_SLOTS : INNER_KEYS);
+   }
+
+   // Put the separator just constructed in p's first free slot at
+   // position i, with child c to its right
+   static void insertChild(Inner *p, unsigned i, Node *c) {
+       unsigned char s = p->order[p->count];
+       for (unsigned j = p->count; j > i; --j) {
+           p->order[j] = p->order[j - 1];
+           p->child[j + 1] = p->child[j];
+       }
+       p->order[i] = s;
+       p->child[i + 1] = c;
+       ++p->count;
+   }
+
+   // Drop child i of p and the separator next to it
+   static void removeChild(Inner *p, unsigned i) {
+       unsigned k = i > 0 ? i - 1 : 0;
+       unsigned char s = p->order[k];
+       p->slot(s)->~Key();
+       for (unsigned j = k; j + 1 < p->count; ++j) p->order[j] = p->order[j + 1];
+       p->order[p->count - 1] = s;
+       for (unsigned j = i; j < p->count; ++j) p->child[j] = p->child[j + 1];
+       --p->count;
+   }
+
+   // Split the full leaf p->child[i], moving its upper half to a new
+   // leaf.  Only the copies can throw, and then nothing has changed.
+   void splitLeaf(Inner *p, unsigned i) {
+       Leaf *l = static_cast<Leaf *>(p->child[i]);
+       Leaf *r = new Leaf();
+       unsigned mid = l->count / 2, moved = 0;
+       SJTU_TRY {
+           for (; mid + moved < l->count; ++moved) {
+               new (r->slot(moved)) value_type(*l->slot(l->order[mid + moved]));
+           }
+           new (p->slot(p->order[p->count])) Key(r->slot(0)->first);
+       } SJTU_CATCH_ALL {
+           while (moved > 0) r->slot(--moved)->~value_type();
+           delete r;
+           SJTU_RETHROW;
+       }
+       for (unsigned j = mid; j < l->count; ++j) l->slot(l->order[j])->~value_type();
+       r->count = moved;
+       l->count = mid;
+       r->prev = l;
+       r->next = l->next;
+       if (l->next) l->next->prev = r;
+       else tail = r;
+       l->next = r;
+       insertChild(p, i, r);
+   }
+
+   // Split the full inner node p->child[i]: its middle separator moves
+   // up to p, the separators and children after it to a new node
+   void splitInner(Inner *p, unsigned i) {
+       Inner *l = static_cast<Inner *>(p->child[i]);
+       Inner *r = new Inner();
+       unsigned mid = l->count / 2, moved = 0;
+       SJTU_TRY {
+           for (; mid + 1 + moved < l->count; ++moved) {
+               new (r->slot(moved)) Key(innerKey(l, mid + 1 + moved));
+           }
+           new (p->slot(p->order[p->count])) Key(innerKey(l, mid));
+       } SJTU_CATCH_ALL {
+           while (moved > 0) r->slot(--moved)->~Key();
+           delete r;
+           SJTU_RETHROW;
+       }
+       for (unsigned j = 0; j <= moved; ++j) r->child[j] = l->child[mid + 1 + j];
+       for (unsigned j = mid; j < l->count; ++j) l->slot(l->order[j])->~Key();
+       r->count = moved;
+       l->count = mid;
+       insertChild(p, i, r);
+   }
+
+   void splitChild(Inner *p, unsigned i, int level) {
+       if (level == 0) splitLeaf(p, i);
+       else splitInner(p, i);
+   }
+
+   // Leaf for k with room for one more element.  Splits every full node
+   // on the way down, so the parent of each split has room for the new
+   // separator; a split that throws leaves the tree as it was, and the
+   // splits before it leave a valid tree.
+   Leaf *makeRoom(const Key &k) {
+       if (!root) {
+           Leaf *l = new Leaf();
+           root = head = tail = l;
+           return l;
+       }
+       if (isFull(root, height)) {
+           Inner *r = new Inner();
+           r->child[0] = root;
+           SJTU_TRY {
+               splitChild(r, 0, height);
+           } SJTU_CATCH_ALL {
+               delete r;
+               SJTU_RETHROW;
+           }
+           root = r;
+           ++height;
+       }
+       Node *x = root;
+       for (int h = height; h > 0; --h) {
+           Inner *n = static_cast<Inner *>(x);
+           unsigned i = childIndex(n, k);
+           if (isFull(n->child[i], h - 1)) {
+               splitChild(n, i, h - 1);
+               if (!comp(k, innerKey(n, i))) ++i;
+           }
+           x = n->child[i];
+       }
+       return static_cast<Leaf *>(x);
+   }
+
+   // Take the value just constructed in l's first free slot in at
+   // position i
+   static void insertAt(Leaf *l, unsigned i) {
+       unsigned char s = l->order[l->count];
+       for (unsigned j = l->count; j > i; --j) {
+           l->order[j] = l->order[j - 1];
+           l->rank[l->order[j]] = (unsigned char)j;
+       }
+       l->order[i] = s;
+       l->rank[s] = (unsigned char)i;
+       ++l->count;
+   }
+
+   void eraseAt(Leaf *l, unsigned s) {
+       if (l->count == 1) {
+           Inner *path[MAX_HEIGHT];
+           unsigned index[MAX_HEIGHT];
+           descend(l->slot(s)->first, path, index);
+           l->slot(s)->~value_type();
+           removeLeaf(l, path, index);
+       } else {
+           l->slot(s)->~value_type();
+           for (unsigned j = l->rank[s]; j + 1 < l->count; ++j) {
+               l->order[j] = l->order[j + 1];
+               l->rank[l->order[j]] = (unsigned char)j;
+           }
+           l->order[l->count - 1] = (unsigned char)s;
+           --l->count;
+       }
+       --elementCount;
+   }
+
+   // Free the emptied leaf l along with every ancestor it leaves without
+   // children, then drop root levels left with a single child
+   void removeLeaf(Leaf *l, Inner **path, unsigned *index) {
+       if (l->prev) l->prev->next = l->next;
+       else head = l->next;
+       if (l->next) l->next->prev = l->prev;
+       else tail = l->prev;
+       delete l;
+       int h = height;
+       while (h > 0 && path[h - 1]->count == 0) delete path[--h];
+       if (h == 0) {
+           root = nullptr;
+           height = 0;
+           return;
+       }
+       removeChild(path[h - 1], index[h - 1]);
+       while (height > 0 && root->count == 0) {
+           Inner *r = static_cast<Inner *>(root);
+           root = r->child[0];
+           delete r;
+           --height;
+       }
+   }
+
+   static void destroyNode(Node *x, int level) {
+       if (level == 0) {
+           Leaf *l = static_cast<Leaf *>(x);
+           for (unsigned i = 0; i < l->count; ++i) l->slot(l->order[i])->~value_type();
+           delete l;
+           return;
+       }
+       Inner *n = static_cast<Inner *>(x);
+       for (unsigned i = 0; i <= n->count; ++i) destroyNode(n->child[i], level - 1);
+       for (unsigned i = 0; i < n->count; ++i) n->slot(n->order[i])->~Key();
+       delete n;
+   }
+
+   // Copy of the subtree x with its slots in key order; its leaves are
+   // linked after last, which ends up at the last of them.  If a copy
+   // throws, the part of the subtree copied so far is freed.
+   static Node *cloneNode(Node *x, int level, Leaf *&last) {
+       if (level == 0) {
+           Leaf *from = static_cast<Leaf *>(x), *l = new Leaf();
+           unsigned i = 0;
+           SJTU_TRY {
+               for (; i < from->count; ++i) new (l->slot(i)) value_type(*from->slot(from->order[i]));
+           } SJTU_CATCH_ALL {
+               while (i > 0) l->slot(--i)->~value_type();
+               delete l;
+               SJTU_RETHROW;
+           }
+           l->count = i;
+           l->prev = last;
+           if (last) last->next = l;
+           last = l;
+           return l;
+       }
+       Inner *from = static_cast<Inner *>(x), *n = new Inner();
+       unsigned keys = 0, children = 0;
+       SJTU_TRY {
+           for (; children <= from->count; ++children) {
+               if (children > 0) {
+                   new (n->slot(keys)) Key(*from->slot(from->order[keys]));
+                   ++keys;
+               }
+               n->child[children] = cloneNode(from->child[children], level - 1, last);
+           }
+       } SJTU_CATCH_ALL {
+           while (children > 0) destroyNode(n->child[--children], level - 1);
+           while (keys > 0) n->slot(--keys)->~Key();
+           delete n;
+           SJTU_RETHROW;
+       }
+       n->count = keys;
+       return n;
+   }
+
+  public:
+   class const_iterator;
+   class iterator {
+      private:
+       const btree_map *owner;
+       Leaf *leaf;      // null at end()
+       unsigned slot;
+
+       friend class btree_map;
+       friend class const_iterator;
+
+      public:
+       iterator(const btree_map *m = nullptr, Leaf *l = nullptr, unsigned s = 0)
+           : owner(m), leaf(l), slot(s) {}
+
+       iterator(const iterator &other) : owner(other.owner), leaf(other.leaf), slot(other.slot) {}
+
+       iterator &operator=(const iterator &) = default;
+
+       /**
+        * Checked steps that report instead of throwing: move and return
+        * errc::none, or leave the iterator as it is and return
+        * errc::invalid_iterator where ++ / -- would throw.
+        */
+       errc try_increment() {
+           return stepForward(leaf, slot) ? errc::none : errc::invalid_iterator;
+       }
+
+       errc try_decrement() {
+           if (!owner || !owner->stepBackward(leaf, slot)) return errc::invalid_iterator;
+           return errc::none;
+       }
+
+       iterator operator++(int) {
+           iterator temp = *this;
+           ++*this;
+           return temp;
+       }
+
+       iterator &operator++() {
+           if (try_increment() != errc::none) SJTU_THROW(invalid_iterator());
+           return *this;
+       }
+
+       iterator operator--(int) {
+           iterator temp = *this;
+           --*this;
+           return temp;
+       }
+
+       iterator &operator--() {
+           if (try_decrement() != errc::none) SJTU_THROW(invalid_iterator());
+           return *this;
+       }
+
+       value_type &operator*() const {
+           if (!leaf) SJTU_THROW(invalid_iterator());
+           return *leaf->slot(slot);
+       }
+
+       bool operator==(const iterator &rhs) const {
+           return owner == rhs.owner && leaf == rhs.leaf && slot == rhs.slot;
+       }
+
+       bool operator==(const const_iterator &rhs) const {
+           return owner == rhs.owner && leaf == rhs.leaf && slot == rhs.slot;
+       }
+
+       bool operator!=(const iterator &rhs) const {
+           return !(*this == rhs);
+       }
+
+       bool operator!=(const const_iterator &rhs) const {
+           return !(*this == rhs);
+       }
+
+       value_type *operator->() const noexcept {
+           return leaf->slot(slot);
+       }
+   };
+
+   class const_iterator {
+      private:
+       const btree_map *owner;
+       Leaf *leaf;
+       unsigned slot;
+
+       friend class btree_map;
+       friend class iterator;
+
+      public:
+       const_iterator(const btree_map *m = nullptr, Leaf *l = nullptr, unsigned s = 0)
+           : owner(m), leaf(l), slot(s) {}
+
+       const_iterator(const const_iterator &other)
+           : owner(other.owner), leaf(other.leaf), slot(other.slot) {}
+
+       const_iterator(const iterator &other) : owner(other.owner), leaf(other.leaf), slot(other.slot) {}
+
+       const_iterator &operator=(const const_iterator &) = default;
+
+       errc try_increment() {
+           return stepForward(leaf, slot) ? errc::none : errc::invalid_iterator;
+       }
+
+       errc try_decrement() {
+           if (!owner || !owner->stepBackward(leaf, slot)) return errc::invalid_iterator;
+           return errc::none;
+       }
+
+       const_iterator operator++(int) {
+           const_iterator temp = *this;
+           ++*this;
+           return temp;
+       }
+
+       const_iterator &operator++() {
+           if (try_increment() != errc::none) SJTU_THROW(invalid_iterator());
+           return *this;
+       }
+
+       const_iterator operator--(int) {
+           const_iterator temp = *this;
+           --*this;
+           return temp;
+       }
+
+       const_iterator &operator--() {
+           if (try_decrement() != errc::none) SJTU_THROW(invalid_iterator());
+           return *this;
+       }
+
+       const value_type &operator*() const {
+           if (!leaf) SJTU_THROW(invalid_iterator());
+           return *leaf->slot(slot);
+       }
+
+       bool operator==(const iterator &rhs) const {
+           return owner == rhs.owner && leaf == rhs.leaf && slot == rhs.slot;
+       }
+
+       bool operator==(const const_iterator &rhs) const {
+           return owner == rhs.owner && leaf == rhs.leaf && slot == rhs.slot;
+       }
+
+       bool operator!=(const iterator &rhs) const {
+           return !(*this == rhs);
+       }
+
+       bool operator!=(const const_iterator &rhs) const {
+           return !(*this == rhs);
+       }
+
+       const value_type *operator->() const noexcept {
+           return leaf->slot(slot);
+       }
+   };
+
+   btree_map() : root(nullptr), head(nullptr), tail(nullptr), height(0), elementCount(0) {}
+
+   btree_map(const btree_map &other)
+       : root(nullptr), head(nullptr), tail(nullptr), height(0), elementCount(0), comp(other.comp) {
+       *this = other;
+   }
+
+   // Copies the whole tree before letting go of the old one: if a copy
+   // throws, the map is left as it was
+   btree_map &operator=(const btree_map &other) {
+       if (this == &other) return *this;
+       Leaf *last = nullptr;
+       Node *copy = other.root ? cloneNode(other.root, other.height, last) : nullptr;
+       clear();
+       root = copy;
+       height = other.height;
+       elementCount = other.elementCount;
+       comp = other.comp;
+       tail = last;
+       for (head = last; head && head->prev; head = head->prev) {}
+       return *this;
+   }
+
+   ~btree_map() {
+       clear();
+   }
+
+   T &at(const Key &key) {
+       Leaf *l;
+       unsigned s;
+       if (!findSlot(key, l, s)) SJTU_THROW(index_out_of_bound());
+       return l->slot(s)->second;
+   }
+
+   const T &at(const Key &key) const {
+       Leaf *l;
+       unsigned s;
+       if (!findSlot(key, l, s)) SJTU_THROW(index_out_of_bound());
+       return l->slot(s)->second;
+   }
+
+   T &operator[](const Key &key) {
+       Leaf *l;
+       unsigned s;
+       if (findSlot(key, l, s)) return l->slot(s)->second;
+
+       // Insert new element with default value
+       pair<iterator, bool> result = insert(value_type(key, T()));
+       return result.first->second;
+   }
+
+   const T &operator[](const Key &key) const {
+       return at(key);
+   }
+
+   iterator begin() {
+       return iterator(this, head, head ? head->order[0] : 0);
+   }
+
+   const_iterator cbegin() const {
+       return const_iterator(this, head, head ? head->order[0] : 0);
+   }
+
+   iterator end() {
+       return iterator(this);
+   }
+
+   const_iterator cend() const {
+       return const_iterator(this);
+   }
+
+   bool empty() const {
+       return elementCount == 0;
+   }
+
+   size_t size() const {
+       return elementCount;
+   }
+
+   void clear() {
+       if (root) destroyNode(root, height);
+       root = nullptr;
+       head = tail = nullptr;
+       height = 0;
+       elementCount = 0;
+   }
+
+   pair<iterator, bool> insert(const value_type &val) {
+       Leaf *l = descend(val.first);
+       unsigned i = l ? lowerBound(l, val.first) : 0;
+       if (l && i < l->count && !comp(val.first, leafKey(l, i))) {
+           return pair<iterator, bool>(iterator(this, l, l->order[i]), false);
+       }
+       if (!l || l->count == LEAF_SLOTS) {
+           l = makeRoom(val.first);
+           i = lowerBound(l, val.first);
+       }
+       unsigned s = l->order[l->count];
+       SJTU_TRY {
+           new (l->slot(s)) value_type(val);
+       } SJTU_CATCH_ALL {
+           // Only a root leaf made for this element can be empty
+           if (l->count == 0) {
+               delete l;
+               root = head = tail = nullptr;
+           }
+           SJTU_RETHROW;
+       }
+       insertAt(l, i);
+       ++elementCount;
+       return pair<iterator, bool>(iterator(this, l, s), true);
+   }
+
+   void erase(iterator pos) {
+       if (try_erase(pos) != errc::none) SJTU_THROW(invalid_iterator());
+   }
+
+   // erase() that returns errc::invalid_iterator instead of throwing
+   errc try_erase(iterator pos) {
+       if (!pos.leaf || pos.owner != this) return errc::invalid_iterator;
+       eraseAt(pos.leaf, pos.slot);
+       return errc::none;
+   }
+
+   size_t count(const Key &key) const {
+       Leaf *l;
+       unsigned s;
+       return findSlot(key, l, s) ? 1 : 0;
+   }
+
+   iterator find(const Key &key) {
+       Leaf *l;
+       unsigned s;
+       return findSlot(key, l, s) ? iterator(this, l, s) : end();
+   }
+
+   const_iterator find(const Key &key) const {
+       Leaf *l;
+       unsigned s;
+       return findSlot(key, l, s) ? const_iterator(this, l, s) : cend();
+   }
+
+   /**
+    * Iterator to the first element whose key is not less than key,
+    * or end() if there is none.
+    */
+   iterator lower_bound(const Key &key) {
+       const_iterator it = static_cast<const btree_map *>(this)->lower_bound(key);
+       return iterator(this, it.leaf, it.slot);
+   }
+
+   const_iterator lower_bound(const Key &key) const {
+       Leaf *l = descend(key);
+       if (!l) return cend();
+       unsigned i = lowerBound(l, key);
+       if (i == l->count) {
+           // Every key of the next leaf is at least the separator above it
+           l = l->next;
+           i = 0;
+       }
+       return l ? const_iterator(this, l, l->order[i]) : cend();
+   }
+};
+
+}
+
+#endif
@@ -0,0 +1,641 @@
+/**
+* a sorted map in two contiguous arrays, for small and read-mostly maps
+*/
+#ifndef SJTU_FLAT_MAP_HPP
+#define SJTU_FLAT_MAP_HPP
+
+// only for std::less<T>
+#include <functional>
+#include <cstddef>
+// placement new for the array slots
+#include <new>
+#include "utility.hpp"
+#include "exceptions.hpp"
+// errc and the SJTU_THROW / SJTU_TRY macros
+#include "map.hpp"
+
+namespace sjtu {
+
+/**
+ * Sorted map kept in two parallel arrays, the keys and the mapped
+ * values, both in key order.  Lookups read the key array only: maps of
+ * up to LinearSearchMax elements scan it from the front, larger ones
+ * search it by halves.  There is no allocation or link per element; a
+ * map of n elements takes n * (sizeof(Key) + sizeof(T)) bytes plus its
+ * spare capacity.
+ *
+ * Meant for maps built once and then read: insert(first, last) sorts
+ * the m new elements and merges them in, in O(n + m log m), while a
+ * single insert or erase shifts every element after it, in O(n).
+ *
+ * The key and the value of an element live apart, so an iterator
+ * yields a pair of references, pair<const Key &, T &>, instead of a
+ * value_type &; it->first and it->second work as with sjtu::map.  An
+ * iterator is a position: every insert or erase invalidates all
+ * iterators, pointers and references, and an old iterator names
+ * whatever element has moved to its position.  Key and T must be
+ * copy constructible and copy assignable.  If copying or moving one
+ * throws in the middle of insert or erase, the map is left empty
+ * rather than half shifted.
+ */
+template<
+   class Key,
+   class T,
+   class Compare = std::less <Key>,
+   size_t LinearSearchMax = 8
+   > class flat_map {
+  public:
+   typedef pair<const Key, T> value_type;
+   typedef pair<const Key &, T &> reference;
+   typedef pair<const Key &, const T &> const_reference;
+
+  private:
+   Key *keys;
+   T *values;
+   size_t elementCount, cap;
+   Compare comp;
+
+   // What operator-> of an iterator returns: the reference pair, held
+   // long enough for one member access
+   template<class Ref>
+   struct Arrow {
+       Ref ref;
+
+       Ref *operator->() { return &ref; }
+   };
+
+   // Index array freed on scope exit
+   struct IndexBuffer {
+       size_t *data;
+
+       explicit IndexBuffer(size_t n) : data(static_cast<size_t *>(::operator new(n * sizeof(size_t)))) {}
+       ~IndexBuffer() { ::operator delete(data); }
+   };
+
+   // Position of the first key not less than k, which is the number of
+   // keys less than k.  Small maps count them all without an early exit,
+   // large ones halve the range by picking the next base without a
+   // branch; either way no comparison outcome is ever predicted.
+   size_t lowerBound(const Key &k) const {
+       if (elementCount <= LinearSearchMax) {
+           size_t i = 0;
+           for (size_t j = 0; j < elementCount; ++j) i += comp(keys[j], k);
+           return i;
+       }
+       size_t base = 0, n = elementCount;
+       while (n > 1) {
+           size_t half = n / 2;
+           base = comp(keys[base + half], k) ? base + half : base;
+           n -= half;
+       }
+       return base + comp(keys[base], k);
+   }
+
+   // Position of k, or elementCount if k is absent
+   size_t indexOf(const Key &k) const {
+       size_t i = lowerBound(k);
+       return i < elementCount && !comp(k, keys[i]) ? i : elementCount;
+   }
+
+   // Construct element i of (k, v) from key and value, moving them when
+   // that cannot throw; nothing is left behind if either copy throws
+   template<class K, class V>
+   static void construct(Key *k, T *v, size_t i, K &key, V &value) {
+       new (k + i) Key(std::move_if_noexcept(key));
+       SJTU_TRY {
+           new (v + i) T(std::move_if_noexcept(value));
+       } SJTU_CATCH_ALL {
+           k[i].~Key();
+           SJTU_RETHROW;
+       }
+   }
+
+   static void destroy(Key *k, T *v, size_t n) {
+       for (size_t i = 0; i < n; ++i) {
+           k[i].~Key();
+           v[i].~T();
+       }
+   }
+
+   // Hand over to arrays of n elements, of which the first built are
+   // constructed, freeing the old ones
+   void adopt(Key *k, T *v, size_t built, size_t n) {
+       destroy(keys, values, elementCount);
+       ::operator delete(keys);
+       ::operator delete(values);
+       keys = k;
+       values = v;
+       elementCount = built;
+       cap = n;
+   }
+
+   // Both arrays of n elements, or neither if either allocation throws
+   static void allocate(size_t n, Key *&k, T *&v) {
+       k = static_cast<Key *>(::operator new(n * sizeof(Key)));
+       SJTU_TRY {
+           v = static_cast<T *>(::operator new(n * sizeof(T)));
+       } SJTU_CATCH_ALL {
+           ::operator delete(k);
+           SJTU_RETHROW;
+       }
+   }
+
+   void swapWith(flat_map &other) {
+       Key *k = keys;
+       T *v = values;
+       size_t n = elementCount, c = cap;
+       keys = other.keys;
+       values = other.values;
+       elementCount = other.elementCount;
+       cap = other.cap;
+       other.keys = k;
+       other.values = v;
+       other.elementCount = n;
+       other.cap = c;
+   }
+
+   // Room for at least n elements
+   void grow(size_t n) {
+       if (n < 2 * cap) n = 2 * cap;
+       if (n < 4) n = 4;
+       Key *k = nullptr;
+       T *v = nullptr;
+       allocate(n, k, v);
+       size_t built = 0;
+       SJTU_TRY {
+           for (; built < elementCount; ++built) construct(k, v, built, keys[built], values[built]);
+       } SJTU_CATCH_ALL {
+           destroy(k, v, built);
+           ::operator delete(k);
+           ::operator delete(v);
+           clear();
+           SJTU_RETHROW;
+       }
+       adopt(k, v, built, n);
+   }
+
+   // Shift the elements from i on up by one and put (k, v) at i
+   void insertAt(size_t i, const Key &k, const T &v) {
+       if (elementCount == cap) grow(elementCount + 1);
+       if (i == elementCount) {
+           construct(keys, values, elementCount, k, v);
+           ++elementCount;
+           return;
+       }
+       SJTU_TRY {
+           construct(keys, values, elementCount, keys[elementCount - 1], values[elementCount - 1]);
+           ++elementCount;
+           for (size_t j = elementCount - 2; j > i; --j) {
+               keys[j] = std::move_if_noexcept(keys[j - 1]);
+               values[j] = std::move_if_noexcept(values[j - 1]);
+           }
+           keys[i] = k;
+           values[i] = v;
+       } SJTU_CATCH_ALL {
+           clear();
+           SJTU_RETHROW;
+       }
+   }
+
+   void eraseAt(size_t i) {
+       SJTU_TRY {
+           for (size_t j = i; j + 1 < elementCount; ++j) {
+               keys[j] = std::move_if_noexcept(keys[j + 1]);
+               values[j] = std::move_if_noexcept(values[j + 1]);
+           }
+       } SJTU_CATCH_ALL {
+           clear();
+           SJTU_RETHROW;
+       }
+       --elementCount;
+       keys[elementCount].~Key();
+       values[elementCount].~T();
+   }
+
+   // Stable bottom-up merge sort of the positions idx[0, n) by the keys
+   // of from; returns whichever of idx and tmp ends up sorted
+   size_t *sortPositions(const flat_map &from, size_t *idx, size_t *tmp, size_t n) const {
+       for (size_t width = 1; width < n; width *= 2) {
+           for (size_t lo = 0; lo < n; lo += 2 * width) {
+               size_t mid = lo + width < n ? lo + width : n;
+               size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+               size_t a = lo, b = mid, out = lo;
+               while (a < mid && b < hi) {
+                   tmp[out++] = comp(from.keys[idx[b]], from.keys[idx[a]]) ? idx[b++] : idx[a++];
+               }
+               while (a < mid) tmp[out++] = idx[a++];
+               while (b < hi) tmp[out++] = idx[b++];
+           }
+           size_t *t = idx;
+           idx = tmp;
+           tmp = t;
+       }
+       return idx;
+   }
+
+   // Merge the elements of staged, taken in the order of idx, into the
+   // map.  Of equal keys the one already in the map wins, then the one
+   // staged first, as with a loop of single inserts.
+   void mergeIn(flat_map &staged, const size_t *idx) {
+       size_t m = staged.elementCount, n = elementCount + m, built = 0;
+       Key *k = nullptr;
+       T *v = nullptr;
+       allocate(n, k, v);
+       SJTU_TRY {
+           size_t a = 0, b = 0;
+           while (a < elementCount || b < m) {
+               // Staged keys equal to the last one placed lose; elements
+               // are moved out, so compare with the copy placed
+               if (b < m && built > 0 && !comp(k[built - 1], staged.keys[idx[b]])) {
+                   ++b;
+                   continue;
+               }
+               if (b == m || (a < elementCount && !comp(staged.keys[idx[b]], keys[a]))) {
+                   construct(k, v, built, keys[a], values[a]);
+                   ++a;
+               } else {
+                   construct(k, v, built, staged.keys[idx[b]], staged.values[idx[b]]);
+                   ++b;
+               }
+               ++built;
+           }
+       } SJTU_CATCH_ALL {
+           destroy(k, v, built);
+           ::operator delete(k);
+           ::operator delete(v);
+           clear();
+           SJTU_RETHROW;
+       }
+       adopt(k, v, built, n);
+   }
+
+  public:
+   class const_iterator;
+   class iterator {
+      private:
+       const flat_map *owner;
+       size_t index;
+
+       friend class flat_map;
+       friend class const_iterator;
+
+      public:
+       iterator(const flat_map *m = nullptr, size_t i = 0) : owner(m), index(i) {}
+
+       iterator(const iterator &other) : owner(other.owner), index(other.index) {}
+
+       iterator &operator=(const iterator &) = default;
+
+       /**
+        * Checked steps that report instead of throwing: move and return
+        * errc::none, or leave the iterator as it is and return
+        * errc::invalid_iterator where ++ / -- would throw.
+        */
+       errc try_increment() {
+           if (!owner || index >= owner->elementCount) return errc::invalid_iterator;
+           ++index;
+           return errc::none;
+       }
+
+       errc try_decrement() {
+           if (!owner || index == 0 || index > owner->elementCount) return errc::invalid_iterator;
+           --index;
+           return errc::none;
+       }
+
+       iterator operator++(int) {
+           iterator temp = *this;
+           ++*this;
+           return temp;
+       }
+
+       iterator &operator++() {
+           if (try_increment() != errc::none) SJTU_THROW(invalid_iterator());
+           return *this;
+       }
+
+       iterator operator--(int) {
+           iterator temp = *this;
+           --*this;
+           return temp;
+       }
+
+       iterator &operator--() {
+           if (try_decrement() != errc::none) SJTU_THROW(invalid_iterator());
+           return *this;
+       }
+
+       reference operator*() const {
+           if (!owner || index >= owner->elementCount) SJTU_THROW(invalid_iterator());
+           return reference(owner->keys[index], owner->values[index]);
+       }
+
+       bool operator==(const iterator &rhs) const {
+           return owner == rhs.owner && index == rhs.index;
+       }
+
+       bool operator==(const const_iterator &rhs) const {
+           return owner == rhs.owner && index == rhs.index;
+       }
+
+       bool operator!=(const iterator &rhs) const {
+           return !(*this == rhs);
+       }
+
+       bool operator!=(const const_iterator &rhs) const {
+           return !(*this == rhs);
+       }
+
+       Arrow<reference> operator->() const {
+           Arrow<reference> a = {**this};
+           return a;
+       }
+   };
+
+   class const_iterator {
+      private:
+       const flat_map *owner;
+       size_t index;
+
+       friend class flat_map;
+       friend class iterator;
+
+      public:
+       const_iterator(const flat_map *m = nullptr, size_t i = 0) : owner(m), index(i) {}
+
+       const_iterator(const const_iterator &other) : owner(other.owner), index(other.index) {}
+
+       const_iterator(const iterator &other) : owner(other.owner), index(other.index) {}
+
+       const_iterator &operator=(const const_iterator &) = default;
+
+       errc try_increment() {
+           if (!owner || index >= owner->elementCount) return errc::invalid_iterator;
+           ++index;
+           return errc::none;
+       }
+
+       errc try_decrement() {
+           if (!owner || index == 0 || index > owner->elementCount) return errc::invalid_iterator;
+           --index;
+           return errc::none;
+       }
+
+       const_iterator operator++(int) {
+           const_iterator temp = *this;
+           ++*this;
+           return temp;
+       }
+
+       const_iterator &operator++() {
+           if (try_increment() != errc::none) SJTU_THROW(invalid_iterator());
+           return *this;
+       }
+
+       const_iterator operator--(int) {
+           const_iterator temp = *this;
+           --*this;
+           return temp;
+       }
+
+       const_iterator &operator--() {
+           if (try_decrement() != errc::none) SJTU_THROW(invalid_iterator());
+           return *this;
+       }
+
+       const_reference operator*() const {
+           if (!owner || index >= owner->elementCount) SJTU_THROW(invalid_iterator());
+           return const_reference(owner->keys[index], owner->values[index]);
+       }
+
+       bool operator==(const iterator &rhs) const {
+           return owner == rhs.owner && index == rhs.index;
+       }
+
+       bool operator==(const const_iterator &rhs) const {
+           return owner == rhs.owner && index == rhs.index;
+       }
+
+       bool operator!=(const iterator &rhs) const {
+           return !(*this == rhs);
+       }
+
+       bool operator!=(const const_iterator &rhs) const {
+           return !(*this == rhs);
+       }
+
+       Arrow<const_reference> operator->() const {
+           Arrow<const_reference> a = {**this};
+           return a;
+       }
+   };
+
+   flat_map() : keys(nullptr), values(nullptr), elementCount(0), cap(0) {}
+
+   flat_map(const flat_map &other)
+       : keys(nullptr), values(nullptr), elementCount(0), cap(0), comp(other.comp) {
+       if (other.elementCount == 0) return;
+       Key *k = nullptr;
+       T *v = nullptr;
+       allocate(other.elementCount, k, v);
+       size_t built = 0;
+       SJTU_TRY {
+           for (; built < other.elementCount; ++built) {
+               new (k + built) Key(other.keys[built]);
+               SJTU_TRY {
+                   new (v + built) T(other.values[built]);
+               } SJTU_CATCH_ALL {
+                   k[built].~Key();
+                   SJTU_RETHROW;
+               }
+           }
+       } SJTU_CATCH_ALL {
+           destroy(k, v, built);
+           ::operator delete(k);
+           ::operator delete(v);
+           SJTU_RETHROW;
+       }
+       adopt(k, v, built, built);
+   }
+
+   // Copies into a new map first: if a copy throws, this one is intact
+   flat_map &operator=(const flat_map &other) {
+       if (this == &other) return *this;
+       flat_map copy(other);
+       swapWith(copy);
+       comp = other.comp;
+       return *this;
+   }
+
+   ~flat_map() {
+       clear();
+       ::operator delete(keys);
+       ::operator delete(values);
+   }
+
+   T &at(const Key &key) {
+       size_t i = indexOf(key);
+       if (i == elementCount) SJTU_THROW(index_out_of_bound());
+       return values[i];
+   }
+
+   const T &at(const Key &key) const {
+       size_t i = indexOf(key);
+       if (i == elementCount) SJTU_THROW(index_out_of_bound());
+       return values[i];
+   }
+
+   T &operator[](const Key &key) {
+       size_t i = lowerBound(key);
+       if (i < elementCount && !comp(key, keys[i])) return values[i];
+
+       // Insert new element with default value
+       insertAt(i, key, T());
+       return values[i];
+   }
+
+   const T &operator[](const Key &key) const {
+       return at(key);
+   }
+
+   iterator begin() {
+       return iterator(this, 0);
+   }
+
+   const_iterator cbegin() const {
+       return const_iterator(this, 0);
+   }
+
+   iterator end() {
+       return iterator(this, elementCount);
+   }
+
+   const_iterator cend() const {
+       return const_iterator(this, elementCount);
+   }
+
+   bool empty() const {
+       return elementCount == 0;
+   }
+
+   size_t size() const {
+       return elementCount;
+   }
+
+   /**
+    * Capacity management: reserve() makes room for n elements so that
+    * inserts up to that size do not reallocate; shrink_to_fit() gives
+    * back the spare capacity of a map that is done growing.
+    */
+   size_t capacity() const {
+       return cap;
+   }
+
+   void reserve(size_t n) {
+       if (n > cap) grow(n);
+   }
+
+   void shrink_to_fit() {
+       if (cap == elementCount) return;
+       flat_map copy(*this);
+       swapWith(copy);
+   }
+
+   void clear() {
+       destroy(keys, values, elementCount);
+       elementCount = 0;
+   }
+
+   pair<iterator, bool> insert(const value_type &val) {
+       size_t i = lowerBound(val.first);
+       if (i < elementCount && !comp(val.first, keys[i])) {
+           return pair<iterator, bool>(iterator(this, i), false);
+       }
+       insertAt(i, val.first, val.second);
+       return pair<iterator, bool>(iterator(this, i), true);
+   }
+
+   /**
+    * Insert the elements of [first, last), anything with members first
+    * and second, in one pass: they are copied out, sorted (unless they
+    * come sorted already) and merged with the map.  Keys already in the
+    * map keep their values, and of equal keys in the range the first
+    * one is inserted, as with a loop of single inserts.
+    */
+   template<class InputIt>
+   void insert(InputIt first, InputIt last) {
+       flat_map staged;
+       staged.comp = comp;
+       for (; first != last; ++first) {
+           if (staged.elementCount == staged.cap) staged.grow(staged.elementCount + 1);
+           new (staged.keys + staged.elementCount) Key((*first).first);
+           SJTU_TRY {
+               new (staged.values + staged.elementCount) T((*first).second);
+           } SJTU_CATCH_ALL {
+               staged.keys[staged.elementCount].~Key();
+               SJTU_RETHROW;
+           }
+           ++staged.elementCount;
+       }
+       size_t m = staged.elementCount;
+       if (m == 0) return;
+       bool sorted = true;
+       for (size_t i = 1; i < m && sorted; ++i) sorted = comp(staged.keys[i - 1], staged.keys[i]);
+       // Sorted input with keys past the last one only needs appending
+       if (sorted && (elementCount == 0 || comp(keys[elementCount - 1], staged.keys[0]))) {
+           if (elementCount + m > cap) grow(elementCount + m);
+           for (size_t i = 0; i < m; ++i) {
+               SJTU_TRY {
+                   construct(keys, values, elementCount, staged.keys[i], staged.values[i]);
+               } SJTU_CATCH_ALL {
+                   clear();
+                   SJTU_RETHROW;
+               }
+               ++elementCount;
+           }
+           return;
+       }
+       IndexBuffer idx(m), tmp(m);
+       for (size_t i = 0; i < m; ++i) idx.data[i] = i;
+       mergeIn(staged, sorted ? idx.data : sortPositions(staged, idx.data, tmp.data, m));
+   }
+
+   void erase(iterator pos) {
+       if (try_erase(pos) != errc::none) SJTU_THROW(invalid_iterator());
+   }
+
+   // erase() that returns errc::invalid_iterator instead of throwing
+   errc try_erase(iterator pos) {
+       if (pos.owner != this || pos.index >= elementCount) return errc::invalid_iterator;
+       eraseAt(pos.index);
+       return errc::none;
+   }
+
+   size_t count(const Key &key) const {
+       return indexOf(key) < elementCount ? 1 : 0;
+   }
+
+   iterator find(const Key &key) {
+       return iterator(this, indexOf(key));
+   }
+
+   const_iterator find(const Key &key) const {
+       return const_iterator(this, indexOf(key));
+   }
+
+   /**
+    * Iterator to the first element whose key is not less than key,
+    * or end() if there is none.
+    */
+   iterator lower_bound(const Key &key) {
+       return iterator(this, lowerBound(key));
+   }
+
+   const_iterator lower_bound(const Key &key) const {
+       return const_iterator(this, lowerBound(key));
+   }
+};
+
+}
+
+#endif
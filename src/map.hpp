@@ -10,624 +10,4251 @@
 #include "utility.hpp"
 #include "exceptions.hpp"
 
+// Default of map_traits::checked_iterators; build with
+// -DSJTU_MAP_CHECKED_ITERATORS=0 to drop iterator checks everywhere.
+#ifndef SJTU_MAP_CHECKED_ITERATORS
+#define SJTU_MAP_CHECKED_ITERATORS 1
+#endif
+
+// Default of map_traits::avl_balancing; build with
+// -DSJTU_MAP_AVL_BALANCING=1 to balance every map as an AVL tree.
+#ifndef SJTU_MAP_AVL_BALANCING
+#define SJTU_MAP_AVL_BALANCING 0
+#endif
+
+// Default of map_traits::splay_tree; build with -DSJTU_MAP_SPLAY_TREE=1
+// to make every map a splay tree.
+#ifndef SJTU_MAP_SPLAY_TREE
+#define SJTU_MAP_SPLAY_TREE 0
+#endif
+
+// Build with -DSJTU_MAP_USE_BUILTINS=1 to let the map use GCC / Clang
+// builtins: a bit scan instruction in the node pool and prefetches in
+// find_many().  Off by default, so the header stays standard C++.
+#ifndef SJTU_MAP_USE_BUILTINS
+#define SJTU_MAP_USE_BUILTINS 0
+#endif
+
+// Error codes and the throw / try macros.  The stock exceptions.hpp
+// has neither; noalloc_exceptions.hpp, included first, brings both
+// along with a build without exceptions.
+#ifndef SJTU_ERRC_DEFINED
+#define SJTU_ERRC_DEFINED
+namespace sjtu {
+// Error codes of the non-throwing API; one per exception class
+enum class errc {
+    none = 0,
+    index_out_of_bound,
+    runtime_error,
+    invalid_iterator,
+    container_is_empty
+};
+}
+#endif
+
+#ifndef SJTU_THROW
+#define SJTU_THROW(e) throw e
+#define SJTU_TRY try
+#define SJTU_CATCH_ALL catch (...)
+#define SJTU_RETHROW throw
+#endif
+
+namespace sjtu {
+// Tag of the map's own placement new, which spares it <new>
+struct placement_tag {};
+}
+
+inline void *operator new(size_t, sjtu::placement_tag, void *where) {
+    return where;
+}
+
+// Called only if the constructor run by the placement new throws
+inline void operator delete(void *, sjtu::placement_tag, void *) noexcept {}
+
 namespace sjtu {
 
+/**
+ * Tuning knobs for sjtu::map.  Derive from this struct and override the
+ * members you need, e.g.
+ *
+ *     struct compact_traits : sjtu::map_traits {
+ *         static const bool compact_color = true;
+ *     };
+ *     sjtu::map<int, int, std::less<int>, compact_traits> m;
+ */
+struct map_traits {
+   // Keep the red/black color in a spare bit of the parent link instead
+   // of a separate (padded) field.
+   static const bool compact_color = false;
+   // Link nodes by 32-bit indices into the node pool instead of pointers.
+   // Halves the link overhead; limits the map to 2^32 - 2^10 nodes
+   // (2^31 with compact_color).
+   static const bool index_links = false;
+   // Structure-of-arrays nodes: each pool block keeps the hot part (links,
+   // color and a copy of the key) apart from a parallel array of values,
+   // so lookups never pull mapped values into the cache.  Keys are stored
+   // twice; requires index_links.
+   static const bool split_values = false;
+   // Keep in-order next/prev links in every node so that iterator steps
+   // are a single load instead of a climb through parent links.
+   static const bool threaded = false;
+   // Slots of a direct-mapped key -> node cache consulted before every
+   // lookup, for workloads that hit the same few keys again and again.
+   // Only insert and the lookups of a non-const map fill the cache; a
+   // const map reads it without writing, so concurrent lookups through
+   // a const map never race on it.  A power of two; 0 disables the cache.
+   static const size_t lookup_cache_slots = 0;
+   // Bits per key of a Bloom filter in front of find, count and at, so
+   // that most lookups of absent keys never descend the tree.  About 10
+   // gives a 1% false-positive rate; 0 disables the filter.
+   static const size_t filter_bits_per_key = 0;
+   // Iterator steps and dereferences throw invalid_iterator on misuse.
+   // Without the checks, misuse is undefined behaviour, and with pointer
+   // links an iterator shrinks to a single node pointer: it no longer
+   // knows its map, so erase() and the *_from() hints cannot reject an
+   // iterator of another map.  try_increment() / try_decrement() keep
+   // checking for the end in either mode.
+   static const bool checked_iterators = SJTU_MAP_CHECKED_ITERATORS;
+   // Per-node access counters for map::rebuild_by_frequency(): one in
+   // every access_sample successful find, at or operator[] lookups on a
+   // non-const map bumps the counter of the node found.  count() and
+   // lookups through a const map are not counted, so concurrent readers
+   // write nothing.  A power of two; 0 disables the counters and their
+   // 4 bytes per node.
+   static const size_t access_sample = 0;
+   // Balance the tree as an AVL tree (the heights of sibling subtrees
+   // differ by at most one) instead of a red-black tree: a search visits
+   // at most about 1.44 log2(n) nodes instead of 2 log2(n), for more
+   // rotations on insert and erase.  After random inserts the average
+   // depth is much the same; sorted inserts and long erase/insert
+   // histories leave AVL trees shallower.  Nodes stay the same size.
+   static const bool avl_balancing = SJTU_MAP_AVL_BALANCING;
+   // Make the tree a splay tree, which keeps no balance at all: find,
+   // at, find_ptr, try_at and operator[] of a non-const map, and insert,
+   // rotate the node they reach (on a miss, the last node visited) up
+   // to the root, so keys used again soon after sit near the top.  A
+   // single operation can take O(n), a sequence O(log n) amortized per
+   // operation.  Lookups through a const map and lower_bound, the
+   // finger searches and find_many leave the tree alone.  As in every
+   // mode, they write nothing else either (no lookup cache, filter or
+   // access counters), so any number of threads can run them at once;
+   // like begin(), they take time in proportion to the current depth.
+   // Nodes never move: iterators stay valid exactly as in the balanced
+   // modes.  Overrides avl_balancing.
+   static const bool splay_tree = SJTU_MAP_SPLAY_TREE;
+   // Hash of a key, used by the lookup cache and the filter
+   template<class K>
+   struct key_hash {
+       size_t operator()(const K &k) const { return std::hash<K>()(k); }
+   };
+};
+
 template<
    class Key,
    class T,
-   class Compare = std::less <Key>
+   class Compare = std::less <Key>,
+   class Traits = map_traits
    > class map {
   public:
    typedef pair<const Key, T> value_type;
 
   private:
+   // Under AVL balancing the color bit holds the parity of the node's
+   // height instead (a leaf has height 1): BLACK for odd
    enum Color { RED, BLACK };
 
-   struct Node {
-       value_type *data;
-       Node *left, *right, *parent;
-       Color color;
+   template<bool B>
+   struct Tag {};
+   typedef Tag<Traits::index_links> LinkMode;
+   typedef Tag<Traits::split_values> ValueMode;
+   typedef Tag<Traits::threaded> ThreadMode;
+   typedef Tag<(Traits::lookup_cache_slots > 0)> CacheMode;
+   typedef Tag<(Traits::filter_bits_per_key > 0)> FilterMode;
+   typedef Tag<(Traits::access_sample > 0)> CountMode;
+   typedef Tag<Traits::avl_balancing> BalanceMode;
+   typedef Tag<Traits::splay_tree> SplayMode;
+   // Iterators are one node pointer that walks without the map
+   static const bool SLIM_ITERATORS = !Traits::checked_iterators && !Traits::index_links;
+   typedef Tag<SLIM_ITERATORS> IterMode;
+
+   static_assert(!Traits::split_values || Traits::index_links,
+                 "map_traits::split_values requires index_links");
+   static_assert((Traits::access_sample & (Traits::access_sample - 1)) == 0,
+                 "map_traits::access_sample must be a power of two");
+   static_assert((Traits::lookup_cache_slots & (Traits::lookup_cache_slots - 1)) == 0,
+                 "map_traits::lookup_cache_slots must be a power of two");
+
+   struct NodeBase;
+   struct Node;
+
+   template<bool Indexed, class Dummy = void>
+   struct RefType {
+       typedef NodeBase *type;
+   };
+
+   template<class Dummy>
+   struct RefType<true, Dummy> {
+       typedef unsigned type;
+   };
+
+   // Handle of a node: a pointer, or an index into the pool.  Ref() is null.
+   typedef typename RefType<Traits::index_links>::type Ref;
+
+   // Parent link and color, stored side by side
+   template<class R, bool Compact, class Dummy = void>
+   struct Links {
+       R left, right;
+       R parentRef;
+       Color nodeColor;
+
+       R parent() const { return parentRef; }
+       void setParent(R p) { parentRef = p; }
+       Color color() const { return nodeColor; }
+       void setColor(Color c) { nodeColor = c; }
+   };
+
+   // Parent pointer with the color in bit 0; nodes are at least 2-byte
+   // aligned, so the bit is always free in a real pointer.
+   template<class Dummy>
+   struct Links<NodeBase *, true, Dummy> {
+       NodeBase *left, *right;
+       size_t parentColor;
+
+       NodeBase *parent() const { return reinterpret_cast<NodeBase *>(parentColor & ~size_t(1)); }
+       void setParent(NodeBase *p) { parentColor = reinterpret_cast<size_t>(p) | (parentColor & 1); }
+       Color color() const { return static_cast<Color>(parentColor & 1); }
+       void setColor(Color c) { parentColor = (parentColor & ~size_t(1)) | c; }
+   };
+
+   // Parent index with the color in bit 31
+   template<class Dummy>
+   struct Links<unsigned, true, Dummy> {
+       unsigned left, right;
+       unsigned parentColor;
+
+       unsigned parent() const { return parentColor & 0x7fffffffu; }
+       void setParent(unsigned p) { parentColor = p | (parentColor & 0x80000000u); }
+       Color color() const { return static_cast<Color>(parentColor >> 31); }
+       void setColor(Color c) { parentColor = (parentColor & 0x7fffffffu) | (unsigned(c) << 31); }
+   };
+
+   // In-order neighbours, with threaded: the first node has no prev and
+   // the last one's next is the end() handle.
+   template<bool Threaded, class Dummy = void>
+   struct Thread {};
+
+   template<class Dummy>
+   struct Thread<true, Dummy> {
+       Ref next, prev;
+   };
+
+   // Links shared by tree nodes and the end() sentinel
+   struct NodeBase : Links<Ref, Traits::compact_color>, Thread<Traits::threaded> {};
+
+   // Tree node; the value is constructed in place inside a pool slot
+   template<bool Split, class Dummy = void>
+   struct NodeData : NodeBase {
+       alignas(value_type) unsigned char storage[sizeof(value_type)];
+
+       value_type *data() { return reinterpret_cast<value_type *>(storage); }
+   };
+
+   // Hot half of a split node; the value lives in the block's cold array
+   template<class Dummy>
+   struct NodeData<true, Dummy> : NodeBase {
+       alignas(Key) unsigned char keyStorage[sizeof(Key)];
+
+       Key *keyCopy() { return reinterpret_cast<Key *>(keyStorage); }
+   };
+
+   // Sampled lookup count, with access_sample
+   template<bool Counted, class Dummy = void>
+   struct AccessCount {};
+
+   template<class Dummy>
+   struct AccessCount<true, Dummy> {
+       unsigned hits;
+   };
+
+   struct Node : NodeData<Traits::split_values>, AccessCount<(Traits::access_sample > 0)> {};
+
+   // Block allocator for nodes.  Slots are carved out of numbered blocks of
+   // growing size and recycled through per-block free lists; allocation
+   // prefers the lowest-numbered block with room so that survivors of a
+   // mass erase concentrate in few blocks.  Numbers of released blocks are
+   // reused, so block numbers follow neither age nor address.  Block b
+   // owns the index range [b << BLOCK_SHIFT, (b + 1) << BLOCK_SHIFT);
+   // block 0 is never used, so index 0 can serve as null.  The pool never
+   // moves a live node by itself: relocation only happens in
+   // map::shrink_to_fit().
+   class NodePool {
+      public:
+       static const unsigned BLOCK_SHIFT = 10;
+       static const size_t MIN_BLOCK_SLOTS = 4;
+       static const size_t MAX_BLOCK_SLOTS = size_t(1) << BLOCK_SHIFT;
+       // Block numbers that keep every index below the color bit / END
+       static const size_t MAX_BLOCKS =
+           (Traits::compact_color ? 0x80000000u : 0xffffffffu) >> BLOCK_SHIFT;
+
+      private:
+       union Slot {
+           Slot *next;
+           Node node;
+       };
+
+       struct Block {
+           Slot *slots;      // null for an unused block number
+           value_type *cold; // values of the slots, with split_values
+           Slot *freeList;
+           size_t capacity;  // slots in the block
+           size_t used;      // slots handed out at least once
+           size_t live;      // slots currently holding a node
+           bool draining;    // being emptied by a compaction
+       };
+
+       static const size_t WORD_BITS = 64;
+
+       Block *blocks;                // indexed by block number
+       Slot **bases;                 // blocks[b].slots, packed for index lookups
+       value_type **coldBases;       // blocks[b].cold, likewise
+       size_t *byAddress;            // numbers of allocated blocks, by address
+       size_t *freeNumbers;          // unused block numbers below blockCount
+       size_t blockCount;            // block numbers in use, including 0
+       size_t allocated;             // blocks holding memory
+       size_t freeNumberCount;
+       size_t blockCap;
+       unsigned long long *nonFull;  // bit b set if block b can take a node
+       unsigned long long *nonFullWords;  // bit w set if nonFull[w] != 0
+       size_t slotCount, liveCount;
+       bool releaseEmpty;
+       mutable size_t lastBlock;     // answer of the previous blockOf()
+
+       static size_t wordsFor(size_t bits) { return (bits + WORD_BITS - 1) / WORD_BITS; }
+
+       // Index of the lowest set bit of w != 0
+       static unsigned lowestBit(unsigned long long w) {
+#if SJTU_MAP_USE_BUILTINS
+           return __builtin_ctzll(w);
+#else
+           // w & -w isolates the bit; a de Bruijn multiplication moves a
+           // distinct 6-bit pattern for each position to the top
+           static const unsigned char position[64] = {
+               0, 1, 48, 2, 57, 49, 28, 3, 61, 58, 50, 42, 38, 29, 17, 4,
+               62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12, 5,
+               63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+               46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19, 9, 13, 8, 7, 6};
+           return position[((w & (0 - w)) * 0x03f79d71b4cb0a89ull) >> 58];
+#endif
+       }
+
+       void setNonFull(size_t b) {
+           size_t w = b / WORD_BITS;
+           nonFull[w] |= 1ULL << (b % WORD_BITS);
+           nonFullWords[w / WORD_BITS] |= 1ULL << (w % WORD_BITS);
+       }
+
+       void clearNonFull(size_t b) {
+           size_t w = b / WORD_BITS;
+           nonFull[w] &= ~(1ULL << (b % WORD_BITS));
+           if (!nonFull[w]) nonFullWords[w / WORD_BITS] &= ~(1ULL << (w % WORD_BITS));
+       }
+
+       void zeroNonFull() {
+           size_t words = wordsFor(blockCap);
+           for (size_t w = 0; w < words; ++w) nonFull[w] = 0;
+           for (size_t w = 0; w < wordsFor(words); ++w) nonFullWords[w] = 0;
+       }
+
+       void rebuildNonFull() {
+           zeroNonFull();
+           for (size_t b = 1; b < blockCount; ++b) {
+               const Block &blk = blocks[b];
+               if (blk.slots && !blk.draining && blk.live < blk.capacity) setNonFull(b);
+           }
+       }
+
+       // Two-level scan: one summary word covers 4096 blocks
+       size_t firstNonFull() const {
+           size_t words = wordsFor(wordsFor(blockCount));
+           for (size_t i = 0; i < words; ++i) {
+               if (nonFullWords[i]) {
+                   size_t w = i * WORD_BITS + lowestBit(nonFullWords[i]);
+                   return w * WORD_BITS + lowestBit(nonFull[w]);
+               }
+           }
+           return 0;
+       }
+
+       // Position in byAddress of the first block at or above s
+       size_t addressRank(const Slot *s) const {
+           size_t lo = 0, hi = allocated;
+           while (lo < hi) {
+               size_t mid = (lo + hi) / 2;
+               if (blocks[byAddress[mid]].slots < s) lo = mid + 1;
+               else hi = mid;
+           }
+           return lo;
+       }
+
+       Ref makeRef(size_t, Slot *s, Tag<false>) const {
+           return &s->node;
+       }
+
+       Ref makeRef(size_t b, Slot *s, Tag<true>) const {
+           return Ref((b << BLOCK_SHIFT) | size_t(s - blocks[b].slots));
+       }
+
+       // Number of the block holding a node.  Nodes freed together tend
+       // to share a block, so the previous answer is tried first.
+       size_t blockOf(Ref r, Tag<false>) const {
+           const Slot *s = reinterpret_cast<const Slot *>(static_cast<const Node *>(r));
+           if (lastBlock < blockCount) {
+               const Block &blk = blocks[lastBlock];
+               if (blk.slots && s >= blk.slots && s < blk.slots + blk.capacity) return lastBlock;
+           }
+           size_t lo = 0, hi = allocated;
+           while (hi - lo > 1) {
+               size_t mid = (lo + hi) / 2;
+               if (s < blocks[byAddress[mid]].slots) hi = mid;
+               else lo = mid;
+           }
+           lastBlock = byAddress[lo];
+           return lastBlock;
+       }
+
+       size_t blockOf(Ref r, Tag<true>) const {
+           return r >> BLOCK_SHIFT;
+       }
+
+       Node &nodeAt(Ref r, Tag<false>) const {
+           return *static_cast<Node *>(r);
+       }
+
+       Node &nodeAt(Ref r, Tag<true>) const {
+           return bases[r >> BLOCK_SHIFT][r & (MAX_BLOCK_SLOTS - 1)].node;
+       }
+
+       void growTables() {
+           size_t newCap = blockCap ? blockCap * 2 : 8;
+           size_t words = wordsFor(newCap);
+           Block *newBlocks = nullptr;
+           Slot **newBases = nullptr;
+           value_type **newColdBases = nullptr;
+           size_t *newByAddress = nullptr;
+           size_t *newFreeNumbers = nullptr;
+           unsigned long long *newNonFull = nullptr;
+           unsigned long long *newNonFullWords = nullptr;
+           SJTU_TRY {
+               newBlocks = new Block[newCap];
+               newBases = new Slot *[newCap];
+               newColdBases = new value_type *[newCap];
+               newByAddress = new size_t[newCap];
+               newFreeNumbers = new size_t[newCap];
+               newNonFull = new unsigned long long[words]();
+               newNonFullWords = new unsigned long long[wordsFor(words)]();
+           } SJTU_CATCH_ALL {
+               delete[] newBlocks;
+               delete[] newBases;
+               delete[] newColdBases;
+               delete[] newByAddress;
+               delete[] newFreeNumbers;
+               delete[] newNonFull;
+               SJTU_RETHROW;
+           }
+           for (size_t b = 0; b < blockCount; ++b) {
+               newBlocks[b] = blocks[b];
+               newBases[b] = bases[b];
+               newColdBases[b] = coldBases[b];
+           }
+           for (size_t i = 0; i < allocated; ++i) newByAddress[i] = byAddress[i];
+           for (size_t i = 0; i < freeNumberCount; ++i) newFreeNumbers[i] = freeNumbers[i];
+           for (size_t w = 0; w < wordsFor(blockCap); ++w) newNonFull[w] = nonFull[w];
+           for (size_t w = 0; w < wordsFor(wordsFor(blockCap)); ++w) newNonFullWords[w] = nonFullWords[w];
+           delete[] blocks;
+           delete[] bases;
+           delete[] coldBases;
+           delete[] byAddress;
+           delete[] freeNumbers;
+           delete[] nonFull;
+           delete[] nonFullWords;
+           blocks = newBlocks;
+           bases = newBases;
+           coldBases = newColdBases;
+           byAddress = newByAddress;
+           freeNumbers = newFreeNumbers;
+           nonFull = newNonFull;
+           nonFullWords = newNonFullWords;
+           blockCap = newCap;
+       }
+
+       // O(log blocks), plus a shift of the address index that is empty
+       // whenever the new block lies above the others
+       size_t addBlock() {
+           if (blockCount == 0) {
+               if (blockCap == 0) growTables();
+               blocks[0].slots = bases[0] = nullptr;
+               blocks[0].cold = coldBases[0] = nullptr;
+               blockCount = 1;
+           }
+           size_t b = freeNumberCount ? freeNumbers[freeNumberCount - 1] : blockCount;
+           if (Traits::index_links && b >= MAX_BLOCKS) SJTU_THROW(runtime_error());
+           if (b == blockCount && blockCount == blockCap) growTables();
+
+           size_t capacity = slotCount;
+           if (capacity < MIN_BLOCK_SLOTS) capacity = MIN_BLOCK_SLOTS;
+           if (capacity > MAX_BLOCK_SLOTS) capacity = MAX_BLOCK_SLOTS;
+           Slot *slots = static_cast<Slot *>(::operator new(capacity * sizeof(Slot)));
+           value_type *cold = nullptr;
+           if (Traits::split_values) {
+               SJTU_TRY {
+                   cold = static_cast<value_type *>(::operator new(capacity * sizeof(value_type)));
+               } SJTU_CATCH_ALL {
+                   ::operator delete(slots);
+                   SJTU_RETHROW;
+               }
+           }
+
+           Block &blk = blocks[b];
+           blk.slots = bases[b] = slots;
+           blk.cold = coldBases[b] = cold;
+           blk.freeList = nullptr;
+           blk.capacity = capacity;
+           blk.used = blk.live = 0;
+           blk.draining = false;
+           if (b == blockCount) ++blockCount;
+           else --freeNumberCount;
+
+           size_t pos = addressRank(slots);
+           for (size_t i = allocated; i > pos; --i) byAddress[i] = byAddress[i - 1];
+           byAddress[pos] = b;
+           ++allocated;
+           slotCount += capacity;
+           setNonFull(b);
+           return b;
+       }
+
+       void freeBlock(size_t b) {
+           ::operator delete(blocks[b].slots);
+           ::operator delete(blocks[b].cold);
+           blocks[b].slots = bases[b] = nullptr;
+           blocks[b].cold = coldBases[b] = nullptr;
+           slotCount -= blocks[b].capacity;
+           freeNumbers[freeNumberCount++] = b;
+       }
+
+       // Free one empty block and drop it from the address index
+       void releaseBlock(size_t b) {
+           for (size_t i = addressRank(blocks[b].slots); i + 1 < allocated; ++i) {
+               byAddress[i] = byAddress[i + 1];
+           }
+           --allocated;
+           clearNonFull(b);
+           freeBlock(b);
+       }
+
+       // Drop released blocks from the address index and trim the table
+       void compactTables() {
+           size_t j = 0;
+           for (size_t i = 0; i < allocated; ++i) {
+               if (blocks[byAddress[i]].slots) byAddress[j++] = byAddress[i];
+           }
+           allocated = j;
+           while (blockCount > 1 && !blocks[blockCount - 1].slots) --blockCount;
+           if (blockCount == 1) blockCount = 0;
+           freeNumberCount = 0;
+           for (size_t b = blockCount; b-- > 1;) {
+               if (!blocks[b].slots) freeNumbers[freeNumberCount++] = b;
+           }
+           rebuildNonFull();
+       }
+
+       // Min-heap of block numbers by live count, for sortByLive()
+       void siftDown(size_t *order, size_t i, size_t n) const {
+           size_t b = order[i];
+           for (size_t c = 2 * i + 1; c < n; i = c, c = 2 * i + 1) {
+               if (c + 1 < n && blocks[order[c + 1]].live < blocks[order[c]].live) ++c;
+               if (blocks[b].live <= blocks[order[c]].live) break;
+               order[i] = order[c];
+           }
+           order[i] = b;
+       }
+
+       // Heap sort, fullest block first, O(n log n)
+       void sortByLive(size_t *order, size_t n) const {
+           for (size_t i = n / 2; i-- > 0;) siftDown(order, i, n);
+           for (size_t end = n; end-- > 1;) {
+               size_t b = order[0];
+               order[0] = order[end];
+               order[end] = b;
+               siftDown(order, 0, end);
+           }
+       }
+
+      public:
+       NodePool()
+           : blocks(nullptr), bases(nullptr), coldBases(nullptr), byAddress(nullptr), freeNumbers(nullptr),
+             blockCount(0), allocated(0), freeNumberCount(0), blockCap(0), nonFull(nullptr),
+             nonFullWords(nullptr), slotCount(0), liveCount(0), releaseEmpty(false), lastBlock(0) {}
+
+       NodePool(const NodePool &) = delete;
+       NodePool &operator=(const NodePool &) = delete;
+
+       ~NodePool() {
+           clear();
+           delete[] blocks;
+           delete[] bases;
+           delete[] coldBases;
+           delete[] byAddress;
+           delete[] freeNumbers;
+           delete[] nonFull;
+           delete[] nonFullWords;
+       }
+
+       Node &node(Ref r) const {
+           return nodeAt(r, LinkMode());
+       }
+
+       // Value slot parallel to a node, with split_values
+       value_type &cold(Ref r) const {
+           return coldBases[r >> BLOCK_SHIFT][r & (MAX_BLOCK_SLOTS - 1)];
+       }
+
+       Ref allocate() {
+           size_t b = firstNonFull();
+           if (b == 0) b = addBlock();
+           Block &blk = blocks[b];
+           Slot *s;
+           if (blk.freeList) {
+               s = blk.freeList;
+               blk.freeList = s->next;
+           } else {
+               s = blk.slots + blk.used++;
+           }
+           if (++blk.live == blk.capacity) clearNonFull(b);
+           ++liveCount;
+           return makeRef(b, s, LinkMode());
+       }
+
+       void deallocate(Ref r) {
+           size_t b = blockOf(r, LinkMode());
+           Block &blk = blocks[b];
+           Slot *s = reinterpret_cast<Slot *>(&node(r));
+           s->next = blk.freeList;
+           blk.freeList = s;
+           if (blk.live-- == blk.capacity && !blk.draining) setNonFull(b);
+           --liveCount;
+           // Keep at least a block's worth of free slots elsewhere so that an
+           // insert/erase cycle at a block boundary does not thrash.
+           if (releaseEmpty && blk.live == 0 && !blk.draining &&
+               slotCount - liveCount - blk.capacity >= blk.capacity) {
+               releaseBlock(b);
+           }
+       }
+
+       // Release every block; the caller has already destroyed the values
+       void clear() {
+           for (size_t b = 1; b < blockCount; ++b) {
+               if (blocks[b].slots) {
+                   ::operator delete(blocks[b].slots);
+                   ::operator delete(blocks[b].cold);
+               }
+           }
+           if (blockCap) zeroNonFull();
+           blockCount = allocated = freeNumberCount = 0;
+           slotCount = liveCount = 0;
+       }
+
+       size_t capacity() const { return slotCount; }
+
+       void setReleaseEmpty(bool enable) { releaseEmpty = enable; }
+
+       // Mark the blocks a compaction should empty: the fullest blocks are
+       // kept until they can hold all live nodes, the rest are drained.
+       // Returns false if there is nothing to gain.
+       bool planCompaction() {
+           if (allocated == 0) return false;
+           size_t *order = new size_t[allocated];
+           for (size_t i = 0; i < allocated; ++i) order[i] = byAddress[i];
+           sortByLive(order, allocated);
+           size_t kept = 0, k = 0;
+           while (k < allocated && (kept < liveCount || kept == 0)) {
+               kept += blocks[order[k]].capacity;
+               ++k;
+           }
+           bool any = false;
+           for (; k < allocated; ++k) {
+               blocks[order[k]].draining = true;
+               any = true;
+           }
+           delete[] order;
+           if (any) rebuildNonFull();
+           return any;
+       }
+
+       // Drain every block, so that new nodes go to fresh blocks
+       void drainAll() {
+           for (size_t b = 1; b < blockCount; ++b) {
+               if (blocks[b].slots) blocks[b].draining = true;
+           }
+           rebuildNonFull();
+       }
+
+       // Undo planCompaction() or drainAll() after a failed move
+       void cancelDrain() {
+           for (size_t b = 1; b < blockCount; ++b) blocks[b].draining = false;
+           rebuildNonFull();
+       }
+
+       bool isDraining(Ref r) const {
+           return blocks[blockOf(r, LinkMode())].draining;
+       }
+
+       // Free the blocks emptied by a compaction
+       void releaseDrained() {
+           for (size_t b = 1; b < blockCount; ++b) {
+               if (blocks[b].slots && blocks[b].draining) freeBlock(b);
+           }
+           compactTables();
+       }
+   };
+
+   // Direct-mapped key -> node cache in front of findNode().  Nodes never
+   // move during rotations, so entries only go stale when a node is
+   // destroyed, and destroyNode() clears them.  Each entry keeps more bits
+   // of the key's hash, so a miss is settled without touching the node.
+   struct CacheEntry {
+       Ref node;
+       unsigned tag;
+   };
+
+   template<size_t Slots, class Dummy = void>
+   struct LookupCache {
+       CacheEntry slots[Slots];
+       size_t hits, misses;
+
+       LookupCache() : hits(0), misses(0) { flush(); }
+
+       void flush() {
+           for (size_t i = 0; i < Slots; ++i) slots[i].node = Ref();
+       }
+
+       size_t hitCount() const { return hits; }
+       size_t missCount() const { return misses; }
+       void resetStats() { hits = misses = 0; }
+   };
+
+   template<class Dummy>
+   struct LookupCache<0, Dummy> {
+       void flush() {}
+
+       size_t hitCount() const { return 0; }
+       size_t missCount() const { return 0; }
+       void resetStats() {}
+   };
+
+   // Blocked Bloom filter over the keys in the tree: a key sets PROBES
+   // bits inside one 512-bit block, so a query costs one cache line.
+   // Erasing cannot clear bits, so erased keys stay set ("stale") until
+   // the map rebuilds the filter.
+   template<size_t BitsPerKey, class Dummy = void>
+   struct MembershipFilter {
+       static const unsigned PROBES = BitsPerKey * 7 / 10 ? BitsPerKey * 7 / 10 : 1;
+       static const size_t BLOCK_WORDS = 8;
+
+       unsigned long long *words;
+       size_t blocks;
+       size_t sizedFor;  // live plus stale keys the bits are sized for
+       size_t stale;
+       size_t queries, rejected, falsePositives, rebuilds;
+
+       MembershipFilter()
+           : words(nullptr), blocks(0), sizedFor(0), stale(0),
+             queries(0), rejected(0), falsePositives(0), rebuilds(0) {}
+
+       ~MembershipFilter() { delete[] words; }
+
+       // Empty filter with room for keys; throws only bad_alloc
+       void reset(size_t keys) {
+           size_t n = (keys * BitsPerKey + 511) / 512;
+           if (n == 0) n = 1;
+           unsigned long long *w = new unsigned long long[n * BLOCK_WORDS]();
+           delete[] words;
+           words = w;
+           blocks = n;
+           sizedFor = keys;
+           stale = 0;
+           ++rebuilds;
+       }
+
+       // Drop the bits.  The filter answers "maybe" until the map
+       // outgrows keys and rebuilds it, so a failed reset() is not
+       // retried on every insert.
+       void release(size_t keys) {
+           delete[] words;
+           words = nullptr;
+           blocks = 0;
+           sizedFor = keys;
+           stale = 0;
+       }
+
+       unsigned long long *block(unsigned long long h) const {
+           return words + size_t(((h >> 32) * blocks) >> 32) * BLOCK_WORDS;
+       }
+
+       void add(unsigned long long h) {
+           if (!words) return;
+           unsigned long long *b = block(h);
+           unsigned pos = unsigned(h), step = unsigned(h >> 23) | 1;
+           for (unsigned i = 0; i < PROBES; ++i, pos += step) {
+               b[(pos & 511) >> 6] |= 1ULL << (pos & 63);
+           }
+       }
 
-       Node(const value_type &val, Node *p = nullptr)
-           : data(new value_type(val)), left(nullptr), right(nullptr), parent(p), color(RED) {}
+       // No filter yet (allocation failed) answers "maybe"
+       bool mayContain(unsigned long long h) const {
+           if (!words) return true;
+           const unsigned long long *b = block(h);
+           unsigned pos = unsigned(h), step = unsigned(h >> 23) | 1;
+           for (unsigned i = 0; i < PROBES; ++i, pos += step) {
+               if (!(b[(pos & 511) >> 6] & (1ULL << (pos & 63)))) return false;
+           }
+           return true;
+       }
+
+       template<class Stats>
+       void fill(Stats &st) const {
+           st.queries = queries;
+           st.rejected = rejected;
+           st.false_positives = falsePositives;
+           st.rebuilds = rebuilds;
+           st.bits = blocks * BLOCK_WORDS * 64;
+           st.stale_keys = stale;
+       }
+
+       void resetStats() { queries = rejected = falsePositives = rebuilds = 0; }
+
+      private:
+       MembershipFilter(const MembershipFilter &);
+       MembershipFilter &operator=(const MembershipFilter &);
+   };
 
-       // Constructor for sentinel node (no data)
-       Node(Node *p, bool sentinel)
-           : data(nullptr), left(nullptr), right(nullptr), parent(p), color(BLACK) {}
+   template<class Dummy>
+   struct MembershipFilter<0, Dummy> {
+       void release(size_t) {}
 
-       ~Node() {
-           if (data) delete data;
+       template<class Stats>
+       void fill(Stats &st) const {
+           st.queries = st.rejected = st.false_positives = 0;
+           st.rebuilds = st.bits = st.stale_keys = 0;
        }
+
+       void resetStats() {}
    };
 
-   Node *root;
-   Node *endNode;  // sentinel node for end()
+   Ref root;
+   NodeBase header;  // sentinel node for end()
    size_t nodeCount;
    Compare comp;
+   NodePool pool;
+   LookupCache<Traits::lookup_cache_slots> cache;
+   MembershipFilter<Traits::filter_bits_per_key> filter;
+   // Lookups since the map was created, for sampling the access counters
+   size_t lookupTick;
+
+   Ref endRef(Tag<false>) const {
+       return const_cast<NodeBase *>(&header);
+   }
+
+   Ref endRef(Tag<true>) const {
+       return Ref(~0u);
+   }
+
+   Ref endRef() const {
+       return endRef(LinkMode());
+   }
+
+   // Parent of the root.  With slim iterators it is the header, whose left
+   // link mirrors the root: the header is then the only node without a
+   // parent, and end() and --end() are reachable through the links alone.
+   Ref top(Tag<false>) const {
+       return Ref();
+   }
+
+   Ref top(Tag<true>) const {
+       return endRef();
+   }
+
+   Ref top() const {
+       return top(IterMode());
+   }
+
+   void setRoot(Ref x, Tag<false>) {
+       root = x;
+   }
+
+   void setRoot(Ref x, Tag<true>) {
+       root = x;
+       header.left = x;
+   }
+
+   void setRoot(Ref x) {
+       setRoot(x, IterMode());
+   }
+
+   // Node accessors; every structural operation goes through these so
+   // that pointer and index links share one implementation.
+   Node &node(Ref x) const {
+       return pool.node(x);
+   }
+
+   Ref &left(Ref x) const {
+       return node(x).left;
+   }
+
+   Ref &right(Ref x) const {
+       return node(x).right;
+   }
+
+   Ref parent(Ref x) const {
+       return node(x).parent();
+   }
+
+   void setParent(Ref x, Ref p) {
+       node(x).setParent(p);
+   }
+
+   Color color(Ref x) const {
+       return node(x).color();
+   }
+
+   void setColor(Ref x, Color c) {
+       node(x).setColor(c);
+   }
+
+   Ref &next(Ref x) const {
+       return node(x).next;
+   }
+
+   Ref &prev(Ref x) const {
+       return node(x).prev;
+   }
+
+   value_type &value(Ref x, Tag<false>) const {
+       return *node(x).data();
+   }
+
+   value_type &value(Ref x, Tag<true>) const {
+       return pool.cold(x);
+   }
+
+   value_type &value(Ref x) const {
+       return value(x, ValueMode());
+   }
+
+   const Key &key(Ref x, Tag<false>) const {
+       return value(x).first;
+   }
+
+   const Key &key(Ref x, Tag<true>) const {
+       return *node(x).keyCopy();
+   }
+
+   const Key &key(Ref x) const {
+       return key(x, ValueMode());
+   }
+
+   void constructValue(Ref x, const value_type &val, Tag<false>) {
+       new (placement_tag(), node(x).data()) value_type(val);
+   }
+
+   void constructValue(Ref x, const value_type &val, Tag<true>) {
+       new (placement_tag(), &pool.cold(x)) value_type(val);
+       SJTU_TRY {
+           new (placement_tag(), node(x).keyCopy()) Key(val.first);
+       } SJTU_CATCH_ALL {
+           pool.cold(x).~value_type();
+           SJTU_RETHROW;
+       }
+   }
+
+   void destroyValue(Ref x, Tag<false>) {
+       value(x).~value_type();
+   }
+
+   void destroyValue(Ref x, Tag<true>) {
+       node(x).keyCopy()->~Key();
+       value(x).~value_type();
+   }
+
+   Ref createNode(const value_type &val, Ref p) {
+       Ref x = pool.allocate();
+       SJTU_TRY {
+           constructValue(x, val, ValueMode());
+       } SJTU_CATCH_ALL {
+           pool.deallocate(x);
+           SJTU_RETHROW;
+       }
+       static_cast<NodeBase &>(node(x)) = NodeBase();
+       setAccessCount(x, 0, CountMode());
+       setParent(x, p);
+       // a new leaf: red, or under AVL balancing of odd height
+       setColor(x, Traits::avl_balancing ? BLACK : RED);
+       return x;
+   }
+
+   void destroyNode(Ref x) {
+       cacheForget(x, CacheMode());
+       destroyValue(x, ValueMode());
+       pool.deallocate(x);
+   }
+
+   // Helper function to compare keys
+   bool keyEqual(const Key &a, const Key &b) const {
+       return !comp(a, b) && !comp(b, a);
+   }
+
+   bool keyLess(const Key &a, const Key &b) const {
+       return comp(a, b);
+   }
+
+   // Find minimum node in subtree
+   Ref minimum(Ref x) const {
+       if (!x) return x;
+       while (left(x)) x = left(x);
+       return x;
+   }
+
+   // Find maximum node in subtree
+   Ref maximum(Ref x) const {
+       if (!x) return x;
+       while (right(x)) x = right(x);
+       return x;
+   }
+
+   // Find successor of a node; endRef() after the last one
+   Ref successor(Ref x, Tag<false>) const {
+       if (right(x)) {
+           return minimum(right(x));
+       }
+       Ref p = parent(x);
+       while (p && x == right(p)) {
+           x = p;
+           p = parent(p);
+       }
+       if (p) return p;
+       return endRef();
+   }
+
+   Ref successor(Ref x, Tag<true>) const {
+       return next(x);
+   }
+
+   Ref successor(Ref x) const {
+       return successor(x, ThreadMode());
+   }
+
+   // Find predecessor of a node; null before the first one
+   Ref predecessor(Ref x, Tag<false>) const {
+       if (x == endRef()) {
+           return maximum(root);
+       }
+       if (left(x)) {
+           return maximum(left(x));
+       }
+       Ref p = parent(x);
+       while (p && x == left(p)) {
+           x = p;
+           p = parent(p);
+       }
+       return p;
+   }
+
+   Ref predecessor(Ref x, Tag<true>) const {
+       if (x == endRef()) {
+           return maximum(root);
+       }
+       return prev(x);
+   }
+
+   Ref predecessor(Ref x) const {
+       return predecessor(x, ThreadMode());
+   }
+
+   // Steps of a slim iterator, which has no map to ask: climbing from the
+   // last node ends at the header, and the header's left link is the root
+   static Ref nodeSuccessor(Ref x, Tag<false>) {
+       if (x->right) {
+           x = x->right;
+           while (x->left) x = x->left;
+           return x;
+       }
+       Ref p = x->parent();
+       while (x == p->right) {
+           x = p;
+           p = p->parent();
+       }
+       return p;
+   }
+
+   static Ref nodeSuccessor(Ref x, Tag<true>) {
+       return x->next;
+   }
+
+   static Ref nodePredecessor(Ref x, Tag<false>) {
+       if (x->left) {
+           x = x->left;
+           while (x->right) x = x->right;
+           return x;
+       }
+       Ref p = x->parent();
+       while (p && x == p->left) {
+           x = p;
+           p = p->parent();
+       }
+       return p;
+   }
+
+   static Ref nodePredecessor(Ref x, Tag<true>) {
+       if (x->parent()) return x->prev;
+       return nodePredecessor(x, Tag<false>());
+   }
+
+   // Maintain the in-order thread; rotations never change it, so only
+   // linking, unlinking and relocating a node have to.
+   void threadAfter(Ref, Ref, Tag<false>) {}
+
+   void threadAfter(Ref last, Ref x, Tag<true>) {
+       prev(x) = last;
+       next(x) = endRef();
+       if (last) next(last) = x;
+   }
+
+   void threadEnd(Ref, Tag<false>) {}
+
+   void threadEnd(Ref last, Tag<true>) {
+       if (last) next(last) = endRef();
+   }
+
+   void threadInsert(Ref, Tag<false>) {}
+
+   void threadInsert(Ref z, Tag<true>) {
+       Ref p = parent(z);
+       if (p == top()) {
+           prev(z) = Ref();
+           next(z) = endRef();
+       } else if (z == left(p)) {
+           next(z) = p;
+           prev(z) = prev(p);
+           if (prev(p)) next(prev(p)) = z;
+           prev(p) = z;
+       } else {
+           prev(z) = p;
+           next(z) = next(p);
+           if (next(p) != endRef()) prev(next(p)) = z;
+           next(p) = z;
+       }
+   }
+
+   void threadErase(Ref, Tag<false>) {}
+
+   void threadErase(Ref z, Tag<true>) {
+       if (prev(z)) next(prev(z)) = next(z);
+       if (next(z) != endRef()) prev(next(z)) = prev(z);
+   }
+
+   void threadRelink(Ref, Tag<false>) {}
+
+   void threadRelink(Ref y, Tag<true>) {
+       if (prev(y)) next(prev(y)) = y;
+       if (next(y) != endRef()) prev(next(y)) = y;
+   }
+
+   // Left rotation
+   void rotateLeft(Ref x) {
+       Ref y = right(x);
+       right(x) = left(y);
+       if (left(y)) setParent(left(y), x);
+       setParent(y, parent(x));
+
+       if (parent(x) == top()) {
+           setRoot(y);
+       } else if (x == left(parent(x))) {
+           left(parent(x)) = y;
+       } else {
+           right(parent(x)) = y;
+       }
+       left(y) = x;
+       setParent(x, y);
+   }
+
+   // Right rotation
+   void rotateRight(Ref y) {
+       Ref x = left(y);
+       left(y) = right(x);
+       if (right(x)) setParent(right(x), y);
+       setParent(x, parent(y));
+
+       if (parent(y) == top()) {
+           setRoot(x);
+       } else if (y == left(parent(y))) {
+           left(parent(y)) = x;
+       } else {
+           right(parent(y)) = x;
+       }
+       right(x) = y;
+       setParent(y, x);
+   }
+
+   // Fix tree after insertion
+   void insertFixup(Ref z, Tag<false>) {
+       while (parent(z) != top() && color(parent(z)) == RED) {
+           Ref zp = parent(z), zpp = parent(zp);
+           if (zp == left(zpp)) {
+               Ref y = right(zpp);
+               if (y && color(y) == RED) {
+                   setColor(zp, BLACK);
+                   setColor(y, BLACK);
+                   setColor(zpp, RED);
+                   z = zpp;
+               } else {
+                   if (z == right(zp)) {
+                       z = zp;
+                       rotateLeft(z);
+                   }
+                   setColor(parent(z), BLACK);
+                   setColor(parent(parent(z)), RED);
+                   rotateRight(parent(parent(z)));
+               }
+           } else {
+               Ref y = left(zpp);
+               if (y && color(y) == RED) {
+                   setColor(zp, BLACK);
+                   setColor(y, BLACK);
+                   setColor(zpp, RED);
+                   z = zpp;
+               } else {
+                   if (z == left(zp)) {
+                       z = zp;
+                       rotateRight(z);
+                   }
+                   setColor(parent(z), BLACK);
+                   setColor(parent(parent(z)), RED);
+                   rotateLeft(parent(parent(z)));
+               }
+           }
+       }
+       setColor(root, BLACK);
+   }
+
+   // Transplant for deletion
+   void transplant(Ref u, Ref v) {
+       if (parent(u) == top()) {
+           setRoot(v);
+       } else if (u == left(parent(u))) {
+           left(parent(u)) = v;
+       } else {
+           right(parent(u)) = v;
+       }
+       if (v) setParent(v, parent(u));
+   }
+
+   bool isBlack(Ref x) const {
+       return !x || color(x) == BLACK;
+   }
+
+   // Fix tree after deletion
+   void deleteFixup(Ref x, Ref xParent, Tag<false>) {
+       while (x != root && isBlack(x)) {
+           if (!xParent) break;
+           if (x == left(xParent)) {
+               Ref w = right(xParent);
+               if (!w) break;
+               if (color(w) == RED) {
+                   setColor(w, BLACK);
+                   setColor(xParent, RED);
+                   rotateLeft(xParent);
+                   w = right(xParent);
+                   if (!w) break;
+               }
+               if (isBlack(left(w)) && isBlack(right(w))) {
+                   setColor(w, RED);
+                   x = xParent;
+                   xParent = parent(x);
+               } else {
+                   if (isBlack(right(w))) {
+                       if (left(w)) setColor(left(w), BLACK);
+                       setColor(w, RED);
+                       rotateRight(w);
+                       w = right(xParent);
+                       if (!w) break;
+                   }
+                   setColor(w, color(xParent));
+                   setColor(xParent, BLACK);
+                   if (right(w)) setColor(right(w), BLACK);
+                   rotateLeft(xParent);
+                   x = root;
+               }
+           } else {
+               Ref w = left(xParent);
+               if (!w) break;
+               if (color(w) == RED) {
+                   setColor(w, BLACK);
+                   setColor(xParent, RED);
+                   rotateRight(xParent);
+                   w = left(xParent);
+                   if (!w) break;
+               }
+               if (isBlack(right(w)) && isBlack(left(w))) {
+                   setColor(w, RED);
+                   x = xParent;
+                   xParent = parent(x);
+               } else {
+                   if (isBlack(left(w))) {
+                       if (right(w)) setColor(right(w), BLACK);
+                       setColor(w, RED);
+                       rotateLeft(w);
+                       w = left(xParent);
+                       if (!w) break;
+                   }
+                   setColor(w, color(xParent));
+                   setColor(xParent, BLACK);
+                   if (left(w)) setColor(left(w), BLACK);
+                   rotateRight(xParent);
+                   x = root;
+               }
+           }
+       }
+       if (x) setColor(x, BLACK);
+   }
+
+   // AVL balancing.  With rank(x) the height of x and 0 for null, the
+   // parity bit gives the difference to a child of a balanced node,
+   // which is 1 or 2, and the fixups know which of two values a pending
+   // difference can take; a node's height changes by flipping its bit.
+   bool oddRank(Ref x) const {
+       return x && color(x) == BLACK;
+   }
+
+   void flipRank(Ref x) {
+       setColor(x, color(x) == BLACK ? RED : BLACK);
+   }
+
+   void setRank(Ref x, int h) {
+       setColor(x, h & 1 ? BLACK : RED);
+   }
+
+   // z was inserted as a leaf or has just grown by one
+   void insertFixup(Ref z, Tag<true>) {
+       for (Ref p = parent(z); p != top(); z = p, p = parent(p)) {
+           // now 1 below p, which was 2 below it: done
+           if (oddRank(p) != oddRank(z)) return;
+           bool zLeft = z == left(p);
+           Ref s = zLeft ? right(p) : left(p);
+           if (oddRank(s) != oddRank(p)) {
+               // s is 1 below p: p grows too
+               flipRank(p);
+               continue;
+           }
+           // s is 2 below p: rotate z up, its inner child too if that is
+           // the taller one
+           Ref y = zLeft ? right(z) : left(z);
+           if (oddRank(y) == oddRank(z)) {
+               if (zLeft) rotateRight(p);
+               else rotateLeft(p);
+               flipRank(p);
+           } else {
+               if (zLeft) {
+                   rotateLeft(z);
+                   rotateRight(p);
+               } else {
+                   rotateRight(z);
+                   rotateLeft(p);
+               }
+               flipRank(y);
+               flipRank(z);
+               flipRank(p);
+           }
+           return;
+       }
+   }
+
+   // x (maybe null) below p has just shrunk by one
+   void deleteFixup(Ref x, Ref p, Tag<true>) {
+       while (p != top()) {
+           bool xLeft = x == left(p);
+           Ref s = xLeft ? right(p) : left(p);
+           if (oddRank(x) == oddRank(p)) {
+               // x is 2 below p: done unless s is 2 below as well, in
+               // which case p shrinks
+               if (oddRank(s) != oddRank(p)) return;
+               flipRank(p);
+               x = p;
+               p = parent(p);
+               continue;
+           }
+           // x is 3 below p, s 1 below: rotate s up, its inner child t
+           // too if the outer child u is the lower one
+           Ref t = xLeft ? left(s) : right(s), u = xLeft ? right(s) : left(s);
+           if (oddRank(u) != oddRank(s)) {
+               if (xLeft) rotateLeft(p);
+               else rotateRight(p);
+               if (oddRank(t) != oddRank(s)) {
+                   // the subtree keeps its height
+                   flipRank(p);
+                   flipRank(s);
+                   return;
+               }
+               x = s;
+           } else {
+               if (xLeft) {
+                   rotateRight(s);
+                   rotateLeft(p);
+               } else {
+                   rotateLeft(s);
+                   rotateRight(p);
+               }
+               flipRank(t);
+               flipRank(s);
+               x = t;
+           }
+           p = parent(x);
+       }
+   }
+
+   // Splay tree: rotate x up to the root, two levels at a time, the
+   // upper rotation first where x and its parent are children on the
+   // same side, so the depth of the path above x roughly halves
+   void splay(Ref, Tag<false>) {}
+
+   void splay(Ref x, Tag<true>) {
+       for (Ref p = parent(x); p != top(); p = parent(x)) {
+           Ref g = parent(p);
+           bool xLeft = x == left(p);
+           if (g == top()) {
+               if (xLeft) rotateRight(p);
+               else rotateLeft(p);
+           } else if (xLeft == (p == left(g))) {
+               if (xLeft) {
+                   rotateRight(g);
+                   rotateRight(p);
+               } else {
+                   rotateLeft(g);
+                   rotateLeft(p);
+               }
+           } else if (xLeft) {
+               rotateRight(p);
+               rotateLeft(g);
+           } else {
+               rotateLeft(p);
+               rotateRight(g);
+           }
+       }
+   }
+
+   // Hang the new node z below p (or make it the root) and rebalance
+   void attachNode(Ref z, Ref p, bool asLeft) {
+       nodeCount++;
+       if (!p) {
+           setParent(z, top());
+           setRoot(z);
+       } else if (asLeft) {
+           left(p) = z;
+       } else {
+           right(p) = z;
+       }
+       threadInsert(z, ThreadMode());
+       if (Traits::splay_tree) splay(z, SplayMode());
+       else insertFixup(z, BalanceMode());
+       filterInsert(z, FilterMode());
+   }
+
+   // Insert val as the in-order predecessor of pos, which may be endRef()
+   Ref insertBefore(const value_type &val, Ref pos) {
+       Ref p;
+       bool asLeft = false;
+       if (pos == endRef()) {
+           p = root ? maximum(root) : Ref();
+       } else if (!left(pos)) {
+           p = pos;
+           asLeft = true;
+       } else {
+           p = maximum(left(pos));
+       }
+       Ref z = createNode(val, p);
+       attachNode(z, p, asLeft);
+       return z;
+   }
+
+   // Unlink z, destroy it and rebalance
+   void eraseNode(Ref z) {
+       Ref y = z;
+       Ref x;
+       Ref xParent;
+       Color yOriginalColor = color(y);
+
+       if (!left(z)) {
+           x = right(z);
+           xParent = parent(z);
+           transplant(z, right(z));
+       } else if (!right(z)) {
+           x = left(z);
+           xParent = parent(z);
+           transplant(z, left(z));
+       } else {
+           y = minimum(right(z));
+           yOriginalColor = color(y);
+           x = right(y);
+
+           if (parent(y) == z) {
+               xParent = y;
+               if (x) setParent(x, y);
+           } else {
+               xParent = parent(y);
+               transplant(y, right(y));
+               right(y) = right(z);
+               setParent(right(y), y);
+           }
+           transplant(z, y);
+           left(y) = left(z);
+           setParent(left(y), y);
+           setColor(y, color(z));
+       }
+
+       threadErase(z, ThreadMode());
+       destroyNode(z);
+       nodeCount--;
+
+       if (Traits::splay_tree) {
+           if (xParent != top()) splay(xParent, SplayMode());
+       } else if (Traits::avl_balancing || yOriginalColor == BLACK) {
+           deleteFixup(x, xParent, BalanceMode());
+       }
+       filterErase(FilterMode());
+   }
+
+   // Entry for k; tag receives the hash bits that tell keys of one slot apart
+   const CacheEntry &cacheSlot(const Key &k, unsigned &tag) const {
+       unsigned long long h = typename Traits::template key_hash<Key>()(k);
+       // Fibonacci hashing, so identity hashes of small keys spread too
+       h *= 0x9e3779b97f4a7c15ull;
+       tag = unsigned(h >> 32);
+       return cache.slots[size_t(h >> 40) & (Traits::lookup_cache_slots - 1)];
+   }
+
+   CacheEntry &cacheSlot(const Key &k, unsigned &tag) {
+       return const_cast<CacheEntry &>(static_cast<const map *>(this)->cacheSlot(k, tag));
+   }
+
+   void cacheStore(const Key &, Ref, Tag<false>) {}
+
+   void cacheStore(const Key &k, Ref x, Tag<true>) {
+       unsigned tag;
+       CacheEntry &e = cacheSlot(k, tag);
+       e.node = x;
+       e.tag = tag;
+   }
+
+   void cacheForget(Ref, Tag<false>) {}
+
+   void cacheForget(Ref x, Tag<true>) {
+       unsigned tag;
+       CacheEntry &e = cacheSlot(key(x), tag);
+       if (e.node == x) e.node = Ref();
+   }
+
+   // Rebuilds leave room for this many keys at least
+   static const size_t FILTER_MIN_KEYS = 64;
+
+   // key_hash through the MurmurHash3 finalizer, so that every bit used
+   // by the filter depends on the whole hash
+   unsigned long long filterHash(const Key &k) const {
+       unsigned long long h = typename Traits::template key_hash<Key>()(k);
+       h ^= h >> 33;
+       h *= 0xff51afd7ed558ccdull;
+       h ^= h >> 33;
+       h *= 0xc4ceb9fe1a85ec53ull;
+       h ^= h >> 33;
+       return h;
+   }
+
+   // Re-hash every key into a filter sized for twice the current count.
+   // If that allocation fails the filter is dropped and answers "maybe".
+   void refreshFilter(Tag<false>) {}
+
+   void refreshFilter(Tag<true>) {
+       size_t keys = 2 * nodeCount + FILTER_MIN_KEYS;
+       SJTU_TRY {
+           filter.reset(keys);
+       } SJTU_CATCH_ALL {
+           filter.release(keys);
+           return;
+       }
+       for (Ref x = root ? minimum(root) : endRef(); x != endRef(); x = successor(x)) {
+           filter.add(filterHash(key(x)));
+       }
+   }
+
+   // x was just linked into the tree
+   void filterInsert(Ref, Tag<false>) {}
+
+   void filterInsert(Ref x, Tag<true>) {
+       filter.add(filterHash(key(x)));
+       if (nodeCount + filter.stale > filter.sizedFor) refreshFilter(Tag<true>());
+   }
+
+   // A key was just erased; rebuild once stale keys outweigh live ones
+   // count elements were just erased
+   void filterErase(Tag<false>, size_t = 1) {}
+
+   void filterErase(Tag<true>, size_t count = 1) {
+       filter.stale += count;
+       if (2 * filter.stale > nodeCount + FILTER_MIN_KEYS) refreshFilter(Tag<true>());
+   }
+
+   // Cached node for k, or null; reads the cache only
+   Ref cachePeek(const Key &k) const {
+       unsigned tag;
+       const CacheEntry &e = cacheSlot(k, tag);
+       return e.node && e.tag == tag && keyEqual(k, key(e.node)) ? e.node : Ref();
+   }
+
+   // cachePeek() that counts the hit or miss
+   Ref cacheLookup(const Key &, Tag<false>) {
+       return Ref();
+   }
+
+   Ref cacheLookup(const Key &k, Tag<true>) {
+       Ref x = cachePeek(k);
+       if (x) ++cache.hits;
+       else ++cache.misses;
+       return x;
+   }
+
+   // Search through the lookup cache without writing to it
+   Ref cachedFind(const Key &k, Tag<false>) const {
+       return searchTree(k);
+   }
+
+   Ref cachedFind(const Key &k, Tag<true>) const {
+       Ref x = cachePeek(k);
+       return x ? x : searchTree(k);
+   }
+
+   // cachedFind() that counts in and refills the cache
+   Ref cachedLookup(const Key &k, Tag<false>) {
+       return searchTree(k);
+   }
+
+   Ref cachedLookup(const Key &k, Tag<true>) {
+       Ref x = cacheLookup(k, Tag<true>());
+       if (x) return x;
+       x = searchTree(k);
+       if (x) cacheStore(k, x, Tag<true>());
+       return x;
+   }
+
+   Ref filteredFind(const Key &k, Tag<false>) const {
+       return cachedFind(k, CacheMode());
+   }
+
+   Ref filteredFind(const Key &k, Tag<true>) const {
+       if (!filter.mayContain(filterHash(k))) return Ref();
+       return cachedFind(k, CacheMode());
+   }
+
+   Ref filteredLookup(const Key &k, Tag<false>) {
+       return cachedLookup(k, CacheMode());
+   }
+
+   // filteredFind() that counts into the filter's statistics
+   Ref filteredLookup(const Key &k, Tag<true>) {
+       ++filter.queries;
+       if (!filter.mayContain(filterHash(k))) {
+           ++filter.rejected;
+           return Ref();
+       }
+       Ref x = cachedLookup(k, CacheMode());
+       if (!x) ++filter.falsePositives;
+       return x;
+   }
+
+   // Find node by key, through the filter and the lookup cache if
+   // enabled.  This is the lookup of a const map: it leaves the cache,
+   // the filter's counters and the access counters alone, so any number
+   // of threads can search a const map at once.
+   Ref findNode(const Key &k) const {
+       return filteredFind(k, FilterMode());
+   }
+
+   // findNode() for a non-const map, which also refills the cache and
+   // counts into the cache and filter statistics and the access counters
+   Ref lookupNode(const Key &k) {
+       Ref x = filteredLookup(k, FilterMode());
+       if (x) countAccess(x, CountMode());
+       return x;
+   }
+
+   // lookupNode(), which in a splay tree moves the node found, or else
+   // the last node visited, to the root
+   Ref accessNode(const Key &k, Tag<false>) {
+       return lookupNode(k);
+   }
+
+   Ref accessNode(const Key &k, Tag<true>) {
+       Ref x = lookupNode(k);
+       if (x) {
+           splay(x, Tag<true>());
+       } else if (root) {
+           Ref last = root;
+           for (Ref c = root; c; c = keyLess(k, key(c)) ? left(c) : right(c)) last = c;
+           splay(last, Tag<true>());
+       }
+       return x;
+   }
+
+   Ref accessNode(const Key &k) {
+       return accessNode(k, SplayMode());
+   }
+
+   void countAccess(Ref, Tag<false>) {}
+
+   void countAccess(Ref x, Tag<true>) {
+       unsigned &hits = node(x).hits;
+       if ((++lookupTick & (Traits::access_sample - 1)) == 0 && hits != ~0u) ++hits;
+   }
+
+   unsigned accessCount(Ref, Tag<false>) const {
+       return 0;
+   }
+
+   unsigned accessCount(Ref x, Tag<true>) const {
+       return node(x).hits;
+   }
+
+   void setAccessCount(Ref, unsigned, Tag<false>) {}
+
+   void setAccessCount(Ref x, unsigned hits, Tag<true>) {
+       node(x).hits = hits;
+   }
+
+   Ref searchTree(const Key &k) const {
+       Ref current = root;
+       while (current) {
+           if (keyEqual(k, key(current))) {
+               return current;
+           } else if (keyLess(k, key(current))) {
+               current = left(current);
+           } else {
+               current = right(current);
+           }
+       }
+       return Ref();
+   }
+
+   // First node in subtree x whose key is not less than k, or bound
+   Ref lowerBoundIn(Ref x, const Key &k, Ref bound) const {
+       while (x) {
+           if (keyLess(key(x), k)) {
+               x = right(x);
+           } else {
+               bound = x;
+               x = left(x);
+           }
+       }
+       return bound;
+   }
+
+   // Finger search: climb from x only until the subtree can hold k
+   Ref lowerBoundFrom(Ref x, const Key &k) const {
+       if (x == endRef()) {
+           return lowerBoundIn(root, k, endRef());
+       }
+       Ref bound = endRef();
+       if (keyLess(key(x), k)) {
+           // Going right: stop below the first ancestor whose key is >= k
+           for (Ref p = parent(x); p != top(); x = p, p = parent(p)) {
+               if (x == left(p) && !keyLess(key(p), k)) {
+                   bound = p;
+                   break;
+               }
+           }
+       } else if (keyLess(k, key(x))) {
+           // Going left: stop below the first ancestor whose key is < k
+           for (Ref p = parent(x); p != top(); x = p, p = parent(p)) {
+               if (x == right(p) && keyLess(key(p), k)) {
+                   break;
+               }
+           }
+       } else {
+           return x;
+       }
+       return lowerBoundIn(x, k, bound);
+   }
+
+   // Independent descents advanced in lockstep by findMany()
+   static const int BATCH_LANES = 16;
+
+#if SJTU_MAP_USE_BUILTINS
+   void prefetchNode(Ref x) const {
+       if (x) {
+           __builtin_prefetch(&node(x));
+           __builtin_prefetch(&key(x));
+       }
+   }
+#else
+   void prefetchNode(Ref) const {}
+#endif
+
+   // Each round moves every lane one level down, so the cache misses of
+   // up to BATCH_LANES lookups overlap instead of queueing behind each other
+   template<class Iter>
+   void findMany(const Key *keys, size_t n, Iter *out) const {
+       Ref cur[BATCH_LANES];
+       size_t slot[BATCH_LANES];
+       size_t pending = 0;
+       int active = 0;
+       while (active < BATCH_LANES && pending < n) {
+           slot[active] = pending++;
+           cur[active++] = root;
+       }
+       while (active > 0) {
+           for (int i = 0; i < active;) {
+               Ref x = cur[i];
+               Ref hit = Ref();
+               if (x) {
+                   const Key &k = keys[slot[i]];
+                   if (keyLess(k, key(x))) {
+                       x = left(x);
+                   } else if (keyLess(key(x), k)) {
+                       x = right(x);
+                   } else {
+                       hit = x;
+                       x = Ref();
+                   }
+               }
+               if (x) {
+                   cur[i++] = x;
+                   prefetchNode(x);
+                   continue;
+               }
+               out[slot[i]] = Iter(this, hit ? hit : endRef());
+               // Lane finished: start the next key, or retire the lane
+               if (pending < n) {
+                   slot[i] = pending++;
+                   cur[i++] = root;
+               } else {
+                   --active;
+                   cur[i] = cur[active];
+                   slot[i] = slot[active];
+               }
+           }
+       }
+   }
+
+   // Bound on the tree height: 2 log2(n + 1) for a red-black tree.  A
+   // splay tree has none, so its walks step along successor() instead.
+   static const int WALK_DEPTH = 2 * 8 * sizeof(size_t);
+
+   // In-order walk of the subtree under sub over [lo, hi), where a null
+   // bound is open.  The stack
+   // holds the ancestors still to be visited, so no step climbs parent
+   // links, and the next node's address is known before the current one
+   // is loaded (unlike a walk along the thread).  Returns false if f did.
+   template<class V, class F>
+   bool walkForward(Ref sub, const Key *lo, const Key *hi, F &f) const {
+       return walkForward<V>(sub, lo, hi, f, SplayMode());
+   }
+
+   template<class V, class F>
+   bool walkForward(Ref sub, const Key *lo, const Key *hi, F &f, Tag<false>) const {
+       Ref stack[WALK_DEPTH];
+       int depth = 0;
+       for (Ref x = sub; x;) {
+           if (lo && keyLess(key(x), *lo)) {
+               x = right(x);
+           } else {
+               stack[depth++] = x;
+               x = left(x);
+           }
+       }
+       while (depth > 0) {
+           Ref x = stack[--depth];
+           if (hi && !keyLess(key(x), *hi)) return true;
+           V &v = value(x);
+           if (!f(v)) return false;
+           for (x = right(x); x; x = left(x)) stack[depth++] = x;
+       }
+       return true;
+   }
+
+   template<class V, class F>
+   bool walkForward(Ref sub, const Key *lo, const Key *hi, F &f, Tag<true>) const {
+       if (!sub) return true;
+       Ref stop = successor(maximum(sub));
+       for (Ref x = lo ? lowerBoundIn(sub, *lo, stop) : minimum(sub); x != stop; x = successor(x)) {
+           if (hi && !keyLess(key(x), *hi)) return true;
+           V &v = value(x);
+           if (!f(v)) return false;
+       }
+       return true;
+   }
+
+   // Mirror image of walkForward(): [lo, hi) in descending order
+   template<class V, class F>
+   bool walkBackward(Ref sub, const Key *lo, const Key *hi, F &f) const {
+       return walkBackward<V>(sub, lo, hi, f, SplayMode());
+   }
+
+   template<class V, class F>
+   bool walkBackward(Ref sub, const Key *lo, const Key *hi, F &f, Tag<false>) const {
+       Ref stack[WALK_DEPTH];
+       int depth = 0;
+       for (Ref x = sub; x;) {
+           if (hi && !keyLess(key(x), *hi)) {
+               x = left(x);
+           } else {
+               stack[depth++] = x;
+               x = right(x);
+           }
+       }
+       while (depth > 0) {
+           Ref x = stack[--depth];
+           if (lo && keyLess(key(x), *lo)) return true;
+           V &v = value(x);
+           if (!f(v)) return false;
+           for (x = left(x); x; x = right(x)) stack[depth++] = x;
+       }
+       return true;
+   }
+
+   template<class V, class F>
+   bool walkBackward(Ref sub, const Key *lo, const Key *hi, F &f, Tag<true>) const {
+       if (!sub) return true;
+       Ref stop = predecessor(minimum(sub));
+       Ref x = hi ? predecessor(lowerBoundIn(sub, *hi, successor(maximum(sub)))) : maximum(sub);
+       for (; x != stop; x = predecessor(x)) {
+           if (lo && keyLess(key(x), *lo)) return true;
+           V &v = value(x);
+           if (!f(v)) return false;
+       }
+       return true;
+   }
+
+   // A parallel walk cuts the tree at this depth into at most 2^CUT whole
+   // subtrees and the nodes above them.  The cut does not depend on the
+   // thread count, so neither does the grouping of a parallel reduction.
+   static const int PARALLEL_CUT = 8;
+   // Smaller maps are walked piece by piece on the calling thread
+   static const size_t PARALLEL_MIN = 1 << 14;
+
+   // The subtree under node, or count elements in key order from node on
+   struct Piece {
+       Ref node;
+       bool whole;
+       size_t count;
+   };
+
+   // Append the pieces of the subtree under x to out[n...] in key order:
+   // the subtrees depth levels down, whole, and single nodes above them
+   size_t cutTree(Ref x, int depth, Piece *out, size_t n) const {
+       if (!x) return n;
+       if (depth == 0) {
+           out[n].node = x;
+           out[n].whole = true;
+           return n + 1;
+       }
+       n = cutTree(left(x), depth - 1, out, n);
+       out[n].node = x;
+       out[n].whole = false;
+       out[n].count = 1;
+       return cutTree(right(x), depth - 1, out, n + 1);
+   }
+
+   // Element j * size() / k of the map, for j = 0, 1, ..., k - 1, by one
+   // walk in key order
+   void evenSplits(size_t k, Ref *first) const {
+       Ref x = root ? minimum(root) : endRef();
+       size_t at = 0;
+       for (size_t j = 0; j < k; ++j) {
+           for (size_t start = j * nodeCount / k; at < start; ++at) x = successor(x);
+           first[j] = x;
+       }
+   }
+
+   // The pieces of a parallel walk.  A splay tree's shape says nothing
+   // about sizes (it can be a single path), so its elements are cut
+   // instead into 2^PARALLEL_CUT runs of equal length, found by a walk
+   // on the calling thread.
+   size_t cutPieces(Piece *out, Tag<false>) const {
+       return cutTree(root, PARALLEL_CUT, out, 0);
+   }
+
+   size_t cutPieces(Piece *out, Tag<true>) const {
+       size_t k = size_t(1) << PARALLEL_CUT;
+       if (k > nodeCount) k = nodeCount;
+       Buffer<Ref> first(k);
+       evenSplits(k, first.data);
+       for (size_t j = 0; j < k; ++j) {
+           out[j].node = first[j];
+           out[j].whole = false;
+           out[j].count = (j + 1) * nodeCount / k - j * nodeCount / k;
+       }
+       return k;
+   }
+
+   // Rough size of the subtree under x: a perfect tree as deep as its
+   // shorter outer spine.  The longer spine of a red-black tree can be
+   // twice as long (red nodes piling up on one side, as after ascending
+   // inserts), and following it overestimates wildly.
+   size_t estimateSize(Ref x) const {
+       int l = 0, r = 0;
+       for (Ref y = x; y; y = left(y)) ++l;
+       for (Ref y = x; y; y = right(y)) ++r;
+       return (size_t(1) << (l < r ? l : r)) - 1;
+   }
+
+   // First elements of k contiguous ranges of near-equal size; first[k]
+   // is endRef().  In a splay tree the sizes are exact, from a walk.
+   void partitionPoints(size_t k, Ref *first, Tag<true>) const {
+       evenSplits(k, first);
+       first[k] = endRef();
+   }
+
+   // Otherwise they are estimated from the tree's shape.  The cut yields
+   // about 64 pieces per range, so the estimates' errors mostly cancel
+   // out within a range.
+   void partitionPoints(size_t k, Ref *first, Tag<false>) const {
+       int depth = 6;
+       while ((size_t(1) << (depth - 6)) < k && depth < 60) ++depth;
+       size_t most = nodeCount < (size_t(2) << depth) ? nodeCount : size_t(2) << depth;
+       Buffer<Piece> pieces(most);
+       Buffer<size_t> weight(most);
+       size_t n = cutTree(root, depth, pieces.data, 0), total = 0;
+       for (size_t i = 0; i < n; ++i) {
+           weight[i] = pieces[i].whole ? estimateSize(pieces[i].node) : 1;
+           total += weight[i];
+       }
+       // Range j starts at the piece whose middle passes j * total / k
+       size_t piece = 0, before = 0;
+       for (size_t j = 0; j < k; ++j) {
+           while (piece < n && (before + weight[piece] / 2) * k < j * total) {
+               before += weight[piece++];
+           }
+           if (piece == n) {
+               first[j] = endRef();
+           } else {
+               Ref x = pieces[piece].node;
+               first[j] = pieces[piece].whole ? minimum(x) : x;
+           }
+       }
+       first[k] = endRef();
+   }
+
+   template<class Pool, class Task>
+   void runPieces(Pool &pool, size_t n, Task task) const {
+       if (nodeCount < PARALLEL_MIN) {
+           for (size_t i = 0; i < n; ++i) task(i);
+       } else {
+           pool.run(n, task);
+       }
+   }
+
+   // Adapts a void visitor to the walkers
+   template<class F>
+   struct VisitAll {
+       F *f;
+
+       template<class V>
+       bool operator()(V &v) const {
+           (*f)(v);
+           return true;
+       }
+   };
+
+   template<class V, class F>
+   struct VisitPiece {
+       const map *owner;
+       const Piece *pieces;
+       F *f;
+
+       void operator()(size_t i) const {
+           VisitAll<F> g = {f};
+           Ref x = pieces[i].node;
+           if (pieces[i].whole) {
+               owner->template walkForward<V>(x, nullptr, nullptr, g);
+               return;
+           }
+           for (size_t j = 0; j < pieces[i].count; ++j, x = owner->successor(x)) {
+               V &v = owner->value(x);
+               g(v);
+           }
+       }
+   };
+
+   template<class V, class Pool, class F>
+   void parallelVisit(Pool &pool, F &f) const {
+       Buffer<Piece> pieces(size_t(2) << PARALLEL_CUT);
+       size_t n = cutPieces(pieces.data, SplayMode());
+       VisitPiece<V, F> task = {this, pieces.data, &f};
+       runPieces(pool, n, task);
+   }
+
+   // Fold of one piece; empty until its task has finished
+   template<class R>
+   struct Partial {
+       alignas(R) unsigned char storage[sizeof(R)];
+       bool set;
+
+       Partial() : set(false) {}
+       ~Partial() {
+           if (set) get().~R();
+       }
+
+       R &get() { return *reinterpret_cast<R *>(storage); }
+   };
+
+   template<class R, class MapFn, class ReduceFn>
+   struct FoldPiece {
+       const map *owner;
+       const Piece *pieces;
+       Partial<R> *parts;
+       MapFn *mapFn;
+       ReduceFn *reduceFn;
+
+       // Walker callback; acc starts as the piece's first element, which
+       // the walk then skips
+       struct Step {
+           R acc;
+           bool started;
+           MapFn *mapFn;
+           ReduceFn *reduceFn;
+
+           bool operator()(const value_type &v) {
+               if (started) {
+                   acc = (*reduceFn)(acc, (*mapFn)(v));
+               } else {
+                   started = true;
+               }
+               return true;
+           }
+       };
+
+       void operator()(size_t i) const {
+           Ref x = pieces[i].node;
+           Ref first = pieces[i].whole ? owner->minimum(x) : x;
+           Step step = {(*mapFn)(owner->value(first)), false, mapFn, reduceFn};
+           if (pieces[i].whole) {
+               owner->template walkForward<const value_type>(x, nullptr, nullptr, step);
+           } else {
+               for (size_t j = 0; j < pieces[i].count; ++j, x = owner->successor(x)) step(owner->value(x));
+           }
+           new (placement_tag(), parts[i].storage) R(step.acc);
+           parts[i].set = true;
+       }
+   };
+
+   void checkHint(const map *owner, Ref x) const {
+       if (!x || (!SLIM_ITERATORS && owner != this)) {
+           SJTU_THROW(invalid_iterator());
+       }
+   }
+
+   Ref copyNode(const map &other, Ref x, Ref p) {
+       Ref y = createNode(other.value(x), p);
+       setColor(y, other.color(x));
+       return y;
+   }
+
+   // Copy other's tree below p.  x and its copy y move in step along the
+   // links, a missing child of y telling which subtree of x comes next,
+   // so any depth works without a stack (a splay tree can be a path).
+   Ref copyTree(const map &other, Ref p) {
+       Ref x = other.root, last = Ref();
+       if (!x) return Ref();
+       Ref t = copyNode(other, x, p), y = t;
+       SJTU_TRY {
+           for (;;) {
+               if (other.left(x) && !left(y)) {
+                   x = other.left(x);
+                   Ref c = copyNode(other, x, y);
+                   left(y) = c;
+                   y = c;
+                   continue;
+               }
+               if (!right(y)) {
+                   threadAfter(last, y, ThreadMode());
+                   last = y;
+                   if (other.right(x)) {
+                       x = other.right(x);
+                       Ref c = copyNode(other, x, y);
+                       right(y) = c;
+                       y = c;
+                       continue;
+                   }
+               }
+               if (y == t) return t;
+               x = other.parent(x);
+               y = parent(y);
+           }
+       } SJTU_CATCH_ALL {
+           // A copy failed: every node made so far hangs below t
+           destroySubtree(t);
+           SJTU_RETHROW;
+       }
+   }
+
+   void copyFrom(const map &other) {
+       setRoot(copyTree(other, top()));
+       nodeCount = other.nodeCount;
+       refreshFilter(FilterMode());
+   }
+
+   // Destroy the values of a subtree; the pool releases the slots
+   // wholesale.  Right rotations unroll the subtree into its right spine
+   // on the way, so no depth needs a stack.
+   void destroyTree(Ref x) {
+       while (x) {
+           Ref l = left(x);
+           if (l) {
+               left(x) = right(l);
+               right(l) = x;
+               x = l;
+           } else {
+               Ref r = right(x);
+               destroyValue(x, ValueMode());
+               x = r;
+           }
+       }
+   }
+
+   // Move a node into a slot outside the draining blocks and relink it
+   void relocate(Ref x) {
+       Ref y = pool.allocate();
+       SJTU_TRY {
+           constructValue(y, value(x), ValueMode());
+       } SJTU_CATCH_ALL {
+           pool.deallocate(y);
+           SJTU_RETHROW;
+       }
+       static_cast<NodeBase &>(node(y)) = node(x);
+       setAccessCount(y, accessCount(x, CountMode()), CountMode());
+       if (parent(x) == top()) {
+           setRoot(y);
+       } else if (x == left(parent(x))) {
+           left(parent(x)) = y;
+       } else {
+           right(parent(x)) = y;
+       }
+       if (left(y)) setParent(left(y), y);
+       if (right(y)) setParent(right(y), y);
+       threadRelink(y, ThreadMode());
+       destroyNode(x);
+   }
+
+   // Van Emde Boas order of the top h levels below x: the upper half of
+   // the levels first, then each subtree hanging below them in turn
+   void vebOrder(Ref x, int h, Ref *out, size_t &n) const {
+       if (!x) return;
+       if (h == 1) {
+           out[n++] = x;
+           return;
+       }
+       int upper = h / 2;
+       vebOrder(x, upper, out, n);
+       vebBelow(x, upper, h - upper, out, n);
+   }
+
+   // vebOrder() of each subtree rooted depth levels below x
+   void vebBelow(Ref x, int depth, int h, Ref *out, size_t &n) const {
+       if (!x) return;
+       if (depth == 0) {
+           vebOrder(x, h, out, n);
+           return;
+       }
+       vebBelow(left(x), depth - 1, h, out, n);
+       vebBelow(right(x), depth - 1, h, out, n);
+   }
+
+   // Sizes a subtree of black height h can have: at least 2^h - 1 (all
+   // black), at most 4^h - 1 with a black root and 2 * 4^h - 1 with a red
+   static size_t fewestNodes(int h) {
+       return (size_t(1) << h) - 1;
+   }
+
+   static size_t mostNodes(int h, bool blackRoot) {
+       if (2 * h + 2 >= int(8 * sizeof(size_t))) return ~size_t(0);
+       size_t most = (size_t(1) << (2 * h)) - 1;
+       return blackRoot ? most : 2 * most + 1;
+   }
+
+   // Sizes of an AVL tree of height h: at least one more than the
+   // minimum sizes for h - 1 and h - 2 together, at most 2^h - 1
+   static size_t fewestAvlNodes(int h) {
+       size_t below = 0, fewest = 0;
+       for (int i = 0; i < h; ++i) {
+           size_t next = fewest + below + 1;
+           below = fewest;
+           fewest = next;
+       }
+       return fewest;
+   }
+
+   static size_t mostAvlNodes(int h) {
+       if (h >= int(8 * sizeof(size_t))) return ~size_t(0);
+       return (size_t(1) << h) - 1;
+   }
+
+   // Left subtree sizes that give a node over m positions children of
+   // [fewestL, mostL] and [fewestR, mostR] nodes, as [lo, hi]; false if
+   // there are none
+   static bool leftSizes(size_t m, size_t fewestL, size_t mostL, size_t fewestR, size_t mostR,
+                         size_t &lo, size_t &hi) {
+       if (m - 1 < fewestL + fewestR) return false;
+       lo = m - 1 > mostR ? m - 1 - mostR : 0;
+       if (lo < fewestL) lo = fewestL;
+       hi = m - 1 - fewestR;
+       if (hi > mostL) hi = mostL;
+       return lo <= hi;
+   }
+
+   // v moved into [lo, hi], and its distance from there
+   static size_t clampTo(size_t v, size_t lo, size_t hi, size_t &distance) {
+       size_t c = v < lo ? lo : v > hi ? hi : v;
+       distance = c > v ? c - v : v - c;
+       return c;
+   }
+
+   // rebuild_by_frequency(): the nodes in key order and the prefix sums
+   // of their weights
+   struct WeightedRun {
+       Ref *nodes;
+       const unsigned long long *prefix;
+   };
+
+   // Last position in [lo, hi) whose weight starts at or before the
+   // middle of the range's weight
+   static size_t weightMiddle(const WeightedRun &run, size_t lo, size_t hi) {
+       unsigned long long half = run.prefix[lo] + (run.prefix[hi] - run.prefix[lo]) / 2;
+       size_t l = lo, r = hi - 1;
+       while (l < r) {
+           size_t mid = l + (r - l + 1) / 2;
+           if (run.prefix[mid] <= half) l = mid;
+           else r = mid - 1;
+       }
+       return l;
+   }
+
+   // Red-black subtree of black height h over positions [lo, hi), whose
+   // count must suit h: the root is the position nearest the middle of
+   // the range's weight that leaves both sides a count they can take
+   Ref weightedSubtree(const WeightedRun &run, size_t lo, size_t hi, int h, bool blackRoot, Ref p) {
+       if (lo == hi) return Ref();
+       size_t m = hi - lo, want = weightMiddle(run, lo, hi) - lo;
+       size_t blackLo = 0, blackHi = 0, redLo = 0, redHi = 0, blackOff, redOff;
+       bool black = false, red = false;
+       if (h > 0) {
+           size_t fewest = fewestNodes(h - 1), most = mostNodes(h - 1, false);
+           black = leftSizes(m, fewest, most, fewest, most, blackLo, blackHi);
+       }
+       if (!blackRoot) {
+           size_t fewest = fewestNodes(h), most = mostNodes(h, true);
+           red = leftSizes(m, fewest, most, fewest, most, redLo, redHi);
+       }
+       size_t blackAt = clampTo(want, blackLo, blackHi, blackOff);
+       size_t redAt = clampTo(want, redLo, redHi, redOff);
+       if (red && (!black || redOff < blackOff)) black = false;
+       size_t at = black ? blackAt : redAt;
+       Ref x = run.nodes[lo + at];
+       setParent(x, p);
+       setColor(x, black ? BLACK : RED);
+       int below = black ? h - 1 : h;
+       left(x) = weightedSubtree(run, lo, lo + at, below, !black, x);
+       right(x) = weightedSubtree(run, lo + at + 1, hi, below, !black, x);
+       return x;
+   }
+
+   // The same for an AVL subtree of height h: the children are of
+   // heights h - 1 and h - 1, h - 2 or h - 2 and h - 1
+   Ref weightedAvlSubtree(const WeightedRun &run, size_t lo, size_t hi, int h, Ref p) {
+       if (lo == hi) return Ref();
+       size_t m = hi - lo, want = weightMiddle(run, lo, hi) - lo, at = 0, best = ~size_t(0);
+       int hl = 0, hr = 0;
+       for (int c = 0; c < (h > 1 ? 3 : 1); ++c) {
+           int l = h - 1 - (c == 2), r = h - 1 - (c == 1);
+           size_t sizeLo, sizeHi, off;
+           if (!leftSizes(m, fewestAvlNodes(l), mostAvlNodes(l), fewestAvlNodes(r),
+                          mostAvlNodes(r), sizeLo, sizeHi)) {
+               continue;
+           }
+           size_t pos = clampTo(want, sizeLo, sizeHi, off);
+           if (off < best) {
+               best = off;
+               at = pos;
+               hl = l;
+               hr = r;
+           }
+       }
+       Ref x = run.nodes[lo + at];
+       setParent(x, p);
+       setRank(x, h);
+       left(x) = weightedAvlSubtree(run, lo, lo + at, hl, x);
+       right(x) = weightedAvlSubtree(run, lo + at + 1, hi, hr, x);
+       return x;
+   }
+
+   // Root of the weighted tree over all n positions
+   Ref weightedTree(const WeightedRun &run, size_t n, Tag<false>) {
+       // the lowest black height that holds n nodes under a black root
+       int h = 1;
+       while (mostNodes(h, true) < n) ++h;
+       return weightedSubtree(run, 0, n, h, true, top());
+   }
+
+   Ref weightedTree(const WeightedRun &run, size_t n, Tag<true>) {
+       int h = 0;
+       while (mostAvlNodes(h) < n) ++h;
+       return weightedAvlSubtree(run, 0, n, h, top());
+   }
+
+   // Sum and maximum of the node depths of a non-empty tree, walking in
+   // order along the links rather than recursing, for splay trees
+   void depthSum(size_t &total, size_t &maximum) const {
+       Ref x = root;
+       size_t depth = 1;
+       for (; left(x); x = left(x)) ++depth;
+       for (;;) {
+           total += depth;
+           if (depth > maximum) maximum = depth;
+           if (right(x)) {
+               x = right(x);
+               for (++depth; left(x); x = left(x)) ++depth;
+               continue;
+           }
+           // climb past the ancestors whose right subtree is done
+           while (parent(x) != top() && x == right(parent(x))) {
+               x = parent(x);
+               --depth;
+           }
+           if (parent(x) == top()) return;
+           x = parent(x);
+           --depth;
+       }
+   }
+
+   // Scratch array released on scope exit
+   template<class U>
+   struct Buffer {
+       U *data;
+
+       explicit Buffer(size_t n) : data(new U[n]) {}
+       ~Buffer() { delete[] data; }
+       U &operator[](size_t i) { return data[i]; }
+
+      private:
+       Buffer(const Buffer &);
+       Buffer &operator=(const Buffer &);
+   };
+
+   // Perfectly balanced subtree over nodes[lo, hi); only the deepest
+   // level, which may be incomplete, is red
+   Ref buildSubtree(Ref *nodes, size_t lo, size_t hi, Ref p, int depth, int redDepth) {
+       if (lo == hi) return Ref();
+       size_t mid = lo + (hi - lo) / 2;
+       Ref x = nodes[mid];
+       setParent(x, p);
+       if (Traits::avl_balancing) {
+           // halving gives subtrees of height the bit length of their size
+           int h = 0;
+           for (size_t size = hi - lo; size; size >>= 1) ++h;
+           setRank(x, h);
+       } else {
+           setColor(x, depth == redDepth ? RED : BLACK);
+       }
+       left(x) = buildSubtree(nodes, lo, mid, x, depth + 1, redDepth);
+       right(x) = buildSubtree(nodes, mid + 1, hi, x, depth + 1, redDepth);
+       return x;
+   }
+
+   // Replace the tree by a balanced one over nodes[0, n) in key order
+   void buildBalanced(Ref *nodes, size_t n) {
+       int redDepth = 0;
+       while ((size_t(2) << redDepth) <= n) ++redDepth;
+       // a lone root stays black
+       if (redDepth == 0) redDepth = -1;
+       setRoot(buildSubtree(nodes, 0, n, top(), 0, redDepth));
+       Ref last = Ref();
+       for (size_t i = 0; i < n; ++i) {
+           threadAfter(last, nodes[i], ThreadMode());
+           last = nodes[i];
+       }
+       nodeCount = n;
+       refreshFilter(FilterMode());
+   }
+
+   // Everything an iterator needs besides its node: the map, or nothing
+   // at all for a slim iterator
+   template<bool Slim, class Dummy = void>
+   struct Walker {
+       const map *mapPtr;
+
+       explicit Walker(const map *m) : mapPtr(m) {}
+
+       const map *owner() const { return mapPtr; }
+       bool attached() const { return mapPtr; }
+       bool isEnd(Ref x) const { return x == mapPtr->endRef(); }
+       Ref forward(Ref x) const { return mapPtr->successor(x); }
+       Ref backward(Ref x) const { return mapPtr->predecessor(x); }
+       value_type &valueOf(Ref x) const { return mapPtr->value(x); }
+   };
+
+   template<class Dummy>
+   struct Walker<true, Dummy> {
+       explicit Walker(const map *) {}
+
+       const map *owner() const { return nullptr; }
+       bool attached() const { return true; }
+       // the header is the only node without a parent
+       bool isEnd(Ref x) const { return !x->parent(); }
+       Ref forward(Ref x) const { return nodeSuccessor(x, ThreadMode()); }
+       Ref backward(Ref x) const { return nodePredecessor(x, ThreadMode()); }
+       value_type &valueOf(Ref x) const { return *static_cast<Node *>(x)->data(); }
+   };
+
+  public:
+   class const_iterator;
+   class iterator : private Walker<SLIM_ITERATORS> {
+      private:
+       Ref nodeRef;
+
+       friend class map;
+       friend class const_iterator;
+
+      public:
+       iterator(const map *m = nullptr, Ref n = Ref()) : Walker<SLIM_ITERATORS>(m), nodeRef(n) {}
+
+       iterator(const iterator &other) : Walker<SLIM_ITERATORS>(other.owner()), nodeRef(other.nodeRef) {}
+
+       iterator &operator=(const iterator &) = default;
+
+       /**
+        * Checked steps that report instead of throwing: move and return
+        * errc::none, or leave the iterator as it is and return
+        * errc::invalid_iterator where ++ / -- would throw.
+        */
+       errc try_increment() {
+           if (!nodeRef || this->isEnd(nodeRef)) return errc::invalid_iterator;
+           nodeRef = this->forward(nodeRef);
+           return errc::none;
+       }
+
+       errc try_decrement() {
+           if (!this->attached() || !nodeRef) return errc::invalid_iterator;
+           Ref pred = this->backward(nodeRef);
+           if (!pred) return errc::invalid_iterator;
+           nodeRef = pred;
+           return errc::none;
+       }
+
+       iterator operator++(int) {
+           iterator temp = *this;
+           ++*this;
+           return temp;
+       }
+
+       iterator &operator++() {
+           if (!Traits::checked_iterators) {
+               nodeRef = this->forward(nodeRef);
+           } else if (try_increment() != errc::none) {
+               SJTU_THROW(invalid_iterator());
+           }
+           return *this;
+       }
+
+       iterator operator--(int) {
+           iterator temp = *this;
+           --*this;
+           return temp;
+       }
+
+       iterator &operator--() {
+           if (!Traits::checked_iterators) {
+               nodeRef = this->backward(nodeRef);
+           } else if (try_decrement() != errc::none) {
+               SJTU_THROW(invalid_iterator());
+           }
+           return *this;
+       }
+
+       value_type &operator*() const {
+           if (Traits::checked_iterators && (!nodeRef || this->isEnd(nodeRef))) {
+               SJTU_THROW(invalid_iterator());
+           }
+           return this->valueOf(nodeRef);
+       }
+
+       bool operator==(const iterator &rhs) const {
+           return this->owner() == rhs.owner() && nodeRef == rhs.nodeRef;
+       }
+
+       bool operator==(const const_iterator &rhs) const {
+           return this->owner() == rhs.owner() && nodeRef == rhs.nodeRef;
+       }
+
+       bool operator!=(const iterator &rhs) const {
+           return !(*this == rhs);
+       }
+
+       bool operator!=(const const_iterator &rhs) const {
+           return !(*this == rhs);
+       }
+
+       value_type *operator->() const noexcept {
+           return &this->valueOf(nodeRef);
+       }
+   };
+
+   class const_iterator : private Walker<SLIM_ITERATORS> {
+      private:
+       Ref nodeRef;
+
+       friend class map;
+       friend class iterator;
+
+      public:
+       const_iterator(const map *m = nullptr, Ref n = Ref()) : Walker<SLIM_ITERATORS>(m), nodeRef(n) {}
+
+       const_iterator(const const_iterator &other) : Walker<SLIM_ITERATORS>(other.owner()), nodeRef(other.nodeRef) {}
+
+       const_iterator(const iterator &other) : Walker<SLIM_ITERATORS>(other.owner()), nodeRef(other.nodeRef) {}
+
+       const_iterator &operator=(const const_iterator &) = default;
+
+       errc try_increment() {
+           if (!nodeRef || this->isEnd(nodeRef)) return errc::invalid_iterator;
+           nodeRef = this->forward(nodeRef);
+           return errc::none;
+       }
+
+       errc try_decrement() {
+           if (!this->attached() || !nodeRef) return errc::invalid_iterator;
+           Ref pred = this->backward(nodeRef);
+           if (!pred) return errc::invalid_iterator;
+           nodeRef = pred;
+           return errc::none;
+       }
+
+       const_iterator operator++(int) {
+           const_iterator temp = *this;
+           ++*this;
+           return temp;
+       }
+
+       const_iterator &operator++() {
+           if (!Traits::checked_iterators) {
+               nodeRef = this->forward(nodeRef);
+           } else if (try_increment() != errc::none) {
+               SJTU_THROW(invalid_iterator());
+           }
+           return *this;
+       }
+
+       const_iterator operator--(int) {
+           const_iterator temp = *this;
+           --*this;
+           return temp;
+       }
+
+       const_iterator &operator--() {
+           if (!Traits::checked_iterators) {
+               nodeRef = this->backward(nodeRef);
+           } else if (try_decrement() != errc::none) {
+               SJTU_THROW(invalid_iterator());
+           }
+           return *this;
+       }
+
+       const value_type &operator*() const {
+           if (Traits::checked_iterators && (!nodeRef || this->isEnd(nodeRef))) {
+               SJTU_THROW(invalid_iterator());
+           }
+           return this->valueOf(nodeRef);
+       }
+
+       bool operator==(const iterator &rhs) const {
+           return this->owner() == rhs.owner() && nodeRef == rhs.nodeRef;
+       }
+
+       bool operator==(const const_iterator &rhs) const {
+           return this->owner() == rhs.owner() && nodeRef == rhs.nodeRef;
+       }
+
+       bool operator!=(const iterator &rhs) const {
+           return !(*this == rhs);
+       }
+
+       bool operator!=(const const_iterator &rhs) const {
+           return !(*this == rhs);
+       }
+
+       const value_type *operator->() const noexcept {
+           return &this->valueOf(nodeRef);
+       }
+   };
+
+   map() : root(), header(), nodeCount(0), lookupTick(0) {}
+
+   map(const map &other) : root(), header(), nodeCount(0), comp(other.comp), lookupTick(0) {
+       copyFrom(other);
+   }
+
+   map &operator=(const map &other) {
+       if (this == &other) return *this;
+       clear();
+       comp = other.comp;
+       copyFrom(other);
+       return *this;
+   }
+
+   ~map() {
+       clear();
+   }
+
+   T &at(const Key &key) {
+       Ref x = accessNode(key);
+       if (!x) SJTU_THROW(index_out_of_bound());
+       return value(x).second;
+   }
+
+   const T &at(const Key &key) const {
+       Ref x = findNode(key);
+       if (!x) SJTU_THROW(index_out_of_bound());
+       return value(x).second;
+   }
+
+   /**
+    * Non-throwing lookups.  find_ptr returns the mapped value of key, or
+    * nullptr if there is none; try_at stores that pointer in out and
+    * returns errc::index_out_of_bound instead of throwing like at().
+    */
+   T *find_ptr(const Key &key) {
+       Ref x = accessNode(key);
+       return x ? &value(x).second : nullptr;
+   }
+
+   const T *find_ptr(const Key &key) const {
+       Ref x = findNode(key);
+       return x ? &value(x).second : nullptr;
+   }
+
+   errc try_at(const Key &key, T *&out) {
+       out = find_ptr(key);
+       return out ? errc::none : errc::index_out_of_bound;
+   }
+
+   errc try_at(const Key &key, const T *&out) const {
+       out = find_ptr(key);
+       return out ? errc::none : errc::index_out_of_bound;
+   }
+
+   T &operator[](const Key &key) {
+       Ref x = accessNode(key);
+       if (x) return value(x).second;
+
+       // Insert new element with default value
+       pair<iterator, bool> result = insert(value_type(key, T()));
+       return value(result.first.nodeRef).second;
+   }
+
+   const T &operator[](const Key &key) const {
+       Ref x = findNode(key);
+       if (!x) SJTU_THROW(index_out_of_bound());
+       return value(x).second;
+   }
+
+   iterator begin() {
+       Ref min = minimum(root);
+       if (min) return iterator(this, min);
+       return end();
+   }
+
+   const_iterator cbegin() const {
+       Ref min = minimum(root);
+       if (min) return const_iterator(this, min);
+       return cend();
+   }
+
+   iterator end() {
+       return iterator(this, endRef());
+   }
+
+   const_iterator cend() const {
+       return const_iterator(this, endRef());
+   }
+
+   bool empty() const {
+       return nodeCount == 0;
+   }
+
+   size_t size() const {
+       return nodeCount;
+   }
+
+   void clear() {
+       destroyTree(root);
+       cache.flush();
+       filter.release(0);
+       pool.clear();
+       setRoot(Ref());
+       nodeCount = 0;
+   }
+
+   /**
+    * Number of node slots currently reserved by the map, live or free.
+    * size() / capacity() is the fraction of node storage in use.
+    */
+   size_t capacity() const {
+       return pool.capacity();
+   }
+
+   /**
+    * Compact the surviving elements into as few blocks as possible and
+    * return the emptied blocks to the allocator.
+    * This is the only operation that relocates elements: it invalidates
+    * all iterators, pointers and references into the map.  If copying
+    * an element throws, the map keeps all its elements, the ones moved
+    * so far in their new slots, and no block stays marked for draining.
+    */
+   void shrink_to_fit() {
+       if (!root) {
+           pool.clear();
+           return;
+       }
+       if (!pool.planCompaction()) return;
+       SJTU_TRY {
+           Ref x = minimum(root);
+           while (x != endRef()) {
+               Ref next = successor(x);
+               if (pool.isDraining(x)) relocate(x);
+               x = next;
+           }
+       } SJTU_CATCH_ALL {
+           pool.cancelDrain();
+           SJTU_RETHROW;
+       }
+       pool.releaseDrained();
+   }
+
+   /**
+    * Where optimize() leaves the nodes in memory: in their current slots,
+    * or moved to fresh blocks in breadth-first or van Emde Boas order of
+    * the rebuilt tree, so that the top levels of every search share
+    * cache lines.
+    */
+   enum node_layout { KEEP_LAYOUT, BREADTH_FIRST, VAN_EMDE_BOAS };
+
+   /**
+    * Relink every node into a perfectly balanced tree, O(n): a search
+    * then visits at most floor(log2(n)) + 1 nodes, against up to about
+    * twice that after a long insert/erase history.  With KEEP_LAYOUT no
+    * key or value is copied and iterators stay valid.  The other layouts
+    * then also move every element to a fresh slot, copying its value
+    * and briefly holding twice the node storage, and invalidate all
+    * iterators, pointers and references like shrink_to_fit().
+    */
+   void optimize(node_layout layout = KEEP_LAYOUT) {
+       if (!root) return;
+       size_t n = nodeCount, i = 0;
+       Buffer<Ref> nodes(n);
+       for (Ref x = minimum(root); x != endRef(); x = successor(x)) nodes[i++] = x;
+       buildBalanced(nodes.data, n);
+       relayout(layout, nodes.data);
+   }
+
+   /**
+    * Shape of the tree: the depth of a node is the number of nodes a
+    * search for its key visits, 1 for the root.  All zero when empty.
+    */
+   struct depth_stats {
+       double average;
+       size_t maximum;
+   };
+
+   depth_stats tree_depth() const {
+       depth_stats st = {0, 0};
+       if (!root) return st;
+       size_t total = 0;
+       depthSum(total, st.maximum);
+       st.average = double(total) / nodeCount;
+       return st;
+   }
+
+   /**
+    * Reshape the tree by the access counters (map_traits::access_sample)
+    * so that frequently found keys sit near the root.  Each node weighs
+    * its count plus one, and every subtree's root is the node nearest the
+    * middle of the subtree's weight (which alone would keep the average
+    * search within a couple of nodes of the optimal static tree) among
+    * those that leave both sides enough nodes for a valid red-black
+    * coloring, or valid AVL heights.  The map thus stays an ordinary
+    * balanced tree, and later inserts and erases keep working as usual;
+    * the hottest keys can sit at the top as long as enough keys (about
+    * sqrt(n) in a red-black tree) lie on either side of them.
+    * O(n log n).  The layout is as for optimize(): with KEEP_LAYOUT no
+    * element moves and iterators stay valid, but the hot nodes at the
+    * top then lie wherever they were allocated, and a search pays a
+    * cache and TLB miss for nearly every level, so a relayout is usually
+    * worth it.  The counters are halved afterwards so that the next
+    * rebuild follows shifts in popularity.  Without counters this builds
+    * a balanced tree like optimize().  A splay tree is left in the
+    * same balanced shape, which its next lookups then adjust.
+    */
+   void rebuild_by_frequency(node_layout layout = KEEP_LAYOUT) {
+       if (!root) return;
+       size_t n = nodeCount, i = 0;
+       Buffer<Ref> nodes(n);
+       Buffer<unsigned long long> prefix(n + 1);
+       prefix[0] = 0;
+       for (Ref x = minimum(root); x != endRef(); x = successor(x), ++i) {
+           nodes[i] = x;
+           prefix[i + 1] = prefix[i] + accessCount(x, CountMode()) + 1;
+           setAccessCount(x, accessCount(x, CountMode()) / 2, CountMode());
+       }
+       WeightedRun run = {nodes.data, prefix.data};
+       installRoot(weightedTree(run, n, BalanceMode()));
+       relayout(layout, nodes.data);
+   }
+
+   /**
+    * Automatic policy: when enabled, erase() hands a block back to the
+    * allocator as soon as its last element is gone.  Since only empty
+    * blocks are released, no element moves and iterators stay valid.
+    */
+   void set_auto_shrink(bool enable) {
+       pool.setReleaseEmpty(enable);
+   }
+
+   /**
+    * Hit and miss counts of the lookup cache (map_traits::lookup_cache_slots).
+    * Every insert and every find, at, find_ptr, try_at or operator[] of a
+    * non-const map consults the cache once and counts; lookups through a
+    * const map, count() among them, use the cache but are not counted.
+    * Without a cache both counts stay 0.
+    */
+   struct lookup_stats {
+       size_t hits;
+       size_t misses;
+   };
+
+   lookup_stats lookup_cache_stats() const {
+       lookup_stats st = {cache.hitCount(), cache.missCount()};
+       return st;
+   }
+
+   void reset_lookup_cache_stats() {
+       cache.resetStats();
+   }
+
+   /**
+    * Counters of the membership filter (map_traits::filter_bits_per_key).
+    * queries counts the find, at, find_ptr, try_at and operator[] calls
+    * of a non-const map, rejected the ones answered without touching the
+    * tree, false_positives the ones that passed the filter and still
+    * found nothing.  Lookups through a const map, count() among them, are
+    * filtered too but not counted, so that they never write to the map.
+    * The filter is rebuilt when the map outgrows it and when erased keys,
+    * whose bits cannot be cleared, outnumber half of the live ones.  All
+    * zero without a filter.
+    */
+   struct filter_stats {
+       size_t queries;
+       size_t rejected;
+       size_t false_positives;
+       size_t rebuilds;
+       size_t bits;
+       size_t stale_keys;
+   };
+
+   filter_stats membership_filter_stats() const {
+       filter_stats st;
+       filter.fill(st);
+       return st;
+   }
+
+   void reset_membership_filter_stats() {
+       filter.resetStats();
+   }
+
+   pair<iterator, bool> insert(const value_type &val) {
+       Ref cached = cacheLookup(val.first, CacheMode());
+       if (cached) {
+           splay(cached, SplayMode());
+           return pair<iterator, bool>(iterator(this, cached), false);
+       }
+
+       // Find position to insert
+       Ref p = Ref();
+       Ref current = root;
+
+       while (current) {
+           p = current;
+           if (keyEqual(val.first, key(current))) {
+               // Key already exists
+               cacheStore(val.first, current, CacheMode());
+               splay(current, SplayMode());
+               return pair<iterator, bool>(iterator(this, current), false);
+           } else if (keyLess(val.first, key(current))) {
+               current = left(current);
+           } else {
+               current = right(current);
+           }
+       }
+
+       // Create new node
+       Ref z = createNode(val, p);
+       attachNode(z, p, p && keyLess(val.first, key(p)));
+       cacheStore(val.first, z, CacheMode());
+       return pair<iterator, bool>(iterator(this, z), true);
+   }
+
+   void erase(iterator pos) {
+       if (try_erase(pos) != errc::none) SJTU_THROW(invalid_iterator());
+   }
+
+   // erase() that returns errc::invalid_iterator instead of throwing
+   errc try_erase(iterator pos) {
+       if (!pos.nodeRef || pos.nodeRef == endRef() || (!SLIM_ITERATORS && pos.owner() != this)) {
+           return errc::invalid_iterator;
+       }
+       eraseNode(pos.nodeRef);
+       return errc::none;
+   }
+
+   /**
+    * Erase the first / last element; throws container_is_empty if there
+    * is none.
+    */
+   void pop_front() {
+       if (!root) SJTU_THROW(container_is_empty());
+       eraseNode(minimum(root));
+   }
+
+   void pop_back() {
+       if (!root) SJTU_THROW(container_is_empty());
+       eraseNode(maximum(root));
+   }
+
+   /**
+    * Erase every element whose key is less than key (trim_before) or
+    * greater than key (trim_after); returns how many were erased.  The
+    * tree is cut at key in O(log n) (amortized in a splay tree, which
+    * splays the outermost element kept) and the k erased elements are
+    * destroyed in O(k), without rebalancing after each one.  Iterators
+    * to the remaining elements stay valid.
+    */
+   size_t trim_before(const Key &key) {
+       return trim(key, true);
+   }
+
+   size_t trim_after(const Key &key) {
+       return trim(key, false);
+   }
+
+   /**
+    * Erase every element for which pred(value) is true, calling pred once
+    * per element in key order; returns how many were erased.  While the
+    * share erased so far is small, elements are erased one by one; once
+    * it reaches 1 / ERASE_REBUILD_RATIO, the rest of the walk relinks the
+    * survivors into a new balanced tree as it goes, in O(1) per element
+    * instead of a rebalancing erase each (never in a splay tree, which
+    * that walk cannot hold on its stack).  Either way the survivors keep
+    * their nodes: their addresses and iterators stay valid.  If pred
+    * throws, the elements erased so far stay erased.
+    */
+   template<class Pred>
+   size_t erase_if(Pred pred) {
+       size_t erased = 0, seen = 0;
+       for (Ref x = root ? minimum(root) : endRef(); x != endRef();) {
+           if (!Traits::splay_tree && seen >= ERASE_SAMPLE &&
+               erased * ERASE_REBUILD_RATIO >= seen) {
+               return erased + eraseRebuilding(x, pred);
+           }
+           Ref after = successor(x);
+           ++seen;
+           if (pred(const_cast<const value_type &>(value(x)))) {
+               eraseNode(x);
+               ++erased;
+           }
+           x = after;
+       }
+       return erased;
+   }
+
+   size_t count(const Key &key) const {
+       return findNode(key) ? 1 : 0;
+   }
+
+   iterator find(const Key &key) {
+       Ref x = accessNode(key);
+       return x ? iterator(this, x) : end();
+   }
+
+   const_iterator find(const Key &key) const {
+       Ref x = findNode(key);
+       return x ? const_iterator(this, x) : cend();
+   }
+
+   /**
+    * Iterator to the first element whose key is not less than key,
+    * or end() if there is none.
+    */
+   iterator lower_bound(const Key &key) {
+       return iterator(this, lowerBoundIn(root, key, endRef()));
+   }
+
+   const_iterator lower_bound(const Key &key) const {
+       return const_iterator(this, lowerBoundIn(root, key, endRef()));
+   }
+
+   /**
+    * Finger search: same result as lower_bound(key) / find(key), but the
+    * search starts at hint and climbs only as far as needed before
+    * descending again.  Probing keys near the previous result (sequential
+    * or clustered access) touches O(log d) nodes, d being the distance in
+    * elements; a far-away key costs at most two root-to-leaf paths.
+    * hint may be end().  throw invalid_iterator if hint is not an
+    * iterator of this map.
+    */
+   iterator lower_bound_from(iterator hint, const Key &key) {
+       checkHint(hint.owner(), hint.nodeRef);
+       return iterator(this, lowerBoundFrom(hint.nodeRef, key));
+   }
+
+   const_iterator lower_bound_from(const_iterator hint, const Key &key) const {
+       checkHint(hint.owner(), hint.nodeRef);
+       return const_iterator(this, lowerBoundFrom(hint.nodeRef, key));
+   }
+
+   iterator find_from(iterator hint, const Key &key) {
+       iterator it = lower_bound_from(hint, key);
+       if (it.nodeRef == endRef() || keyLess(key, this->key(it.nodeRef))) {
+           return end();
+       }
+       return it;
+   }
+
+   const_iterator find_from(const_iterator hint, const Key &key) const {
+       const_iterator it = lower_bound_from(hint, key);
+       if (it.nodeRef == endRef() || keyLess(key, this->key(it.nodeRef))) {
+           return cend();
+       }
+       return it;
+   }
+
+   /**
+    * Batched lookup: out[i] = find(keys[i]) for i in [0, n).
+    * Several descents run interleaved, so on trees larger than the cache
+    * their memory stalls overlap; SJTU_MAP_USE_BUILTINS adds software
+    * prefetch of each lane's next node.
+    */
+   void find_many(const Key *keys, size_t n, iterator *out) {
+       findMany(keys, n, out);
+   }
+
+   void find_many(const Key *keys, size_t n, const_iterator *out) const {
+       findMany(keys, n, out);
+   }
+
+   /**
+    * Internal iteration: call f(value) on every element in ascending key
+    * order until f returns false.  The walk keeps its own stack of
+    * pending ancestors, so it neither climbs parent links nor validates
+    * an iterator per step.
+    * f must not insert or erase elements.  Returns false if f stopped
+    * the walk early, true otherwise.
+    */
+   template<class F>
+   bool for_each(F f) {
+       return walkForward<value_type>(root, nullptr, nullptr, f);
+   }
+
+   template<class F>
+   bool for_each(F f) const {
+       return walkForward<const value_type>(root, nullptr, nullptr, f);
+   }
+
+   // for_each() over the elements whose keys lie in [lo, hi)
+   template<class F>
+   bool for_each_in_range(const Key &lo, const Key &hi, F f) {
+       return walkForward<value_type>(root, &lo, &hi, f);
+   }
+
+   template<class F>
+   bool for_each_in_range(const Key &lo, const Key &hi, F f) const {
+       return walkForward<const value_type>(root, &lo, &hi, f);
+   }
+
+   // for_each() in descending key order
+   template<class F>
+   bool reverse_for_each(F f) {
+       return walkBackward<value_type>(root, nullptr, nullptr, f);
+   }
+
+   template<class F>
+   bool reverse_for_each(F f) const {
+       return walkBackward<const value_type>(root, nullptr, nullptr, f);
+   }
+
+   // for_each_in_range() in descending key order
+   template<class F>
+   bool reverse_for_each_in_range(const Key &lo, const Key &hi, F f) {
+       return walkBackward<value_type>(root, &lo, &hi, f);
+   }
+
+   template<class F>
+   bool reverse_for_each_in_range(const Key &lo, const Key &hi, F f) const {
+       return walkBackward<const value_type>(root, &lo, &hi, f);
+   }
+
+   /**
+    * Parallel visitors.  pool runs the tasks: a work_stealing_pool (see
+    * work_stealing_pool.hpp) or any type whose run(n, task) calls
+    * task(i) for every i in [0, n) and returns when all are done.  The
+    * tree is cut below depth PARALLEL_CUT into up to 256 subtrees and
+    * the nodes above them; maps below PARALLEL_MIN elements are walked on
+    * the calling thread.  A splay tree (map_traits::splay_tree) can be
+    * too lopsided for such a cut, down to a single path after ascending
+    * inserts; it is cut instead into 256 runs of equal length, which an
+    * O(n) walk on the calling thread finds first.
+    *
+    * parallel_for_each() calls f(value) once per element, concurrently
+    * and in no particular order, so f must be safe to call from several
+    * threads at once.  The map must not be modified meanwhile, except
+    * for the mapped values f is handed.
+    */
+   template<class Pool, class F>
+   void parallel_for_each(Pool &pool, F f) {
+       parallelVisit<value_type>(pool, f);
+   }
+
+   template<class Pool, class F>
+   void parallel_for_each(Pool &pool, F f) const {
+       parallelVisit<const value_type>(pool, f);
+   }
+
+   /**
+    * Fold of map_fn(value) over the elements in key order, starting from
+    * init: reduce_fn(...reduce_fn(init, map_fn(first))..., map_fn(last)),
+    * except that each piece of the cut is folded on its own and the
+    * piece results are then folded in key order.  The grouping depends
+    * only on the tree's shape (in a splay tree, on size()), not on the
+    * pool or scheduling, so an associative reduce_fn gives exactly the
+    * sequential result (no commutativity needed), and any reduce_fn
+    * gives the same result on every run.  map_fn and reduce_fn are
+    * called concurrently.
+    */
+   template<class Pool, class R, class MapFn, class ReduceFn>
+   R parallel_reduce(Pool &pool, R init, MapFn map_fn, ReduceFn reduce_fn) const {
+       Buffer<Piece> pieces(size_t(2) << PARALLEL_CUT);
+       size_t n = cutPieces(pieces.data, SplayMode());
+       Buffer<Partial<R> > parts(n);
+       FoldPiece<R, MapFn, ReduceFn> task = {this, pieces.data, parts.data, &map_fn, &reduce_fn};
+       runPieces(pool, n, task);
+       for (size_t i = 0; i < n; ++i) {
+           if (parts[i].set) init = reduce_fn(init, parts[i].get());
+       }
+       return init;
+   }
+
+   /**
+    * Divide the map into k contiguous ranges of roughly equal size for
+    * parallel consumers.  out[i] is the (begin, end) of the i-th range in
+    * key order: out[0].first is begin(), out[k - 1].second is end(), and
+    * every range ends where the next one begins.  Sizes are estimated
+    * from the shape of the tree in O(k log n), without counting the
+    * elements, so the ranges are balanced only approximately; some are
+    * empty when the map has few elements.  A splay tree's shape tells
+    * nothing about sizes, so there the elements are counted by a walk
+    * in O(n) instead, and the range sizes differ by at most one.  While
+    * nobody modifies the map, the ranges can be iterated from several
+    * threads at once.
+    */
+   void partition(size_t k, pair<iterator, iterator> *out) {
+       if (k == 0) return;
+       Buffer<Ref> first(k + 1);
+       partitionPoints(k, first.data, SplayMode());
+       for (size_t i = 0; i < k; ++i) {
+           out[i].first = iterator(this, first[i]);
+           out[i].second = iterator(this, first[i + 1]);
+       }
+   }
+
+   void partition(size_t k, pair<const_iterator, const_iterator> *out) const {
+       if (k == 0) return;
+       Buffer<Ref> first(k + 1);
+       partitionPoints(k, first.data, SplayMode());
+       for (size_t i = 0; i < k; ++i) {
+           out[i].first = const_iterator(this, first[i]);
+           out[i].second = const_iterator(this, first[i + 1]);
+       }
+   }
+
+   /**
+    * Set operations built on red-black split and join.  With m elements
+    * in the smaller map and n in the larger one, the tree work is
+    * O(m log(n / m + 1)): recursing over other's tree, each step splits
+    * this map's tree by one key and later joins the two results back.
+    * The pool overloads expand the top levels of that recursion first
+    * and run the independent subproblems below on pool (see
+    * parallel_for_each()); below PARALLEL_MIN elements they stay on the
+    * calling thread.  Elements of this map keep their nodes, so
+    * iterators to the ones that stay remain valid.  Dropped elements are
+    * freed one at a time, which dominates intersect() when it keeps a
+    * small part of a large map.  Maintaining the thread (threaded) or
+    * the membership filter adds an O(n) pass.  A splay tree
+    * (map_traits::splay_tree) instead merges the two maps' elements in
+    * key order and rebuilds itself balanced, in O(n + m) on the calling
+    * thread.
+    *
+    * merge_union() adds other's elements; where both maps hold a key,
+    * the mapped value becomes combine(mine, theirs).  other's elements
+    * are copied first, which costs O(|other|) more; if one of the copies
+    * throws, the map is left unchanged (a splay tree keeps the elements
+    * merged so far).  combine must not throw, and the pool overload
+    * calls it concurrently.
+    */
+   template<class Combine>
+   void merge_union(const map &other, Combine combine) {
+       SerialPool pool;
+       setOperation<SET_UNION>(pool, other, combine, SplayMode());
+   }
 
-   // Helper function to compare keys
-   bool keyEqual(const Key &a, const Key &b) const {
-       return !comp(a, b) && !comp(b, a);
+   template<class Pool, class Combine>
+   void merge_union(Pool &pool, const map &other, Combine combine) {
+       setOperation<SET_UNION>(pool, other, combine, SplayMode());
    }
 
-   bool keyLess(const Key &a, const Key &b) const {
-       return comp(a, b);
+   // Keep only the elements whose keys other also holds
+   void intersect(const map &other) {
+       SerialPool pool;
+       intersect(pool, other);
    }
 
-   // Find minimum node in subtree
-   Node* minimum(Node *node) const {
-       if (!node) return nullptr;
-       while (node->left) node = node->left;
-       return node;
+   template<class Pool>
+   void intersect(Pool &pool, const map &other) {
+       if (&other == this) return;
+       NoCombine none;
+       setOperation<SET_INTERSECT>(pool, other, none, SplayMode());
    }
 
-   // Find maximum node in subtree
-   Node* maximum(Node *node) const {
-       if (!node) return nullptr;
-       while (node->right) node = node->right;
-       return node;
+   // Remove the elements whose keys other holds
+   void difference(const map &other) {
+       SerialPool pool;
+       difference(pool, other);
    }
 
-   // Find successor of a node
-   Node* successor(Node *node) const {
-       if (!node) return endNode;
-       if (node->right) {
-           return minimum(node->right);
+   template<class Pool>
+   void difference(Pool &pool, const map &other) {
+       if (&other == this) {
+           clear();
+           return;
        }
-       Node *p = node->parent;
-       while (p && node == p->right) {
-           node = p;
-           p = p->parent;
-       }
-       return p ? p : endNode;
+       NoCombine none;
+       setOperation<SET_DIFFERENCE>(pool, other, none, SplayMode());
    }
 
-   // Find predecessor of a node
-   Node* predecessor(Node *node) const {
-       if (node == endNode) {
-           return maximum(root);
-       }
-       if (!node) return nullptr;
-       if (node->left) {
-           return maximum(node->left);
+   /**
+    * One operation of apply_batch().  mapped is read by INSERT and ASSIGN
+    * only and must stay valid until apply_batch() returns.
+    */
+   struct batch_op {
+       enum kind_type { INSERT, ASSIGN, ERASE, FIND };
+
+       kind_type kind;
+       Key key;
+       const T *mapped;
+
+       batch_op(kind_type kind, const Key &key, const T *mapped = nullptr)
+           : kind(kind), key(key), mapped(mapped) {}
+   };
+
+   /**
+    * done is what the single call would report: INSERT inserted, ASSIGN
+    * created the key rather than overwriting it, ERASE removed an
+    * element, FIND found one.  pos points to the element the op left
+    * behind, or is end() if there is none or a later op of the batch
+    * erased it.
+    */
+   struct batch_result {
+       iterator pos;
+       bool done;
+   };
+
+   /**
+    * Apply ops[0, n) with the same outcome as issuing them one at a time
+    * (insert, operator[] assignment, erase, find) and store the outcome
+    * of ops[i] in results[i].  The ops are stably sorted by key and the
+    * tree is walked once in key order; when the batch touches a large
+    * share of the keys the whole tree is rebuilt in one linear pass
+    * instead of rebalancing after every change.  Nodes are never moved,
+    * so iterators to elements the batch keeps stay valid.
+    * If an op throws, the ops before it in key order have been applied.
+    */
+   void apply_batch(const batch_op *ops, size_t n, batch_result *results) {
+       if (n == 0) return;
+       Buffer<size_t> scratch(2 * n);
+       for (size_t i = 0; i < n; ++i) {
+           scratch[i] = i;
        }
-       Node *p = node->parent;
-       while (p && node == p->left) {
-           node = p;
-           p = p->parent;
+       const size_t *order = sortBatch(ops, scratch.data, scratch.data + n, n);
+       size_t groups = 1;
+       for (size_t i = 1; i < n; ++i) {
+           if (keyLess(ops[order[i - 1]].key, ops[order[i]].key)) ++groups;
        }
-       return p;
-   }
-
-   // Left rotation
-   void rotateLeft(Node *x) {
-       Node *y = x->right;
-       x->right = y->left;
-       if (y->left) y->left->parent = x;
-       y->parent = x->parent;
-
-       if (!x->parent) {
-           root = y;
-       } else if (x == x->parent->left) {
-           x->parent->left = y;
+       if (groups * BATCH_REBUILD_RATIO >= nodeCount) {
+           batchRebuild(ops, order, n, groups, results);
        } else {
-           x->parent->right = y;
+           batchWalk(ops, order, n, results);
        }
-       y->left = x;
-       x->parent = y;
    }
 
-   // Right rotation
-   void rotateRight(Node *y) {
-       Node *x = y->left;
-       y->left = x->right;
-       if (x->right) x->right->parent = y;
-       x->parent = y->parent;
-
-       if (!y->parent) {
-           root = x;
-       } else if (y == y->parent->left) {
-           y->parent->left = x;
+  private:
+   // apply_batch() rebuilds once groups * ratio reaches size()
+   static const size_t BATCH_REBUILD_RATIO = 2;
+
+   // erase_if() switches to rebuilding once erased * ratio reaches the
+   // number of elements seen, after at least ERASE_SAMPLE of them
+   static const size_t ERASE_REBUILD_RATIO = 8;
+   static const size_t ERASE_SAMPLE = 64;
+
+   // Move every node to a fresh slot in the given order of the current
+   // tree; nodes is scratch space for nodeCount references
+   void relayout(node_layout layout, Ref *nodes) {
+       if (layout == KEEP_LAYOUT) return;
+       size_t n = nodeCount, i = 0;
+       if (layout == BREADTH_FIRST) {
+           // nodes doubles as the queue
+           nodes[0] = root;
+           for (size_t head = 0, tail = 1; head < tail; ++head) {
+               if (left(nodes[head])) nodes[tail++] = left(nodes[head]);
+               if (right(nodes[head])) nodes[tail++] = right(nodes[head]);
+           }
        } else {
-           y->parent->right = x;
+           size_t total = 0, height = 0;
+           depthSum(total, height);
+           vebOrder(root, int(height), nodes, i);
        }
-       x->right = y;
-       y->parent = x;
+       pool.drainAll();
+       SJTU_TRY {
+           for (i = 0; i < n; ++i) relocate(nodes[i]);
+       } SJTU_CATCH_ALL {
+           pool.cancelDrain();
+           SJTU_RETHROW;
+       }
+       pool.releaseDrained();
    }
 
-   // Fix tree after insertion
-   void insertFixup(Node *z) {
-       while (z->parent && z->parent->color == RED) {
-           if (z->parent == z->parent->parent->left) {
-               Node *y = z->parent->parent->right;
-               if (y && y->color == RED) {
-                   z->parent->color = BLACK;
-                   y->color = BLACK;
-                   z->parent->parent->color = RED;
-                   z = z->parent->parent;
-               } else {
-                   if (z == z->parent->right) {
-                       z = z->parent;
-                       rotateLeft(z);
-                   }
-                   z->parent->color = BLACK;
-                   z->parent->parent->color = RED;
-                   rotateRight(z->parent->parent);
-               }
-           } else {
-               Node *y = z->parent->parent->left;
-               if (y && y->color == RED) {
-                   z->parent->color = BLACK;
-                   y->color = BLACK;
-                   z->parent->parent->color = RED;
-                   z = z->parent->parent;
-               } else {
-                   if (z == z->parent->left) {
-                       z = z->parent;
-                       rotateRight(z);
+   // Stable bottom-up merge sort of op indices by key
+   const size_t *sortBatch(const batch_op *ops, size_t *idx, size_t *tmp, size_t n) const {
+       for (size_t width = 1; width < n; width *= 2) {
+           for (size_t lo = 0; lo < n; lo += 2 * width) {
+               size_t mid = lo + width < n ? lo + width : n;
+               size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+               size_t i = lo, j = mid, k = lo;
+               while (i < mid && j < hi) {
+                   if (keyLess(ops[idx[j]].key, ops[idx[i]].key)) {
+                       tmp[k++] = idx[j++];
+                   } else {
+                       tmp[k++] = idx[i++];
                    }
-                   z->parent->color = BLACK;
-                   z->parent->parent->color = RED;
-                   rotateLeft(z->parent->parent);
                }
+               while (i < mid) tmp[k++] = idx[i++];
+               while (j < hi) tmp[k++] = idx[j++];
            }
+           size_t *t = idx;
+           idx = tmp;
+           tmp = t;
        }
-       root->color = BLACK;
+       return idx;
    }
 
-   // Transplant for deletion
-   void transplant(Node *u, Node *v) {
-       if (!u->parent) {
-           root = v;
-       } else if (u == u->parent->left) {
-           u->parent->left = v;
-       } else {
-           u->parent->right = v;
+   // Fill in pos for the group order[s, e), whose key ends up in cur
+   void finishGroup(const batch_op *ops, const size_t *order, size_t s, size_t e,
+                    Ref cur, batch_result *results) {
+       bool alive = true;
+       for (size_t i = e; i-- > s;) {
+           const batch_op &op = ops[order[i]];
+           batch_result &r = results[order[i]];
+           if (op.kind == batch_op::ERASE) alive = false;
+           bool sees = op.kind != batch_op::ERASE && (op.kind != batch_op::FIND || r.done);
+           r.pos = iterator(this, alive && sees ? cur : endRef());
        }
-       if (v) v->parent = u->parent;
    }
 
-   // Fix tree after deletion
-   void deleteFixup(Node *x, Node *xParent) {
-       while (x != root && (!x || x->color == BLACK)) {
-           if (!xParent) break;
-           if (x == xParent->left) {
-               Node *w = xParent->right;
-               if (!w) break;
-               if (w->color == RED) {
-                   w->color = BLACK;
-                   xParent->color = RED;
-                   rotateLeft(xParent);
-                   w = xParent->right;
-                   if (!w) break;
-               }
-               if ((!w->left || w->left->color == BLACK) &&
-                   (!w->right || w->right->color == BLACK)) {
-                   w->color = RED;
-                   x = xParent;
-                   xParent = x->parent;
-               } else {
-                   if (!w->right || w->right->color == BLACK) {
-                       if (w->left) w->left->color = BLACK;
-                       w->color = RED;
-                       rotateRight(w);
-                       w = xParent->right;
-                       if (!w) break;
+   // Sparse batch: finger search from one key to the next, ordinary
+   // insert and erase in place
+   void batchWalk(const batch_op *ops, const size_t *order, size_t n, batch_result *results) {
+       Ref hint = endRef();
+       for (size_t s = 0, e; s < n; s = e) {
+           const Key &k = ops[order[s]].key;
+           for (e = s + 1; e < n && !keyLess(k, ops[order[e]].key); ++e) {}
+           Ref pos = lowerBoundFrom(hint, k);
+           Ref cur = Ref();
+           if (pos != endRef() && !keyLess(k, key(pos))) {
+               cur = pos;
+               pos = successor(pos);
+           }
+           for (size_t i = s; i < e; ++i) {
+               const batch_op &op = ops[order[i]];
+               bool &done = results[order[i]].done;
+               done = false;
+               if (op.kind == batch_op::FIND) {
+                   done = cur;
+               } else if (op.kind == batch_op::ERASE) {
+                   if (cur) {
+                       eraseNode(cur);
+                       cur = Ref();
+                       done = true;
                    }
-                   w->color = xParent->color;
-                   xParent->color = BLACK;
-                   if (w->right) w->right->color = BLACK;
-                   rotateLeft(xParent);
-                   x = root;
-               }
-           } else {
-               Node *w = xParent->left;
-               if (!w) break;
-               if (w->color == RED) {
-                   w->color = BLACK;
-                   xParent->color = RED;
-                   rotateRight(xParent);
-                   w = xParent->left;
-                   if (!w) break;
-               }
-               if ((!w->right || w->right->color == BLACK) &&
-                   (!w->left || w->left->color == BLACK)) {
-                   w->color = RED;
-                   x = xParent;
-                   xParent = x->parent;
+               } else if (cur) {
+                   if (op.kind == batch_op::ASSIGN) value(cur).second = *op.mapped;
                } else {
-                   if (!w->left || w->left->color == BLACK) {
-                       if (w->right) w->right->color = BLACK;
-                       w->color = RED;
-                       rotateLeft(w);
-                       w = xParent->left;
-                       if (!w) break;
-                   }
-                   w->color = xParent->color;
-                   xParent->color = BLACK;
-                   if (w->left) w->left->color = BLACK;
-                   rotateRight(xParent);
-                   x = root;
+                   cur = insertBefore(value_type(k, *op.mapped), pos);
+                   done = true;
                }
            }
+           finishGroup(ops, order, s, e, cur, results);
+           hint = cur ? cur : pos;
        }
-       if (x) x->color = BLACK;
    }
 
-   // Find node by key
-   Node* findNode(const Key &key) const {
-       Node *current = root;
-       while (current) {
-           if (keyEqual(key, current->data->first)) {
-               return current;
-           } else if (keyLess(key, current->data->first)) {
-               current = current->left;
-           } else {
-               current = current->right;
+   // Dense batch: merge the ops into the in-order node sequence, then
+   // rebuild the tree over it in O(size() + n); erased nodes are only
+   // destroyed once the old tree is no longer walked
+   void batchRebuild(const batch_op *ops, const size_t *order, size_t n, size_t groups,
+                     batch_result *results) {
+       Buffer<Ref> nodes(nodeCount + groups);
+       Buffer<Ref> dropped(groups);
+       size_t m = 0, d = 0;
+       Ref x = root ? minimum(root) : endRef();
+       Ref cur = Ref();
+       SJTU_TRY {
+           for (size_t s = 0, e; s < n; s = e) {
+               const Key &k = ops[order[s]].key;
+               for (e = s + 1; e < n && !keyLess(k, ops[order[e]].key); ++e) {}
+               while (x != endRef() && keyLess(key(x), k)) {
+                   nodes[m++] = x;
+                   x = successor(x);
+               }
+               bool inTree = false;
+               if (x != endRef() && !keyLess(k, key(x))) {
+                   cur = x;
+                   inTree = true;
+                   x = successor(x);
+               }
+               for (size_t i = s; i < e; ++i) {
+                   const batch_op &op = ops[order[i]];
+                   bool &done = results[order[i]].done;
+                   done = false;
+                   if (op.kind == batch_op::FIND) {
+                       done = cur;
+                   } else if (op.kind == batch_op::ERASE) {
+                       if (cur) {
+                           if (inTree) {
+                               dropped[d++] = cur;
+                           } else {
+                               destroyNode(cur);
+                           }
+                           cur = Ref();
+                           inTree = false;
+                           done = true;
+                       }
+                   } else if (cur) {
+                       if (op.kind == batch_op::ASSIGN) value(cur).second = *op.mapped;
+                   } else {
+                       cur = createNode(value_type(k, *op.mapped), Ref());
+                       done = true;
+                   }
+               }
+               if (cur) nodes[m++] = cur;
+               finishGroup(ops, order, s, e, cur, results);
+               cur = Ref();
+           }
+       } SJTU_CATCH_ALL {
+           // Keep every surviving node and leave a valid tree behind
+           if (cur) nodes[m++] = cur;
+           for (; x != endRef(); x = successor(x)) {
+               nodes[m++] = x;
            }
+           buildBalanced(nodes.data, m);
+           while (d > 0) destroyNode(dropped[--d]);
+           SJTU_RETHROW;
        }
-       return nullptr;
+       for (; x != endRef(); x = successor(x)) {
+           nodes[m++] = x;
+       }
+       buildBalanced(nodes.data, m);
+       while (d > 0) destroyNode(dropped[--d]);
    }
 
-   // Copy tree recursively
-   Node* copyTree(Node *other, Node *parent) {
-       if (!other) return nullptr;
-       Node *newNode = new Node(*(other->data), parent);
-       newNode->color = other->color;
-       newNode->left = copyTree(other->left, newNode);
-       newNode->right = copyTree(other->right, newNode);
-       return newNode;
-   }
+   // Join-based set operations.  They work on detached subtrees whose
+   // root's parent link is left stale; h is a subtree's rank: its black
+   // height, the number of black nodes on every path down from its root,
+   // the root included, or under AVL balancing its height.
 
-   // Delete tree recursively
-   void deleteTree(Node *node) {
-       if (!node) return;
-       deleteTree(node->left);
-       deleteTree(node->right);
-       delete node;
+   enum SetOp { SET_UNION, SET_INTERSECT, SET_DIFFERENCE };
+
+   void link(Ref x, Ref l, Ref r) {
+       left(x) = l;
+       right(x) = r;
+       if (l) setParent(l, x);
+       if (r) setParent(r, x);
    }
 
-  public:
-   class const_iterator;
-   class iterator {
-      private:
-       const map *mapPtr;
-       Node *nodePtr;
+   int rank(Ref x, Tag<false>) const {
+       int h = 0;
+       for (; x; x = left(x)) {
+           if (color(x) == BLACK) ++h;
+       }
+       return h;
+   }
 
-       friend class map;
-       friend class const_iterator;
+   int rank(Ref x, Tag<true>) const {
+       int h = 0;
+       for (; x; x = left(x)) h += oddRank(x) != oddRank(left(x)) ? 1 : 2;
+       return h;
+   }
 
-      public:
-       iterator(const map *m = nullptr, Node *n = nullptr) : mapPtr(m), nodePtr(n) {}
+   // Rank of c, a child of x of rank h
+   int childRank(Ref x, int h, Ref, Tag<false>) const {
+       return h - (color(x) == BLACK);
+   }
 
-       iterator(const iterator &other) : mapPtr(other.mapPtr), nodePtr(other.nodePtr) {}
+   int childRank(Ref x, int h, Ref c, Tag<true>) const {
+       return h - (oddRank(x) != oddRank(c) ? 1 : 2);
+   }
 
-       iterator operator++(int) {
-           if (!nodePtr || nodePtr == mapPtr->endNode) {
-               throw invalid_iterator();
-           }
-           iterator temp = *this;
-           nodePtr = mapPtr->successor(nodePtr);
-           return temp;
-       }
+   Ref joinRotateLeft(Ref x) {
+       Ref y = right(x);
+       link(x, left(x), left(y));
+       link(y, x, right(y));
+       return y;
+   }
 
-       iterator &operator++() {
-           if (!nodePtr || nodePtr == mapPtr->endNode) {
-               throw invalid_iterator();
-           }
-           nodePtr = mapPtr->successor(nodePtr);
-           return *this;
-       }
+   Ref joinRotateRight(Ref y) {
+       Ref x = left(y);
+       link(y, right(x), right(y));
+       link(x, left(x), y);
+       return x;
+   }
 
-       iterator operator--(int) {
-           if (nodePtr == mapPtr->endNode) {
-               nodePtr = mapPtr->maximum(mapPtr->root);
-               if (!nodePtr) throw invalid_iterator();
-               return iterator(mapPtr, mapPtr->endNode);
-           }
-           Node *pred = mapPtr->predecessor(nodePtr);
-           if (!pred) throw invalid_iterator();
-           iterator temp = *this;
-           nodePtr = pred;
-           return temp;
+   // Hang k and r (black root, height hr) below the right spine of x
+   // (height h >= hr); the result may have a red root
+   Ref joinRight(Ref x, int h, Ref k, Ref r, int hr) {
+       if (h == hr && isBlack(x)) {
+           link(k, x, r);
+           setColor(k, RED);
+           return k;
        }
-
-       iterator &operator--() {
-           if (nodePtr == mapPtr->endNode) {
-               nodePtr = mapPtr->maximum(mapPtr->root);
-               if (!nodePtr) throw invalid_iterator();
-               return *this;
-           }
-           Node *pred = mapPtr->predecessor(nodePtr);
-           if (!pred) throw invalid_iterator();
-           nodePtr = pred;
-           return *this;
+       Ref c = joinRight(right(x), h - (color(x) == BLACK), k, r, hr);
+       link(x, left(x), c);
+       if (color(x) == BLACK && color(c) == RED && right(c) && color(right(c)) == RED) {
+           setColor(right(c), BLACK);
+           return joinRotateLeft(x);
        }
+       return x;
+   }
 
-       value_type &operator*() const {
-           if (!nodePtr || nodePtr == mapPtr->endNode) {
-               throw invalid_iterator();
-           }
-           return *(nodePtr->data);
+   Ref joinLeft(Ref x, int h, Ref l, int hl, Ref k) {
+       if (h == hl && isBlack(x)) {
+           link(k, l, x);
+           setColor(k, RED);
+           return k;
        }
-
-       bool operator==(const iterator &rhs) const {
-           return mapPtr == rhs.mapPtr && nodePtr == rhs.nodePtr;
+       Ref c = joinLeft(left(x), h - (color(x) == BLACK), l, hl, k);
+       link(x, c, right(x));
+       if (color(x) == BLACK && color(c) == RED && left(c) && color(left(c)) == RED) {
+           setColor(left(c), BLACK);
+           return joinRotateRight(x);
        }
+       return x;
+   }
 
-       bool operator==(const const_iterator &rhs) const {
-           return mapPtr == rhs.mapPtr && nodePtr == rhs.nodePtr;
+   // x's right child k (height hk) is two above its left child; rotate
+   // k, or k's left child if that is k's taller one, into x's place
+   Ref avlRotateLeft(Ref x, Ref k, int hk, int &h) {
+       Ref a = left(k);
+       int ha = childRank(k, hk, a, Tag<true>()), hb = childRank(k, hk, right(k), Tag<true>());
+       if (ha > hb) {
+           link(x, left(x), joinRotateRight(k));
+           setRank(k, hk - 1);
+           setRank(x, hk - 1);
+           setRank(a, hk);
+           h = hk;
+           return joinRotateLeft(x);
        }
+       int hx = (ha > hk - 2 ? ha : hk - 2) + 1;
+       setRank(x, hx);
+       h = (hx > hb ? hx : hb) + 1;
+       setRank(k, h);
+       return joinRotateLeft(x);
+   }
 
-       bool operator!=(const iterator &rhs) const {
-           return !(*this == rhs);
+   Ref avlRotateRight(Ref x, Ref k, int hk, int &h) {
+       Ref a = right(k);
+       int ha = childRank(k, hk, a, Tag<true>()), hb = childRank(k, hk, left(k), Tag<true>());
+       if (ha > hb) {
+           link(x, joinRotateLeft(k), right(x));
+           setRank(k, hk - 1);
+           setRank(x, hk - 1);
+           setRank(a, hk);
+           h = hk;
+           return joinRotateRight(x);
        }
+       int hx = (ha > hk - 2 ? ha : hk - 2) + 1;
+       setRank(x, hx);
+       h = (hx > hb ? hx : hb) + 1;
+       setRank(k, h);
+       return joinRotateRight(x);
+   }
 
-       bool operator!=(const const_iterator &rhs) const {
-           return !(*this == rhs);
+   // AVL join: hang k and r (height hr) below the right spine of x
+   // (height h > hr + 1); h receives the height of the result
+   Ref avlJoinRight(Ref x, int &h, Ref k, Ref r, int hr) {
+       Ref l = left(x), c = right(x);
+       int hl = childRank(x, h, l, Tag<true>()), hc = childRank(x, h, c, Tag<true>());
+       if (hc > hr + 1) {
+           k = avlJoinRight(c, hc, k, r, hr);
+       } else {
+           link(k, c, r);
+           hc = (hc > hr ? hc : hr) + 1;
+           setRank(k, hc);
        }
+       link(x, l, k);
+       if (hc == hl + 2) return avlRotateLeft(x, k, hc, h);
+       h = (hc > hl ? hc : hl) + 1;
+       setRank(x, h);
+       return x;
+   }
 
-       value_type *operator->() const noexcept {
-           return nodePtr->data;
+   Ref avlJoinLeft(Ref x, int &h, Ref l, int hl, Ref k) {
+       Ref c = left(x), r = right(x);
+       int hr = childRank(x, h, r, Tag<true>()), hc = childRank(x, h, c, Tag<true>());
+       if (hc > hl + 1) {
+           k = avlJoinLeft(c, hc, l, hl, k);
+       } else {
+           link(k, l, c);
+           hc = (hc > hl ? hc : hl) + 1;
+           setRank(k, hc);
        }
-   };
-
-   class const_iterator {
-      private:
-       const map *mapPtr;
-       Node *nodePtr;
-
-       friend class map;
-       friend class iterator;
-
-      public:
-       const_iterator(const map *m = nullptr, Node *n = nullptr) : mapPtr(m), nodePtr(n) {}
-
-       const_iterator(const const_iterator &other) : mapPtr(other.mapPtr), nodePtr(other.nodePtr) {}
+       link(x, k, r);
+       if (hc == hr + 2) return avlRotateRight(x, k, hc, h);
+       h = (hc > hr ? hc : hr) + 1;
+       setRank(x, h);
+       return x;
+   }
 
-       const_iterator(const iterator &other) : mapPtr(other.mapPtr), nodePtr(other.nodePtr) {}
+   // One tree of l, k and r (all keys of l < k < all keys of r) in
+   // O(|hl - hr| + 1); under red-black balancing the root comes out black
+   Ref join(Ref l, int hl, Ref k, Ref r, int hr, int &h) {
+       return join(l, hl, k, r, hr, h, BalanceMode());
+   }
 
-       const_iterator operator++(int) {
-           if (!nodePtr || nodePtr == mapPtr->endNode) {
-               throw invalid_iterator();
-           }
-           const_iterator temp = *this;
-           nodePtr = mapPtr->successor(nodePtr);
-           return temp;
+   Ref join(Ref l, int hl, Ref k, Ref r, int hr, int &h, Tag<true>) {
+       if (hl > hr + 1) {
+           h = hl;
+           return avlJoinRight(l, h, k, r, hr);
        }
-
-       const_iterator &operator++() {
-           if (!nodePtr || nodePtr == mapPtr->endNode) {
-               throw invalid_iterator();
-           }
-           nodePtr = mapPtr->successor(nodePtr);
-           return *this;
+       if (hr > hl + 1) {
+           h = hr;
+           return avlJoinLeft(r, h, l, hl, k);
        }
+       link(k, l, r);
+       h = (hl > hr ? hl : hr) + 1;
+       setRank(k, h);
+       return k;
+   }
 
-       const_iterator operator--(int) {
-           if (nodePtr == mapPtr->endNode) {
-               nodePtr = mapPtr->maximum(mapPtr->root);
-               if (!nodePtr) throw invalid_iterator();
-               return const_iterator(mapPtr, mapPtr->endNode);
-           }
-           Node *pred = mapPtr->predecessor(nodePtr);
-           if (!pred) throw invalid_iterator();
-           const_iterator temp = *this;
-           nodePtr = pred;
-           return temp;
+   Ref join(Ref l, int hl, Ref k, Ref r, int hr, int &h, Tag<false>) {
+       if (l && color(l) == RED) {
+           setColor(l, BLACK);
+           ++hl;
        }
-
-       const_iterator &operator--() {
-           if (nodePtr == mapPtr->endNode) {
-               nodePtr = mapPtr->maximum(mapPtr->root);
-               if (!nodePtr) throw invalid_iterator();
-               return *this;
-           }
-           Node *pred = mapPtr->predecessor(nodePtr);
-           if (!pred) throw invalid_iterator();
-           nodePtr = pred;
-           return *this;
+       if (r && color(r) == RED) {
+           setColor(r, BLACK);
+           ++hr;
        }
-
-       const value_type &operator*() const {
-           if (!nodePtr || nodePtr == mapPtr->endNode) {
-               throw invalid_iterator();
-           }
-           return *(nodePtr->data);
+       Ref t;
+       if (hl > hr) {
+           t = joinRight(l, hl, k, r, hr);
+           h = hl;
+       } else if (hr > hl) {
+           t = joinLeft(r, hr, l, hl, k);
+           h = hr;
+       } else {
+           link(k, l, r);
+           setColor(k, BLACK);
+           h = hl + 1;
+           return k;
        }
-
-       bool operator==(const iterator &rhs) const {
-           return mapPtr == rhs.mapPtr && nodePtr == rhs.nodePtr;
+       if (color(t) == RED) {
+           setColor(t, BLACK);
+           ++h;
        }
+       return t;
+   }
 
-       bool operator==(const const_iterator &rhs) const {
-           return mapPtr == rhs.mapPtr && nodePtr == rhs.nodePtr;
+   // join() without a middle node: the minimum of r takes its place
+   Ref join2(Ref l, int hl, Ref r, int hr, int &h) {
+       if (!l) {
+           h = hr;
+           return r;
        }
-
-       bool operator!=(const iterator &rhs) const {
-           return !(*this == rhs);
+       if (!r) {
+           h = hl;
+           return l;
        }
+       Ref lo, hi;
+       int hlo, hhi;
+       Ref m = split(r, hr, key(minimum(r)), lo, hlo, hi, hhi);
+       return join(l, hl, m, hi, hhi, h);
+   }
 
-       bool operator!=(const const_iterator &rhs) const {
-           return !(*this == rhs);
+   // Split t (height h) into l with the keys below k and r with those
+   // above; returns the node holding k, detached, or null
+   Ref split(Ref t, int h, const Key &k, Ref &l, int &hl, Ref &r, int &hr) {
+       if (!t) {
+           l = r = Ref();
+           hl = hr = 0;
+           return Ref();
        }
-
-       const value_type *operator->() const noexcept {
-           return nodePtr->data;
+       Ref lt = left(t), rt = right(t);
+       int hlt = childRank(t, h, lt, BalanceMode()), hrt = childRank(t, h, rt, BalanceMode());
+       if (keyLess(k, key(t))) {
+           Ref found = split(lt, hlt, k, l, hl, r, hr);
+           r = join(r, hr, t, rt, hrt, hr);
+           return found;
        }
-   };
-
-   map() : root(nullptr), endNode(new Node(nullptr, true)), nodeCount(0) {}
+       if (keyLess(key(t), k)) {
+           Ref found = split(rt, hrt, k, l, hl, r, hr);
+           l = join(lt, hlt, t, l, hl, hl);
+           return found;
+       }
+       l = lt;
+       r = rt;
+       hl = hlt;
+       hr = hrt;
+       return t;
+   }
 
-   map(const map &other) : root(nullptr), endNode(new Node(nullptr, true)), nodeCount(other.nodeCount), comp(other.comp) {
-       root = copyTree(other.root, nullptr);
+   // Nodes (or whole subtrees) to destroy once the operation is done,
+   // chained through their parent links
+   void discard(Ref x, Ref &dead) {
+       setParent(x, dead);
+       dead = x;
    }
 
-   map &operator=(const map &other) {
-       if (this == &other) return *this;
-       clear();
-       root = copyTree(other.root, nullptr);
-       nodeCount = other.nodeCount;
-       comp = other.comp;
-       return *this;
+   void discardNode(Ref x, Ref &dead) {
+       left(x) = right(x) = Ref();
+       discard(x, dead);
    }
 
-   ~map() {
-       clear();
-       delete endNode;
+   // Like destroyTree(), but freeing the nodes; returns their number
+   size_t destroySubtree(Ref x) {
+       size_t n = 0;
+       while (x) {
+           Ref l = left(x);
+           if (l) {
+               left(x) = right(l);
+               right(l) = x;
+               x = l;
+           } else {
+               Ref r = right(x);
+               destroyNode(x);
+               ++n;
+               x = r;
+           }
+       }
+       return n;
    }
 
-   T &at(const Key &key) {
-       Node *node = findNode(key);
-       if (!node) throw index_out_of_bound();
-       return node->data->second;
+   // Put a split's halves l and r back together around a (the node of
+   // this map holding b's key, or null) and b (other's node)
+   template<int Op, class Combine>
+   Ref setJoin(Ref l, int hl, Ref a, Ref b, Ref r, int hr, Combine &combine, Ref &dead, int &h) {
+       if (Op == SET_UNION) {
+           // b is a copy in this map's pool; a keeps its node
+           if (a) {
+               value(a).second = combine(value(a).second, value(b).second);
+               discardNode(b, dead);
+               return join(l, hl, a, r, hr, h);
+           }
+           return join(l, hl, b, r, hr, h);
+       }
+       if (Op == SET_INTERSECT && a) return join(l, hl, a, r, hr, h);
+       if (a) discardNode(a, dead);
+       return join2(l, hl, r, hr, h);
    }
 
-   const T &at(const Key &key) const {
-       Node *node = findNode(key);
-       if (!node) throw index_out_of_bound();
-       return node->data->second;
+   // Op on the subtree a (height ha) of this map and the subtree b
+   // (height hb) of src: split a by b's key, recurse on both sides, join
+   template<int Op, class Combine>
+   Ref setOp(Ref a, int ha, const map &src, Ref b, int hb, Combine &combine, Ref &dead, int &h) {
+       if (!a || !b) {
+           if (Op == SET_UNION && !a) {
+               h = hb;
+               return b;
+           }
+           if (Op == SET_INTERSECT && a) {
+               discard(a, dead);
+               a = Ref();
+           }
+           h = a ? ha : 0;
+           return a;
+       }
+       Ref bl = src.left(b), br = src.right(b);
+       int hbl = src.childRank(b, hb, bl, BalanceMode()), hbr = src.childRank(b, hb, br, BalanceMode());
+       Ref l, r;
+       int hl, hr;
+       Ref m = split(a, ha, src.key(b), l, hl, r, hr);
+       l = setOp<Op>(l, hl, src, bl, hbl, combine, dead, hl);
+       r = setOp<Op>(r, hr, src, br, hbr, combine, dead, hr);
+       return setJoin<Op>(l, hl, m, b, r, hr, combine, dead, h);
    }
 
-   T &operator[](const Key &key) {
-       Node *node = findNode(key);
-       if (node) return node->data->second;
+   // Node of the recursion's top levels, which are expanded up front so
+   // that the subproblems below run as independent tasks
+   struct SetFrame {
+       Ref a, b, m, tree, dead;
+       int ha, hb, h;
+       size_t child[2];
+   };
 
-       // Insert new element with default value
-       pair<iterator, bool> result = insert(value_type(key, T()));
-       return result.first.nodePtr->data->second;
+   size_t planSetOp(SetFrame *f, size_t &n, Ref a, int ha, const map &src, Ref b, int hb,
+                    int depth) {
+       size_t i = n++;
+       f[i].a = a;
+       f[i].ha = ha;
+       f[i].b = b;
+       f[i].hb = hb;
+       f[i].m = f[i].tree = f[i].dead = Ref();
+       f[i].child[0] = f[i].child[1] = n;
+       if (depth == 0 || !a || !b) return i;
+       Ref bl = src.left(b), br = src.right(b);
+       int hbl = src.childRank(b, hb, bl, BalanceMode()), hbr = src.childRank(b, hb, br, BalanceMode());
+       Ref l, r;
+       int hl, hr;
+       f[i].m = split(a, ha, src.key(b), l, hl, r, hr);
+       f[i].child[0] = planSetOp(f, n, l, hl, src, bl, hbl, depth - 1);
+       f[i].child[1] = planSetOp(f, n, r, hr, src, br, hbr, depth - 1);
+       return i;
    }
 
-   const T &operator[](const Key &key) const {
-       Node *node = findNode(key);
-       if (!node) throw index_out_of_bound();
-       return node->data->second;
+   static bool isTask(const SetFrame &f) {
+       return f.child[0] == f.child[1];
    }
 
-   iterator begin() {
-       Node *min = minimum(root);
-       return iterator(this, min ? min : endNode);
-   }
+   template<int Op, class Combine>
+   struct SetTask {
+       map *owner;
+       const map *src;
+       SetFrame *frames;
+       const size_t *tasks;
+       Combine *combine;
 
-   const_iterator cbegin() const {
-       Node *min = minimum(root);
-       return const_iterator(this, min ? min : endNode);
-   }
+       void operator()(size_t i) const {
+           SetFrame &f = frames[tasks[i]];
+           f.tree = owner->template setOp<Op>(f.a, f.ha, *src, f.b, f.hb, *combine, f.dead, f.h);
+       }
+   };
 
-   iterator end() {
-       return iterator(this, endNode);
+   template<int Op, class Combine>
+   void finishSetOp(SetFrame *f, size_t i, Combine &combine) {
+       if (isTask(f[i])) return;
+       SetFrame &l = f[f[i].child[0]], &r = f[f[i].child[1]];
+       finishSetOp<Op>(f, f[i].child[0], combine);
+       finishSetOp<Op>(f, f[i].child[1], combine);
+       f[i].tree = setJoin<Op>(l.tree, l.h, f[i].m, f[i].b, r.tree, r.h, combine, f[i].dead, f[i].h);
    }
 
-   const_iterator cend() const {
-       return const_iterator(this, endNode);
+   // Runs tasks on the calling thread
+   struct SerialPool {
+       template<class Task>
+       void run(size_t n, Task task) {
+           for (size_t i = 0; i < n; ++i) task(i);
+       }
+   };
+
+   // Levels of the set operation's recursion to expand into tasks.  Like
+   // the parallel walks, this depends on the sizes only, not on the
+   // pool: small operations stay whole, and larger ones split until a
+   // task handles about PARALLEL_MIN / 64 elements of the smaller map,
+   // into at most 2^PARALLEL_CUT tasks.
+   int setOpDepth(SerialPool &, size_t) const { return 0; }
+
+   template<class Pool>
+   int setOpDepth(Pool &, size_t count) const {
+       size_t smaller = count < nodeCount ? count : nodeCount;
+       int depth = 0;
+       if (smaller < PARALLEL_MIN) return 0;
+       while (depth < PARALLEL_CUT && (smaller >> (depth + 1)) >= PARALLEL_MIN / 64) ++depth;
+       return depth;
    }
 
-   bool empty() const {
-       return nodeCount == 0;
+   // Replace the tree by op(tree, b), b being a subtree of src with
+   // count nodes
+   template<int Op, class Pool, class Combine>
+   void applySetOp(Pool &pool, const map &src, Ref b, size_t count, Combine &combine) {
+       int depth = setOpDepth(pool, count);
+       Buffer<SetFrame> frames(size_t(2) << depth);
+       Buffer<size_t> tasks(size_t(1) << depth);
+       size_t n = 0, t = 0;
+       planSetOp(frames.data, n, root, rank(root, BalanceMode()), src, b, src.rank(b, BalanceMode()), depth);
+       for (size_t i = 0; i < n; ++i) {
+           if (isTask(frames[i])) tasks[t++] = i;
+       }
+       SetTask<Op, Combine> task = {this, &src, frames.data, tasks.data, &combine};
+       pool.run(t, task);
+       finishSetOp<Op>(frames.data, 0, combine);
+       installRoot(frames[0].tree);
+       size_t destroyed = 0;
+       for (size_t i = 0; i < n; ++i) {
+           for (Ref x = frames[i].dead; x;) {
+               Ref next = parent(x);
+               destroyed += destroySubtree(x);
+               x = next;
+           }
+       }
+       nodeCount -= destroyed;
+       rethread(ThreadMode());
+       refreshFilter(FilterMode());
    }
 
-   size_t size() const {
-       return nodeCount;
+   void rethread(Tag<false>) {}
+
+   void rethread(Tag<true>) {
+       Ref last = Ref();
+       for (Ref x = minimum(root); x && x != endRef(); x = successor(x, Tag<false>())) {
+           threadAfter(last, x, Tag<true>());
+           last = x;
+       }
    }
 
-   void clear() {
-       deleteTree(root);
-       root = nullptr;
-       nodeCount = 0;
+   // Combine for the operations that never merge two values
+   struct NoCombine {
+       const T &operator()(const T &mine, const T &) const { return mine; }
+   };
+
+   template<class Pool, class Combine>
+   void unionWith(Pool &pool, const map &other, Combine &combine) {
+       if (!other.root) return;
+       // Copy other into this map's pool; the copy's nodes are then
+       // either linked in or, for keys already present, discarded
+       Ref copy = copyTree(other, Ref());
+       size_t count = other.nodeCount;
+       nodeCount += count;
+       applySetOp<SET_UNION>(pool, *this, copy, count, combine);
    }
 
-   pair<iterator, bool> insert(const value_type &value) {
-       // Find position to insert
-       Node *parent = nullptr;
-       Node *current = root;
+   template<int Op, class Pool, class Combine>
+   void setOperation(Pool &pool, const map &other, Combine &combine, Tag<false>) {
+       if (Op == SET_UNION) unionWith(pool, other, combine);
+       else applySetOp<Op>(pool, other, other.root, other.nodeCount, combine);
+   }
 
-       while (current) {
-           parent = current;
-           if (keyEqual(value.first, current->data->first)) {
-               // Key already exists
-               return pair<iterator, bool>(iterator(this, current), false);
-           } else if (keyLess(value.first, current->data->first)) {
-               current = current->left;
-           } else {
-               current = current->right;
+   // A splay tree can be too deep for the split/join recursion: merge the
+   // two maps' elements in key order instead and rebuild the tree over
+   // the result, like batchRebuild()
+   template<int Op, class Pool, class Combine>
+   void setOperation(Pool &, const map &other, Combine &combine, Tag<true>) {
+       Buffer<Ref> nodes(nodeCount + (Op == SET_UNION ? other.nodeCount : 0));
+       Buffer<Ref> dropped(Op == SET_UNION ? 0 : nodeCount);
+       size_t m = 0, d = 0;
+       Ref x = root ? minimum(root) : endRef();
+       Ref b = other.root ? other.minimum(other.root) : other.endRef();
+       SJTU_TRY {
+           for (; b != other.endRef(); b = other.successor(b)) {
+               const Key &k = other.key(b);
+               for (; x != endRef() && keyLess(key(x), k); x = successor(x)) {
+                   if (Op == SET_INTERSECT) dropped[d++] = x;
+                   else nodes[m++] = x;
+               }
+               if (x != endRef() && !keyLess(k, key(x))) {
+                   if (Op == SET_UNION) {
+                       value(x).second = combine(value(x).second, other.value(b).second);
+                   }
+                   if (Op == SET_DIFFERENCE) dropped[d++] = x;
+                   else nodes[m++] = x;
+                   x = successor(x);
+               } else if (Op == SET_UNION) {
+                   // m must not move past a copy that throws
+                   Ref y = createNode(other.value(b), Ref());
+                   nodes[m++] = y;
+               }
            }
+       } SJTU_CATCH_ALL {
+           // Only copying one of other's elements throws: keep the rest
+           for (; x != endRef(); x = successor(x)) nodes[m++] = x;
+           buildBalanced(nodes.data, m);
+           SJTU_RETHROW;
        }
-
-       // Create new node
-       Node *newNode = new Node(value, parent);
-       nodeCount++;
-
-       if (!parent) {
-           root = newNode;
-       } else if (keyLess(value.first, parent->data->first)) {
-           parent->left = newNode;
-       } else {
-           parent->right = newNode;
+       for (; x != endRef(); x = successor(x)) {
+           if (Op == SET_INTERSECT) dropped[d++] = x;
+           else nodes[m++] = x;
        }
+       buildBalanced(nodes.data, m);
+       while (d > 0) destroyNode(dropped[--d]);
+   }
 
-       insertFixup(newNode);
-       return pair<iterator, bool>(iterator(this, newNode), true);
+   // Cut the tree at k and drop the part below k (front) or above it
+   size_t trim(const Key &k, bool front) {
+       if (!root) return 0;
+       size_t erased = destroySubtree(cutAt(k, front, SplayMode()));
+       nodeCount -= erased;
+       threadEnds(ThreadMode());
+       filterErase(FilterMode(), erased);
+       return erased;
    }
 
-   void erase(iterator pos) {
-       if (!pos.nodePtr || pos.nodePtr == endNode || pos.mapPtr != this) {
-           throw invalid_iterator();
-       }
-
-       Node *z = pos.nodePtr;
-       Node *y = z;
-       Node *x;
-       Node *xParent;
-       Color yOriginalColor = y->color;
-
-       if (!z->left) {
-           x = z->right;
-           xParent = z->parent;
-           transplant(z, z->right);
-       } else if (!z->right) {
-           x = z->left;
-           xParent = z->parent;
-           transplant(z, z->left);
-       } else {
-           y = minimum(z->right);
-           yOriginalColor = y->color;
-           x = y->right;
+   // Detach the part of the tree below k (front) or above it
+   Ref cutAt(const Key &k, bool front, Tag<false>) {
+       Ref l, r;
+       int hl, hr, h;
+       Ref m = split(root, rank(root, BalanceMode()), k, l, hl, r, hr);
+       Ref kept = front ? r : l;
+       if (m) {
+           kept = front ? join(Ref(), 0, m, r, hr, h) : join(l, hl, m, Ref(), 0, h);
+       }
+       installRoot(kept);
+       return front ? l : r;
+   }
 
-           if (y->parent == z) {
-               xParent = y;
-               if (x) x->parent = y;
+   // Splay tree: splay the outermost element to keep and cut off its
+   // subtree on the dropped side
+   Ref cutAt(const Key &k, bool front, Tag<true>) {
+       Ref kept = Ref();
+       for (Ref x = root; x;) {
+           if (front ? keyLess(key(x), k) : keyLess(k, key(x))) {
+               x = front ? right(x) : left(x);
            } else {
-               xParent = y->parent;
-               transplant(y, y->right);
-               y->right = z->right;
-               y->right->parent = y;
+               kept = x;
+               x = front ? left(x) : right(x);
            }
-           transplant(z, y);
-           y->left = z->left;
-           y->left->parent = y;
-           y->color = z->color;
        }
+       Ref dropped = root;
+       if (kept) {
+           splay(kept, Tag<true>());
+           Ref &side = front ? left(kept) : right(kept);
+           dropped = side;
+           side = Ref();
+       } else {
+           setRoot(Ref());
+       }
+       return dropped;
+   }
 
-       delete z;
-       nodeCount--;
+   void threadEnds(Tag<false>) {}
+
+   // Terminate the thread at both ends after a cut
+   void threadEnds(Tag<true>) {
+       if (!root) return;
+       prev(minimum(root)) = Ref();
+       next(maximum(root)) = endRef();
+   }
 
-       if (yOriginalColor == BLACK) {
-           deleteFixup(x, xParent);
+   void installRoot(Ref t) {
+       if (t) {
+           setParent(t, top());
+           if (!Traits::avl_balancing) setColor(t, BLACK);
        }
+       setRoot(t);
    }
 
-   size_t count(const Key &key) const {
-       return findNode(key) ? 1 : 0;
+   // Builds a tree from nodes fed in key order: a binary counter of
+   // perfect trees (all black, or valid AVL trees), each followed by one
+   // pending node
+   struct Assembler {
+       Ref tree[WALK_DEPTH], sep[WALK_DEPTH];
+       int h[WALK_DEPTH];
+       int count;
+   };
+
+   void assemble(Assembler &a, Ref x) {
+       Ref t = Ref();
+       int h = 0;
+       while (a.count > 0 && a.h[a.count - 1] == h) {
+           --a.count;
+           link(a.sep[a.count], a.tree[a.count], t);
+           if (Traits::avl_balancing) setRank(a.sep[a.count], h + 1);
+           else setColor(a.sep[a.count], BLACK);
+           t = a.sep[a.count];
+           ++h;
+       }
+       a.tree[a.count] = t;
+       a.h[a.count] = h;
+       a.sep[a.count] = x;
+       ++a.count;
    }
 
-   iterator find(const Key &key) {
-       Node *node = findNode(key);
-       return node ? iterator(this, node) : end();
+   // Join the assembled nodes into one tree after l (height hl)
+   Ref finishAssembly(Assembler &a, Ref l, int hl, int &h) {
+       Ref t = Ref();
+       h = 0;
+       while (a.count > 0) {
+           --a.count;
+           t = join(a.tree[a.count], a.h[a.count], a.sep[a.count], t, h, h);
+       }
+       return join2(l, hl, t, h, h);
    }
 
-   const_iterator find(const Key &key) const {
-       Node *node = findNode(key);
-       return node ? const_iterator(this, node) : cend();
+   // erase_if() from x on: split off the elements before x, then walk the
+   // rest in order, feeding the survivors to an Assembler; every node is
+   // relinked right after it is visited, while it is still in cache
+   template<class Pred>
+   size_t eraseRebuilding(Ref x, Pred &pred) {
+       Ref done, rest;
+       int hDone, hRest, h;
+       split(root, rank(root, BalanceMode()), key(x), done, hDone, rest, hRest);
+       Ref last = maximum(done);
+       Assembler out;
+       out.count = 0;
+       Ref stack[WALK_DEPTH];
+       int depth = 0;
+       size_t erased = 0;
+       // c is the next node to decide; cRight, the untouched tree after it
+       Ref c = x, cRight = rest;
+       SJTU_TRY {
+           for (;;) {
+               if (pred(const_cast<const value_type &>(value(c)))) {
+                   destroyNode(c);
+                   --nodeCount;
+                   ++erased;
+               } else {
+                   assemble(out, c);
+                   threadAfter(last, c, ThreadMode());
+                   last = c;
+               }
+               for (; cRight; cRight = left(cRight)) stack[depth++] = cRight;
+               if (depth == 0) break;
+               c = stack[--depth];
+               cRight = right(c);
+           }
+       } SJTU_CATCH_ALL {
+           // Hang c and the untouched trees after it back on
+           Ref t = finishAssembly(out, done, hDone, h);
+           t = join(t, h, c, cRight, rank(cRight, BalanceMode()), h);
+           while (depth > 0) {
+               Ref s = stack[--depth];
+               t = join(t, h, s, right(s), rank(right(s), BalanceMode()), h);
+           }
+           installRoot(t);
+           rethread(ThreadMode());
+           refreshFilter(FilterMode());
+           SJTU_RETHROW;
+       }
+       installRoot(finishAssembly(out, done, hDone, h));
+       threadEnd(last, ThreadMode());
+       refreshFilter(FilterMode());
+       return erased;
    }
 };
 
@@ -0,0 +1,142 @@
+/**
+ * Optional drop-in for exceptions.hpp: the same exception classes, but
+ * holding pointers to string literals, so that constructing, copying
+ * and throwing one never allocates; what() returns const char * and
+ * code() the matching errc.  It also lets the containers run without
+ * exceptions.  Include it before any other sjtu header, e.g.
+ *
+ *     #include "noalloc_exceptions.hpp"
+ *     #include "map.hpp"
+ *
+ * It then stands in for exceptions.hpp, which map.hpp includes.
+ * map.hpp needs neither this header nor anything beyond the stock
+ * exceptions.hpp.
+ */
+#ifndef SJTU_NOALLOC_EXCEPTIONS_HPP
+#define SJTU_NOALLOC_EXCEPTIONS_HPP
+
+#ifdef SJTU_EXCEPTIONS_HPP
+#error "include noalloc_exceptions.hpp before exceptions.hpp and map.hpp"
+#endif
+// Keep the stock exceptions.hpp from defining the classes again
+#define SJTU_EXCEPTIONS_HPP
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// Exceptions can be turned off (-fno-exceptions); the library then
+// reports errors through sjtu::last_error() and the error handler.
+#if !defined(SJTU_NO_EXCEPTIONS) && !defined(__cpp_exceptions) && !defined(__EXCEPTIONS)
+#define SJTU_NO_EXCEPTIONS
+#endif
+
+#ifndef SJTU_NO_EXCEPTIONS
+#define SJTU_THROW(e) throw e
+#define SJTU_TRY try
+#define SJTU_CATCH_ALL catch (...)
+#define SJTU_RETHROW throw
+#else
+#define SJTU_THROW(e) ::sjtu::raise(e)
+#define SJTU_TRY if (true)
+#define SJTU_CATCH_ALL else
+#define SJTU_RETHROW
+#endif
+
+// Same definition as in map.hpp, whichever comes first
+#ifndef SJTU_ERRC_DEFINED
+#define SJTU_ERRC_DEFINED
+namespace sjtu {
+// Error codes of the non-throwing API; one per exception class
+enum class errc {
+    none = 0,
+    index_out_of_bound,
+    runtime_error,
+    invalid_iterator,
+    container_is_empty
+};
+}
+#endif
+
+namespace sjtu {
+
+/**
+ * Base of the library's exceptions.  Holds pointers to string literals
+ * only, so constructing, throwing and copying one never allocates.
+ */
+class exception {
+   protected:
+    const char *variant;
+    const char *detail;
+    errc code_;
+   public:
+    exception(const char *variant = "", errc code = errc::none, const char *detail = "")
+        : variant(variant), detail(detail), code_(code) {}
+    exception(const exception &ec) : variant(ec.variant), detail(ec.detail), code_(ec.code_) {}
+    virtual ~exception() {}
+    virtual const char *what() const {
+        return *detail ? detail : variant;
+    }
+    errc code() const {
+        return code_;
+    }
+};
+
+class index_out_of_bound : public exception {
+   public:
+    index_out_of_bound() : exception("index_out_of_bound", errc::index_out_of_bound) {}
+};
+
+class runtime_error : public exception {
+   public:
+    runtime_error() : exception("runtime_error", errc::runtime_error) {}
+};
+
+class invalid_iterator : public exception {
+   public:
+    invalid_iterator() : exception("invalid_iterator", errc::invalid_iterator) {}
+};
+
+class container_is_empty : public exception {
+   public:
+    container_is_empty() : exception("container_is_empty", errc::container_is_empty) {}
+};
+
+/**
+ * Without exceptions, an operation that would throw stores its code in
+ * last_error() and calls the error handler, which must not return; the
+ * default one prints what() and aborts.
+ */
+typedef void (*error_handler)(const exception &);
+
+inline void abort_on_error(const exception &e) {
+    fprintf(stderr, "sjtu: %s\n", e.what());
+    abort();
+}
+
+inline error_handler &current_error_handler() {
+    static error_handler handler = abort_on_error;
+    return handler;
+}
+
+inline error_handler set_error_handler(error_handler handler) {
+    error_handler old = current_error_handler();
+    current_error_handler() = handler ? handler : abort_on_error;
+    return old;
+}
+
+inline errc &last_error() {
+    static errc code = errc::none;
+    return code;
+}
+
+[[noreturn]] inline void raise(const exception &e) {
+    last_error() = e.code();
+    current_error_handler()(e);
+    abort();
+}
+}
+
+#endif
@@ -0,0 +1,566 @@
+/**
+* sjtu::map with its first few elements kept inline in the map object
+*/
+#ifndef SJTU_SMALL_MAP_HPP
+#define SJTU_SMALL_MAP_HPP
+
+// only for std::less<T>
+#include <functional>
+#include <cstddef>
+// placement new for the inline slots
+#include <new>
+#include "utility.hpp"
+#include "exceptions.hpp"
+#include "map.hpp"
+
+namespace sjtu {
+
+/**
+ * Sorted map with the interface of sjtu::map for maps that mostly stay
+ * tiny.  Up to InlineMax elements live in a sorted array inside the
+ * map object itself, so an empty map allocates nothing and a small one
+ * allocates nothing either: no node per element and none of the node
+ * pool's tables.  Lookups in the array count the keys below the target
+ * without branching on the comparisons.
+ *
+ * The insert that would make InlineMax + 1 elements moves them all into
+ * a sjtu::map<Key, T, Compare, Traits> allocated then; from there on the
+ * map behaves as that tree.  Once erasing brings it down to InlineMax / 2
+ * elements, it moves them back inline and frees the tree; the gap
+ * between the two sizes keeps a map that hovers around InlineMax from
+ * converting on every insert and erase.  clear() goes back inline too.
+ * is_inline() tells which representation is in use.
+ *
+ * Iterator stability:
+ *  - While inline, an iterator is a position in the array: every insert
+ *    or erase that adds or removes an element shifts the elements after
+ *    it and invalidates all iterators, pointers and references,
+ *    end() included.
+ *  - An insert into a full inline map moves every element into the
+ *    tree: all iterators, pointers and references become invalid, and
+ *    only the iterator returned by insert() is valid.
+ *  - In the tree, the rules of sjtu::map hold: inserting invalidates
+ *    nothing, erasing invalidates the erased element only.
+ *  - An erase that moves the elements back inline invalidates all
+ *    iterators, pointers and references, as does clear().
+ * With checked iterators (see map_traits::checked_iterators), using an
+ * iterator from the other representation throws invalid_iterator; a
+ * stale iterator of the same representation is not detected.
+ *
+ * Key and T must be copy constructible.  Moving the elements between
+ * the array and the tree copies them, so if a copy throws the map is
+ * left as it was.  Shifting elements within the array moves them when
+ * that cannot throw; if a copy throws in the middle of a shift, the map
+ * is left empty rather than with a hole.
+ */
+template<
+   class Key,
+   class T,
+   class Compare = std::less <Key>,
+   size_t InlineMax = 8,
+   class Traits = map_traits
+   > class small_map {
+  public:
+   typedef pair<const Key, T> value_type;
+   typedef map<Key, T, Compare, Traits> tree_type;
+
+  private:
+   static_assert(InlineMax > 0, "small_map needs room for at least one inline element");
+
+   tree_type *tree;     // null while the elements are inline
+   size_t inlineCount;  // elements in slots, when tree is null
+   Compare comp;
+   alignas(value_type) unsigned char slots[InlineMax * sizeof(value_type)];
+
+   value_type *slot(size_t i) const {
+       return reinterpret_cast<value_type *>(const_cast<unsigned char *>(slots)) + i;
+   }
+
+   // Position of the first inline key not less than k, which is the
+   // number of inline keys less than k
+   size_t lowerBound(const Key &k) const {
+       size_t i = 0;
+       for (size_t j = 0; j < inlineCount; ++j) i += comp(slot(j)->first, k);
+       return i;
+   }
+
+   // Position of k, or inlineCount if k is absent
+   size_t indexOf(const Key &k) const {
+       size_t i = lowerBound(k);
+       return i < inlineCount && !comp(k, slot(i)->first) ? i : inlineCount;
+   }
+
+   void destroyInline() {
+       for (size_t i = 0; i < inlineCount; ++i) slot(i)->~value_type();
+       inlineCount = 0;
+   }
+
+   // After a throw in the middle of a shift, destroy the elements of
+   // slots [0, last] other than the empty slot hole
+   void abandonShift(size_t hole, size_t last) {
+       for (size_t i = 0; i <= last; ++i) {
+           if (i != hole) slot(i)->~value_type();
+       }
+       inlineCount = 0;
+   }
+
+   // Move the inline elements from i on up by one slot and put val at i;
+   // there must be room
+   void insertInline(size_t i, const value_type &val) {
+       size_t hole = inlineCount;
+       SJTU_TRY {
+           for (; hole > i; --hole) {
+               new (slot(hole)) value_type(std::move_if_noexcept(*slot(hole - 1)));
+               slot(hole - 1)->~value_type();
+           }
+           new (slot(i)) value_type(val);
+       } SJTU_CATCH_ALL {
+           // Nothing shifted yet: the map is as it was
+           if (hole < inlineCount) abandonShift(hole, inlineCount);
+           SJTU_RETHROW;
+       }
+       ++inlineCount;
+   }
+
+   // Destroy inline element i and move the ones after it down a slot
+   void eraseInline(size_t i) {
+       slot(i)->~value_type();
+       size_t hole = i;
+       SJTU_TRY {
+           for (; hole + 1 < inlineCount; ++hole) {
+               new (slot(hole)) value_type(std::move_if_noexcept(*slot(hole + 1)));
+               slot(hole + 1)->~value_type();
+           }
+       } SJTU_CATCH_ALL {
+           abandonShift(hole, inlineCount - 1);
+           SJTU_RETHROW;
+       }
+       --inlineCount;
+   }
+
+   // Copy the inline elements and val into a new tree and switch to it
+   typename tree_type::iterator spill(const value_type &val) {
+       tree_type *t = new tree_type;
+       SJTU_TRY {
+           for (size_t i = 0; i < inlineCount; ++i) t->insert(*slot(i));
+           t->insert(val);
+       } SJTU_CATCH_ALL {
+           delete t;
+           SJTU_RETHROW;
+       }
+       destroyInline();
+       tree = t;
+       return t->find(val.first);
+   }
+
+   // Copy the elements of the tree inline and free it; if a copy throws,
+   // the tree stays
+   void unspill() {
+       SJTU_TRY {
+           copyInline(*tree);
+       } SJTU_CATCH_ALL {
+           return;
+       }
+       delete tree;
+       tree = nullptr;
+   }
+
+   // Copy the elements of from, which fit, into the empty array; nothing
+   // is left behind if a copy throws
+   template<class From>
+   void copyInline(const From &from) {
+       SJTU_TRY {
+           for (typename From::const_iterator it = from.cbegin(); it != from.cend(); ++it) {
+               new (slot(inlineCount)) value_type(*it);
+               ++inlineCount;
+           }
+       } SJTU_CATCH_ALL {
+           destroyInline();
+           SJTU_RETHROW;
+       }
+   }
+
+   // A copy is inline whenever the elements fit
+   void copyFrom(const small_map &other) {
+       if (other.size() > InlineMax) {
+           tree = new tree_type(*other.tree);
+       } else {
+           copyInline(other);
+       }
+   }
+
+  public:
+   class const_iterator;
+   class iterator {
+      private:
+       const small_map *owner;
+       size_t index;                       // position, while inline
+       typename tree_type::iterator node;  // position, in the tree
+       bool inTree;
+
+       friend class small_map;
+       friend class const_iterator;
+
+       iterator(const small_map *m, typename tree_type::iterator n)
+           : owner(m), index(0), node(n), inTree(true) {}
+
+       // Whether the iterator belongs to the representation in use
+       bool current() const {
+           return owner && inTree == (owner->tree != nullptr);
+       }
+
+      public:
+       iterator(const small_map *m = nullptr, size_t i = 0) : owner(m), index(i), inTree(false) {}
+
+       iterator(const iterator &other)
+           : owner(other.owner), index(other.index), node(other.node), inTree(other.inTree) {}
+
+       iterator &operator=(const iterator &) = default;
+
+       /**
+        * Checked steps that report instead of throwing: move and return
+        * errc::none, or leave the iterator as it is and return
+        * errc::invalid_iterator where ++ / -- would throw.
+        */
+       errc try_increment() {
+           if (!current()) return errc::invalid_iterator;
+           if (inTree) return node.try_increment();
+           if (index >= owner->inlineCount) return errc::invalid_iterator;
+           ++index;
+           return errc::none;
+       }
+
+       errc try_decrement() {
+           if (!current()) return errc::invalid_iterator;
+           if (inTree) return node.try_decrement();
+           if (index == 0 || index > owner->inlineCount) return errc::invalid_iterator;
+           --index;
+           return errc::none;
+       }
+
+       iterator operator++(int) {
+           iterator temp = *this;
+           ++*this;
+           return temp;
+       }
+
+       iterator &operator++() {
+           if (!Traits::checked_iterators) {
+               if (inTree) {
+                   ++node;
+               } else {
+                   ++index;
+               }
+           } else if (try_increment() != errc::none) {
+               SJTU_THROW(invalid_iterator());
+           }
+           return *this;
+       }
+
+       iterator operator--(int) {
+           iterator temp = *this;
+           --*this;
+           return temp;
+       }
+
+       iterator &operator--() {
+           if (!Traits::checked_iterators) {
+               if (inTree) {
+                   --node;
+               } else {
+                   --index;
+               }
+           } else if (try_decrement() != errc::none) {
+               SJTU_THROW(invalid_iterator());
+           }
+           return *this;
+       }
+
+       value_type &operator*() const {
+           if (Traits::checked_iterators && (!current() || (!inTree && index >= owner->inlineCount))) {
+               SJTU_THROW(invalid_iterator());
+           }
+           return inTree ? *node : *owner->slot(index);
+       }
+
+       bool operator==(const iterator &rhs) const {
+           return owner == rhs.owner && inTree == rhs.inTree && (inTree ? node == rhs.node : index == rhs.index);
+       }
+
+       bool operator==(const const_iterator &rhs) const {
+           return owner == rhs.owner && inTree == rhs.inTree && (inTree ? node == rhs.node : index == rhs.index);
+       }
+
+       bool operator!=(const iterator &rhs) const {
+           return !(*this == rhs);
+       }
+
+       bool operator!=(const const_iterator &rhs) const {
+           return !(*this == rhs);
+       }
+
+       value_type *operator->() const noexcept {
+           return inTree ? node.operator->() : owner->slot(index);
+       }
+   };
+
+   class const_iterator {
+      private:
+       const small_map *owner;
+       size_t index;
+       typename tree_type::const_iterator node;
+       bool inTree;
+
+       friend class small_map;
+       friend class iterator;
+
+       const_iterator(const small_map *m, typename tree_type::const_iterator n)
+           : owner(m), index(0), node(n), inTree(true) {}
+
+       bool current() const {
+           return owner && inTree == (owner->tree != nullptr);
+       }
+
+      public:
+       const_iterator(const small_map *m = nullptr, size_t i = 0) : owner(m), index(i), inTree(false) {}
+
+       const_iterator(const const_iterator &other)
+           : owner(other.owner), index(other.index), node(other.node), inTree(other.inTree) {}
+
+       const_iterator(const iterator &other)
+           : owner(other.owner), index(other.index), node(other.node), inTree(other.inTree) {}
+
+       const_iterator &operator=(const const_iterator &) = default;
+
+       errc try_increment() {
+           if (!current()) return errc::invalid_iterator;
+           if (inTree) return node.try_increment();
+           if (index >= owner->inlineCount) return errc::invalid_iterator;
+           ++index;
+           return errc::none;
+       }
+
+       errc try_decrement() {
+           if (!current()) return errc::invalid_iterator;
+           if (inTree) return node.try_decrement();
+           if (index == 0 || index > owner->inlineCount) return errc::invalid_iterator;
+           --index;
+           return errc::none;
+       }
+
+       const_iterator operator++(int) {
+           const_iterator temp = *this;
+           ++*this;
+           return temp;
+       }
+
+       const_iterator &operator++() {
+           if (!Traits::checked_iterators) {
+               if (inTree) {
+                   ++node;
+               } else {
+                   ++index;
+               }
+           } else if (try_increment() != errc::none) {
+               SJTU_THROW(invalid_iterator());
+           }
+           return *this;
+       }
+
+       const_iterator operator--(int) {
+           const_iterator temp = *this;
+           --*this;
+           return temp;
+       }
+
+       const_iterator &operator--() {
+           if (!Traits::checked_iterators) {
+               if (inTree) {
+                   --node;
+               } else {
+                   --index;
+               }
+           } else if (try_decrement() != errc::none) {
+               SJTU_THROW(invalid_iterator());
+           }
+           return *this;
+       }
+
+       const value_type &operator*() const {
+           if (Traits::checked_iterators && (!current() || (!inTree && index >= owner->inlineCount))) {
+               SJTU_THROW(invalid_iterator());
+           }
+           return inTree ? *node : *owner->slot(index);
+       }
+
+       bool operator==(const iterator &rhs) const {
+           return owner == rhs.owner && inTree == rhs.inTree && (inTree ? node == rhs.node : index == rhs.index);
+       }
+
+       bool operator==(const const_iterator &rhs) const {
+           return owner == rhs.owner && inTree == rhs.inTree && (inTree ? node == rhs.node : index == rhs.index);
+       }
+
+       bool operator!=(const iterator &rhs) const {
+           return !(*this == rhs);
+       }
+
+       bool operator!=(const const_iterator &rhs) const {
+           return !(*this == rhs);
+       }
+
+       const value_type *operator->() const noexcept {
+           return inTree ? node.operator->() : owner->slot(index);
+       }
+   };
+
+   small_map() : tree(nullptr), inlineCount(0) {}
+
+   small_map(const small_map &other) : tree(nullptr), inlineCount(0), comp(other.comp) {
+       copyFrom(other);
+   }
+
+   small_map &operator=(const small_map &other) {
+       if (this == &other) return *this;
+       clear();
+       comp = other.comp;
+       copyFrom(other);
+       return *this;
+   }
+
+   ~small_map() {
+       clear();
+   }
+
+   T &at(const Key &key) {
+       if (tree) return tree->at(key);
+       size_t i = indexOf(key);
+       if (i == inlineCount) SJTU_THROW(index_out_of_bound());
+       return slot(i)->second;
+   }
+
+   const T &at(const Key &key) const {
+       if (tree) return static_cast<const tree_type *>(tree)->at(key);
+       size_t i = indexOf(key);
+       if (i == inlineCount) SJTU_THROW(index_out_of_bound());
+       return slot(i)->second;
+   }
+
+   T &operator[](const Key &key) {
+       if (tree) return (*tree)[key];
+       size_t i = lowerBound(key);
+       if (i < inlineCount && !comp(key, slot(i)->first)) return slot(i)->second;
+
+       // Insert new element with default value
+       if (inlineCount == InlineMax) return spill(value_type(key, T()))->second;
+       insertInline(i, value_type(key, T()));
+       return slot(i)->second;
+   }
+
+   const T &operator[](const Key &key) const {
+       return at(key);
+   }
+
+   iterator begin() {
+       if (tree) return iterator(this, tree->begin());
+       return iterator(this, 0);
+   }
+
+   const_iterator cbegin() const {
+       if (tree) return const_iterator(this, static_cast<const tree_type *>(tree)->cbegin());
+       return const_iterator(this, 0);
+   }
+
+   iterator end() {
+       if (tree) return iterator(this, tree->end());
+       return iterator(this, inlineCount);
+   }
+
+   const_iterator cend() const {
+       if (tree) return const_iterator(this, static_cast<const tree_type *>(tree)->cend());
+       return const_iterator(this, inlineCount);
+   }
+
+   bool empty() const {
+       return size() == 0;
+   }
+
+   size_t size() const {
+       return tree ? tree->size() : inlineCount;
+   }
+
+   // Whether the elements are held inline rather than in a tree
+   bool is_inline() const {
+       return !tree;
+   }
+
+   void clear() {
+       delete tree;
+       tree = nullptr;
+       destroyInline();
+   }
+
+   pair<iterator, bool> insert(const value_type &val) {
+       if (tree) {
+           pair<typename tree_type::iterator, bool> result = tree->insert(val);
+           return pair<iterator, bool>(iterator(this, result.first), result.second);
+       }
+       size_t i = lowerBound(val.first);
+       if (i < inlineCount && !comp(val.first, slot(i)->first)) {
+           return pair<iterator, bool>(iterator(this, i), false);
+       }
+       if (inlineCount == InlineMax) return pair<iterator, bool>(iterator(this, spill(val)), true);
+       insertInline(i, val);
+       return pair<iterator, bool>(iterator(this, i), true);
+   }
+
+   void erase(iterator pos) {
+       if (try_erase(pos) != errc::none) SJTU_THROW(invalid_iterator());
+   }
+
+   // erase() that returns errc::invalid_iterator instead of throwing
+   errc try_erase(iterator pos) {
+       if (pos.owner != this || pos.inTree != (tree != nullptr)) return errc::invalid_iterator;
+       if (!tree) {
+           if (pos.index >= inlineCount) return errc::invalid_iterator;
+           eraseInline(pos.index);
+           return errc::none;
+       }
+       errc result = tree->try_erase(pos.node);
+       if (result == errc::none && tree->size() <= InlineMax / 2) unspill();
+       return result;
+   }
+
+   size_t count(const Key &key) const {
+       if (tree) return tree->count(key);
+       return indexOf(key) < inlineCount ? 1 : 0;
+   }
+
+   iterator find(const Key &key) {
+       if (tree) return iterator(this, tree->find(key));
+       return iterator(this, indexOf(key));
+   }
+
+   const_iterator find(const Key &key) const {
+       if (tree) return const_iterator(this, static_cast<const tree_type *>(tree)->find(key));
+       return const_iterator(this, indexOf(key));
+   }
+
+   /**
+    * Iterator to the first element whose key is not less than key,
+    * or end() if there is none.
+    */
+   iterator lower_bound(const Key &key) {
+       if (tree) return iterator(this, tree->lower_bound(key));
+       return iterator(this, lowerBound(key));
+   }
+
+   const_iterator lower_bound(const Key &key) const {
+       if (tree) return const_iterator(this, static_cast<const tree_type *>(tree)->lower_bound(key));
+       return const_iterator(this, lowerBound(key));
+   }
+};
+
+}
+
+#endif
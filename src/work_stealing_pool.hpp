@@ -0,0 +1,212 @@
+#ifndef SJTU_WORK_STEALING_POOL_HPP
+#define SJTU_WORK_STEALING_POOL_HPP
+
+// Thread pool for map::parallel_for_each() and map::parallel_reduce().
+// Not part of the OJ submission: map.hpp itself includes no thread
+// headers and accepts any pool with the run() interface below.
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "exceptions.hpp"
+// The SJTU_TRY / SJTU_CATCH_ALL macros
+#include "map.hpp"
+
+namespace sjtu {
+
+/**
+ * Fixed set of worker threads that run bulk jobs: run(n, f) calls f(i)
+ * for every i in [0, n) and returns when all calls are done.  The
+ * indices are dealt out in contiguous runs, one per thread; a thread
+ * takes from the back of its own run and, once it is empty, steals the
+ * front half of the fullest remaining run, so uneven tasks balance out.
+ * The calling thread works as one of the threads.  run() is not
+ * reentrant: f must not call run() on the same pool.
+ */
+class work_stealing_pool {
+   // Remaining indices [begin, end) of one thread; the padding keeps the
+   // runs of different threads off each other's cache lines
+   struct Run {
+       std::mutex lock;
+       size_t begin, end;
+       char padding[64];
+
+       Run() : begin(0), end(0) {}
+   };
+
+   typedef void (*Invoke)(void *, size_t);
+
+   std::vector<std::thread> workers;
+   Run *runs;
+   unsigned threadCount;
+
+   std::mutex jobLock;
+   std::condition_variable jobStart, jobDone;
+   unsigned long long generation;
+   unsigned busy;
+   bool stopping;
+   Invoke invoke;
+   void *job;
+   std::exception_ptr failure;
+
+   template<class F>
+   static void call(void *f, size_t i) {
+       (*static_cast<F *>(f))(i);
+   }
+
+   bool takeOwn(unsigned self, size_t &i) {
+       Run &r = runs[self];
+       std::lock_guard<std::mutex> guard(r.lock);
+       if (r.begin == r.end) return false;
+       i = --r.end;
+       return true;
+   }
+
+   // Move the front half of the largest other run into ours
+   bool steal(unsigned self) {
+       unsigned victim = self;
+       size_t most = 0;
+       for (unsigned k = 1; k < threadCount; ++k) {
+           unsigned v = (self + k) % threadCount;
+           std::lock_guard<std::mutex> guard(runs[v].lock);
+           size_t left = runs[v].end - runs[v].begin;
+           if (left > most) {
+               most = left;
+               victim = v;
+           }
+       }
+       if (victim == self) return false;
+       size_t begin, end;
+       {
+           Run &r = runs[victim];
+           std::lock_guard<std::mutex> guard(r.lock);
+           size_t left = r.end - r.begin;
+           if (left == 0) return true;  // raced with its owner; look again
+           begin = r.begin;
+           end = r.begin + (left + 1) / 2;
+           r.begin = end;
+       }
+       Run &mine = runs[self];
+       std::lock_guard<std::mutex> guard(mine.lock);
+       mine.begin = begin;
+       mine.end = end;
+       return true;
+   }
+
+   void work(unsigned self) {
+       for (;;) {
+           size_t i;
+           if (takeOwn(self, i)) {
+               SJTU_TRY {
+                   invoke(job, i);
+               } SJTU_CATCH_ALL {
+                   std::lock_guard<std::mutex> guard(jobLock);
+                   if (!failure) failure = std::current_exception();
+               }
+           } else if (!steal(self)) {
+               return;
+           }
+       }
+   }
+
+   void workerLoop(unsigned self) {
+       unsigned long long seen = 0;
+       for (;;) {
+           {
+               std::unique_lock<std::mutex> guard(jobLock);
+               while (!stopping && generation == seen) jobStart.wait(guard);
+               if (stopping) return;
+               seen = generation;
+           }
+           work(self);
+           std::lock_guard<std::mutex> guard(jobLock);
+           if (--busy == 0) jobDone.notify_one();
+       }
+   }
+
+   work_stealing_pool(const work_stealing_pool &);
+   work_stealing_pool &operator=(const work_stealing_pool &);
+
+  public:
+   /**
+    * threads counts the calling thread; 0 means one per hardware thread.
+    */
+   explicit work_stealing_pool(unsigned threads = 0)
+       : runs(nullptr), threadCount(threads), generation(0), busy(0), stopping(false),
+         invoke(nullptr), job(nullptr) {
+       if (threadCount == 0) threadCount = std::thread::hardware_concurrency();
+       if (threadCount == 0) threadCount = 1;
+       runs = new Run[threadCount];
+       SJTU_TRY {
+           for (unsigned t = 1; t < threadCount; ++t) {
+               workers.push_back(std::thread(&work_stealing_pool::workerLoop, this, t));
+           }
+       } SJTU_CATCH_ALL {
+           shutdown();
+           SJTU_RETHROW;
+       }
+   }
+
+   ~work_stealing_pool() {
+       shutdown();
+   }
+
+   unsigned size() const {
+       return threadCount;
+   }
+
+   /**
+    * Call f(i) for i in [0, n) across the pool and wait for all of them.
+    * If calls throw, the first exception is rethrown here after the
+    * remaining calls have finished.
+    */
+   template<class F>
+   void run(size_t n, F f) {
+       if (n == 0) return;
+       if (threadCount == 1 || n == 1) {
+           for (size_t i = 0; i < n; ++i) f(i);
+           return;
+       }
+       for (unsigned t = 0; t < threadCount; ++t) {
+           runs[t].begin = n * t / threadCount;
+           runs[t].end = n * (t + 1) / threadCount;
+       }
+       {
+           std::lock_guard<std::mutex> guard(jobLock);
+           invoke = &call<F>;
+           job = &f;
+           failure = std::exception_ptr();
+           busy = threadCount - 1;
+           ++generation;
+       }
+       jobStart.notify_all();
+       work(0);
+       std::exception_ptr error;
+       {
+           std::unique_lock<std::mutex> guard(jobLock);
+           while (busy > 0) jobDone.wait(guard);
+           error = failure;
+           failure = std::exception_ptr();
+       }
+       if (error) std::rethrow_exception(error);
+   }
+
+  private:
+   void shutdown() {
+       {
+           std::lock_guard<std::mutex> guard(jobLock);
+           stopping = true;
+       }
+       jobStart.notify_all();
+       for (size_t t = 0; t < workers.size(); ++t) workers[t].join();
+       workers.clear();
+       delete[] runs;
+       runs = nullptr;
+   }
+};
+
+}
+
+#endif
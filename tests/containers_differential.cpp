@@ -0,0 +1,177 @@
+/**
+ * btree_map, flat_map and small_map against std::map, each with a few
+ * choices of its size parameter: the shared steps of differential.hpp
+ * plus what the container adds (flat_map's bulk insert and capacity
+ * calls, small_map's moves between the array and the tree).
+ *
+ *   g++ -O1 -g -std=c++11 -I../src containers_differential.cpp -o containers_differential
+ *   ./containers_differential [rounds]       (default: 4000)
+ *
+ * Worth running under -fsanitize=address,undefined as well.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "btree_map.hpp"
+#include "flat_map.hpp"
+#include "small_map.hpp"
+#include "differential.hpp"
+
+using difftest::Counted;
+using difftest::Model;
+using difftest::Random;
+
+struct threaded_cache_traits : sjtu::map_traits {
+    static const bool threaded = true;
+    static const size_t lookup_cache_slots = 16;
+};
+
+struct splay_traits : sjtu::map_traits {
+    static const bool splay_tree = true;
+};
+
+// Element of a bulk insert: flat_map takes anything with first and second
+struct Item {
+    int first;
+    Counted second;
+};
+
+struct ItemLess {
+    bool operator()(const Item &a, const Item &b) const { return a.first < b.first; }
+};
+
+/**
+ * flat_map's own calls: insert(first, last) from sorted and unsorted
+ * ranges with repeated keys, reserve() and shrink_to_fit().
+ */
+template<class Map>
+void flatStep(Map &m, Model &model, Random &rnd, int range, const char *name, unsigned seed) {
+    switch (rnd.below(3)) {
+    case 0: {
+        int n = rnd.below(2) ? rnd.below(8) : rnd.below(range / 4 + 1);
+        std::vector<Item> items(n);
+        for (int i = 0; i < n; ++i) {
+            items[i].first = rnd.below(range);
+            items[i].second = Counted(rnd.below(1000));
+        }
+        if (rnd.below(2)) std::stable_sort(items.begin(), items.end(), ItemLess());
+        // Of equal keys the first one wins, and present keys keep their values
+        for (int i = 0; i < n; ++i) model.insert(Model::value_type(items[i].first, items[i].second));
+        m.insert(items.begin(), items.end());
+        break;
+    }
+    case 1: {
+        size_t n = m.size() + rnd.below(range);
+        m.reserve(n);
+        DIFF_CHECK(m.capacity() >= n, "reserve");
+        break;
+    }
+    default:
+        m.shrink_to_fit();
+        DIFF_CHECK(m.capacity() == m.size(), "shrink_to_fit");
+    }
+}
+
+template<class Map>
+void runFlat(const char *name, unsigned seed, int rounds, int range) {
+    difftest::runCommon<Map>(name, seed, rounds, range);
+    long liveBefore = Counted::live;
+    {
+        Map m;
+        Model model;
+        Random rnd(seed);
+        for (int i = 0; i < rounds; ++i) {
+            if (rnd.below(8) == 0) flatStep(m, model, rnd, range, name, seed);
+            else difftest::commonStep(m, model, rnd, range, name, seed);
+            DIFF_CHECK(m.capacity() >= m.size(), "capacity");
+            if (i % 16 == 0 || i + 1 == rounds) difftest::checkSame(m, model, name, seed);
+        }
+    }
+    DIFF_CHECK(Counted::live == liveBefore, "values leaked or destroyed twice");
+}
+
+/**
+ * Common steps alternating with stretches of erases, on keys from a
+ * range a few times InlineMax, so that the map keeps moving between the
+ * array and the tree: the array holds at most InlineMax elements and
+ * the tree more than InlineMax / 2.
+ */
+template<class Map, size_t InlineMax>
+void runSmall(const char *name, unsigned seed, int rounds) {
+    const int range = int(InlineMax) * 3 + 2;
+    // Long enough for the common steps to fill the array and overflow it
+    const int phase = range * 4;
+    difftest::runCommon<Map>(name, seed, rounds, range);
+    long liveBefore = Counted::live;
+    {
+        Map m;
+        Model model;
+        Random rnd(seed);
+        bool wasInline = true;
+        int moves = 0;
+        for (int i = 0; i < rounds; ++i) {
+            if ((i / phase) % 2 == 0) {
+                difftest::commonStep(m, model, rnd, range, name, seed);
+            } else {
+                // Erase only, to bring the tree back down to the array
+                int k = rnd.below(range);
+                typename Map::iterator it = m.find(k);
+                DIFF_CHECK((it == m.end()) == (model.count(k) == 0), "find");
+                if (it != m.end()) {
+                    m.erase(it);
+                    model.erase(k);
+                }
+            }
+            if (m.is_inline()) DIFF_CHECK(m.size() <= InlineMax, "inline map too large");
+            else DIFF_CHECK(m.size() > InlineMax / 2, "tree not moved back inline");
+            if (m.is_inline() != wasInline) ++moves;
+            wasInline = m.is_inline();
+            difftest::checkSame(m, model, name, seed);
+            if (rnd.below(256) == 0) {
+                m.clear();
+                model.clear();
+                DIFF_CHECK(m.is_inline(), "clear() goes back inline");
+            }
+        }
+        if (rounds >= phase) DIFF_CHECK(moves > 0, "never left the array");
+    }
+    DIFF_CHECK(Counted::live == liveBefore, "values leaked or destroyed twice");
+}
+
+template<class Map>
+void runBtree(const char *name, int rounds) {
+    // Small key ranges keep the leaves sparse, large ones split them
+    difftest::runCommon<Map>(name, 1, rounds, 64);
+    difftest::runCommon<Map>(name, 2, rounds, 1000);
+    difftest::runCommon<Map>(name, 3, rounds, 20000);
+    printf("ok  %s\n", name);
+}
+
+int main(int argc, char **argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 4000;
+    runBtree<sjtu::btree_map<int, Counted> >("btree_map", rounds);
+    runBtree<sjtu::btree_map<int, Counted, std::less<int>, 256> >("btree_map, 256-byte nodes", rounds);
+    runBtree<sjtu::btree_map<int, Counted, std::less<int>, 4096> >("btree_map, 4096-byte nodes", rounds);
+
+    runFlat<sjtu::flat_map<int, Counted> >("flat_map", 1, rounds, 64);
+    runFlat<sjtu::flat_map<int, Counted> >("flat_map", 2, rounds, 2000);
+    printf("ok  flat_map\n");
+    runFlat<sjtu::flat_map<int, Counted, std::less<int>, 0> >("flat_map, binary search only", 3, rounds, 2000);
+    printf("ok  flat_map, binary search only\n");
+    runFlat<sjtu::flat_map<int, Counted, std::less<int>, 64> >("flat_map, linear search to 64", 4, rounds, 2000);
+    printf("ok  flat_map, linear search to 64\n");
+
+    runSmall<sjtu::small_map<int, Counted>, 8>("small_map", 1, rounds);
+    printf("ok  small_map\n");
+    runSmall<sjtu::small_map<int, Counted, std::less<int>, 1>, 1>("small_map, 1 inline", 2, rounds);
+    printf("ok  small_map, 1 inline\n");
+    runSmall<sjtu::small_map<int, Counted, std::less<int>, 32, threaded_cache_traits>, 32>(
+        "small_map, 32 inline, threaded cached tree", 3, rounds);
+    printf("ok  small_map, 32 inline, threaded cached tree\n");
+    runSmall<sjtu::small_map<int, Counted, std::less<int>, 16, splay_traits>, 16>(
+        "small_map, 16 inline, splay tree", 4, rounds);
+    printf("ok  small_map, 16 inline, splay tree\n");
+    printf("all passed\n");
+    return 0;
+}
@@ -0,0 +1,223 @@
+/**
+ * Differential checks of the sjtu containers against std::map: a test
+ * applies the same random operations to both and compares them after
+ * every step.  Shared by the programs in this directory; each one
+ * prints the cases it ran and exits non-zero on the first mismatch.
+ */
+#ifndef SJTU_TESTS_DIFFERENTIAL_HPP
+#define SJTU_TESTS_DIFFERENTIAL_HPP
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+
+namespace difftest {
+
+// Mapped value that counts its live copies, so a leaked or doubly
+// destroyed value shows up once the containers are gone; atomic, since
+// the pool overloads create values on several threads.  Setting
+// failAfter to n > 0 makes the n-th copy from then on throw.
+struct Counted {
+    static std::atomic<long> live;
+    static long failAfter;
+    int v;
+
+    Counted() : v(0) { ++live; }
+    Counted(int v) : v(v) { ++live; }
+    Counted(const Counted &o) : v(o.v) {
+        if (failAfter > 0 && --failAfter == 0) throw failAfter;
+        ++live;
+    }
+    Counted &operator=(const Counted &o) {
+        v = o.v;
+        return *this;
+    }
+    ~Counted() { --live; }
+
+    bool operator==(const Counted &o) const { return v == o.v; }
+};
+
+std::atomic<long> Counted::live(0);
+long Counted::failAfter = 0;
+
+typedef std::map<int, Counted> Model;
+
+inline void fail(const char *what, const char *test, unsigned seed) {
+    printf("FAILED: %s (%s, seed %u)\n", what, test, seed);
+    exit(1);
+}
+
+#define DIFF_CHECK(cond, what) \
+    do { \
+        if (!(cond)) ::difftest::fail(what, name, seed); \
+    } while (0)
+
+// Deterministic generator, so a failure can be replayed from its seed
+struct Random {
+    unsigned long long state;
+
+    explicit Random(unsigned seed) : state(seed * 0x9e3779b97f4a7c15ull + 1) {}
+
+    unsigned next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return unsigned(state >> 16);
+    }
+
+    int below(int n) { return int(next() % unsigned(n)); }
+};
+
+// Key and mapped value of an element, whichever pair type it comes as
+template<class P>
+int keyOf(const P &p) {
+    return p.first;
+}
+
+template<class P>
+int valueOf(const P &p) {
+    return p.second.v;
+}
+
+/**
+ * m holds exactly the elements of model: size, a forward walk through
+ * iterator and const_iterator, a backward walk from end(), and a lookup
+ * of every key.
+ */
+template<class Map>
+void checkSame(Map &m, const Model &model, const char *name, unsigned seed) {
+    DIFF_CHECK(m.size() == model.size(), "size");
+    DIFF_CHECK(m.empty() == model.empty(), "empty");
+    typename Model::const_iterator e = model.begin();
+    for (typename Map::iterator it = m.begin(); it != m.end(); ++it, ++e) {
+        DIFF_CHECK(e != model.end(), "forward walk is too long");
+        DIFF_CHECK(keyOf(*it) == e->first && valueOf(*it) == e->second.v, "forward walk");
+    }
+    DIFF_CHECK(e == model.end(), "forward walk is too short");
+    const Map &cm = m;
+    e = model.begin();
+    for (typename Map::const_iterator it = cm.cbegin(); it != cm.cend(); it++, ++e) {
+        DIFF_CHECK(e != model.end() && keyOf(*it) == e->first, "const walk");
+    }
+    typename Model::const_reverse_iterator r = model.rbegin();
+    if (!model.empty()) {
+        typename Map::iterator it = m.end();
+        do {
+            --it;
+            DIFF_CHECK(keyOf(*it) == r->first, "backward walk");
+            ++r;
+        } while (it != m.begin());
+    }
+    DIFF_CHECK(r == model.rend(), "backward walk is too short");
+    for (e = model.begin(); e != model.end(); ++e) {
+        DIFF_CHECK(cm.count(e->first) == 1, "count of a present key");
+        DIFF_CHECK(cm.at(e->first).v == e->second.v, "const at");
+    }
+}
+
+/**
+ * One random step of the operations every container shares: insert,
+ * operator[], at, find, count, erase and lower_bound, on keys from
+ * [0, range).
+ */
+template<class Map>
+void commonStep(Map &m, Model &model, Random &rnd, int range, const char *name, unsigned seed) {
+    int k = rnd.below(range), v = rnd.below(1000);
+    const Map &cm = m;
+    switch (rnd.below(8)) {
+    case 0:
+    case 1: {
+        bool fresh = model.find(k) == model.end();
+        if (fresh) model.insert(Model::value_type(k, Counted(v)));
+        typename Map::iterator it = m.insert(typename Map::value_type(k, Counted(v))).first;
+        DIFF_CHECK(keyOf(*it) == k && valueOf(*it) == model.find(k)->second.v, "insert");
+        break;
+    }
+    case 2:
+        m[k] = Counted(v);
+        model[k] = Counted(v);
+        break;
+    case 3: {
+        typename Map::iterator it = m.find(k);
+        typename Model::iterator e = model.find(k);
+        DIFF_CHECK((it == m.end()) == (e == model.end()), "find");
+        if (e != model.end()) {
+            m.erase(it);
+            model.erase(e);
+        }
+        break;
+    }
+    case 4: {
+        bool threw = false;
+        try {
+            m.at(k) = Counted(v);
+        } catch (...) {
+            threw = true;
+        }
+        DIFF_CHECK(threw == (model.find(k) == model.end()), "at");
+        if (!threw) model[k] = Counted(v);
+        break;
+    }
+    case 5: {
+        DIFF_CHECK(cm.count(k) == model.count(k), "count");
+        typename Map::const_iterator it = cm.find(k);
+        DIFF_CHECK((it == cm.cend()) == (model.find(k) == model.end()), "const find");
+        break;
+    }
+    case 6: {
+        typename Map::iterator it = m.lower_bound(k);
+        typename Model::iterator e = model.lower_bound(k);
+        DIFF_CHECK((it == m.end()) == (e == model.end()), "lower_bound");
+        if (e != model.end()) DIFF_CHECK(keyOf(*it) == e->first, "lower_bound key");
+        break;
+    }
+    default: {
+        bool threw = false;
+        try {
+            m.erase(m.end());
+        } catch (...) {
+            threw = true;
+        }
+        DIFF_CHECK(threw, "erase(end()) must throw");
+        break;
+    }
+    }
+}
+
+/**
+ * rounds random common steps against a fresh map, with a full
+ * comparison after each, a copy and an assignment along the way, and
+ * a check that no Counted value outlives the maps.
+ */
+template<class Map>
+void runCommon(const char *name, unsigned seed, int rounds, int range) {
+    long liveBefore = Counted::live;
+    {
+        Map m;
+        Model model;
+        Random rnd(seed);
+        for (int i = 0; i < rounds; ++i) {
+            commonStep(m, model, rnd, range, name, seed);
+            if (i % 64 == 0 || i + 1 == rounds) checkSame(m, model, name, seed);
+            if (i == rounds / 2) {
+                Map copy(m);
+                checkSame(copy, model, name, seed);
+                Map assigned;
+                assigned[range] = Counted(1);
+                assigned = m;
+                checkSame(assigned, model, name, seed);
+            }
+        }
+        m.clear();
+        model.clear();
+        checkSame(m, model, name, seed);
+        for (int i = 0; i < rounds / 4; ++i) commonStep(m, model, rnd, range, name, seed);
+        checkSame(m, model, name, seed);
+    }
+    DIFF_CHECK(Counted::live == liveBefore, "values leaked or destroyed twice");
+}
+
+}
+
+#endif
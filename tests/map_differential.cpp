@@ -0,0 +1,630 @@
+/**
+ * sjtu::map against std::map under every map_traits option, alone and
+ * combined: the shared steps of differential.hpp plus the map's own
+ * operations.
+ *
+ *   g++ -O1 -g -std=c++11 -pthread -I../src map_differential.cpp -o map_differential
+ *   ./map_differential [rounds]       (default: 4000)
+ *
+ * Worth running under -fsanitize=address,undefined as well.
+ * The parallel steps also make it worth a run under -fsanitize=thread.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "map.hpp"
+#include "work_stealing_pool.hpp"
+#include "differential.hpp"
+
+using difftest::Counted;
+using difftest::Model;
+using difftest::Random;
+
+struct compact_traits : sjtu::map_traits {
+    static const bool compact_color = true;
+};
+
+struct index_traits : sjtu::map_traits {
+    static const bool index_links = true;
+};
+
+struct split_traits : sjtu::map_traits {
+    static const bool compact_color = true;
+    static const bool index_links = true;
+    static const bool split_values = true;
+};
+
+struct threaded_traits : sjtu::map_traits {
+    static const bool threaded = true;
+};
+
+struct threaded_index_traits : sjtu::map_traits {
+    static const bool index_links = true;
+    static const bool threaded = true;
+};
+
+struct cache_traits : sjtu::map_traits {
+    static const size_t lookup_cache_slots = 16;
+};
+
+struct filter_traits : sjtu::map_traits {
+    static const size_t filter_bits_per_key = 10;
+};
+
+struct unchecked_traits : sjtu::map_traits {
+    static const bool checked_iterators = false;
+};
+
+struct unchecked_threaded_traits : sjtu::map_traits {
+    static const bool checked_iterators = false;
+    static const bool compact_color = true;
+    static const bool threaded = true;
+};
+
+struct counted_traits : sjtu::map_traits {
+    static const size_t access_sample = 1;
+};
+
+struct avl_traits : sjtu::map_traits {
+    static const bool avl_balancing = true;
+};
+
+struct avl_index_traits : sjtu::map_traits {
+    static const bool avl_balancing = true;
+    static const bool index_links = true;
+    static const bool compact_color = true;
+    static const bool threaded = true;
+};
+
+struct splay_traits : sjtu::map_traits {
+    static const bool splay_tree = true;
+};
+
+struct splay_everything_traits : sjtu::map_traits {
+    static const bool splay_tree = true;
+    static const bool threaded = true;
+    static const size_t lookup_cache_slots = 8;
+    static const size_t filter_bits_per_key = 8;
+    static const size_t access_sample = 2;
+};
+
+struct everything_traits : sjtu::map_traits {
+    static const bool compact_color = true;
+    static const bool index_links = true;
+    static const bool split_values = true;
+    static const bool threaded = true;
+    static const size_t lookup_cache_slots = 8;
+    static const size_t filter_bits_per_key = 8;
+    static const size_t access_sample = 2;
+};
+
+// Collects the keys a visitor is handed, stopping after limit of them
+struct Collect {
+    std::vector<int> *keys;
+    size_t limit;
+
+    bool operator()(const sjtu::pair<const int, Counted> &p) const {
+        keys->push_back(p.first);
+        return keys->size() < limit;
+    }
+};
+
+struct Sum {
+    long operator()(long a, long b) const { return a + b; }
+};
+
+struct KeyOf {
+    long operator()(const sjtu::pair<const int, Counted> &p) const { return p.first; }
+};
+
+// Adds up the keys it is handed, from any number of threads
+struct AddKeys {
+    std::atomic<long> *total;
+
+    void operator()(const sjtu::pair<const int, Counted> &p) const { *total += p.first; }
+};
+
+// A pool with only run(), the interface the parallel operations document
+struct RunOnlyPool {
+    template<class Task>
+    void run(size_t n, Task task) {
+        for (size_t i = 0; i < n; ++i) task(i);
+    }
+};
+
+// Shared by the parallel steps
+sjtu::work_stealing_pool &testPool() {
+    static sjtu::work_stealing_pool pool(4);
+    return pool;
+}
+
+struct Add {
+    Counted operator()(const Counted &mine, const Counted &theirs) const {
+        return Counted(mine.v + theirs.v);
+    }
+};
+
+template<class Map>
+void fillRandom(Map &m, Model &model, Random &rnd, int n, int range) {
+    for (int i = 0; i < n; ++i) {
+        int k = rnd.below(range), v = rnd.below(1000);
+        m[k] = Counted(v);
+        model[k] = Counted(v);
+    }
+}
+
+struct OddValue {
+    bool operator()(const sjtu::pair<const int, Counted> &p) const { return p.second.v % 2 != 0; }
+};
+
+// One random step of the map's own operations on keys from [0, range)
+template<class Map>
+void mapStep(Map &m, Model &model, Random &rnd, int range, const char *name, unsigned seed) {
+    typedef typename Map::iterator iterator;
+    int k = rnd.below(range);
+    switch (rnd.below(19)) {
+    case 0:
+        m.shrink_to_fit();
+        DIFF_CHECK(m.capacity() >= m.size(), "capacity after shrink_to_fit");
+        break;
+    case 1:
+        m.set_auto_shrink(rnd.below(2));
+        break;
+    case 2: {
+        // Erase a run of neighbours through one iterator
+        iterator it = m.lower_bound(k);
+        for (int i = rnd.below(range / 8 + 1); i > 0 && it != m.end(); --i) {
+            iterator next = it;
+            ++next;
+            model.erase(it->first);
+            m.erase(it);
+            it = next;
+        }
+        break;
+    }
+    case 3: {
+        // Finger search from a random hint, forwards and backwards
+        iterator hint = m.lower_bound(rnd.below(range));
+        iterator it = m.lower_bound_from(hint, k);
+        Model::iterator e = model.lower_bound(k);
+        DIFF_CHECK((it == m.end()) == (e == model.end()), "lower_bound_from");
+        if (e != model.end()) DIFF_CHECK(it->first == e->first, "lower_bound_from key");
+        it = m.find_from(hint, k);
+        DIFF_CHECK((it == m.end()) == (model.find(k) == model.end()), "find_from");
+        break;
+    }
+    case 4: {
+        int n = 1 + rnd.below(40);
+        std::vector<int> keys(n);
+        for (int i = 0; i < n; ++i) keys[i] = rnd.below(range);
+        std::vector<iterator> out(n);
+        m.find_many(&keys[0], n, &out[0]);
+        for (int i = 0; i < n; ++i) {
+            Model::iterator e = model.find(keys[i]);
+            DIFF_CHECK((out[i] == m.end()) == (e == model.end()), "find_many");
+            if (e != model.end()) DIFF_CHECK(out[i]->second.v == e->second.v, "find_many value");
+        }
+        break;
+    }
+    case 5: {
+        int n = 1 + rnd.below(rnd.below(2) ? 8 : range);
+        std::vector<typename Map::batch_op> ops;
+        std::vector<Counted> mapped(n);
+        std::vector<bool> expected(n);
+        for (int i = 0; i < n; ++i) {
+            int key = rnd.below(range);
+            mapped[i] = Counted(rnd.below(1000));
+            ops.push_back(typename Map::batch_op(typename Map::batch_op::kind_type(rnd.below(4)), key, &mapped[i]));
+        }
+        // The batch acts like its ops issued one at a time in order
+        for (int i = 0; i < n; ++i) {
+            Model::iterator e = model.find(ops[i].key);
+            switch (ops[i].kind) {
+            case Map::batch_op::INSERT:
+                expected[i] = e == model.end();
+                if (expected[i]) model.insert(Model::value_type(ops[i].key, mapped[i]));
+                break;
+            case Map::batch_op::ASSIGN:
+                expected[i] = e == model.end();
+                model[ops[i].key] = mapped[i];
+                break;
+            case Map::batch_op::ERASE:
+                expected[i] = e != model.end();
+                if (expected[i]) model.erase(e);
+                break;
+            default:
+                expected[i] = e != model.end();
+            }
+        }
+        std::vector<typename Map::batch_result> results(n);
+        m.apply_batch(&ops[0], n, &results[0]);
+        for (int i = 0; i < n; ++i) DIFF_CHECK(results[i].done == expected[i], "apply_batch result");
+        break;
+    }
+    case 6: {
+        // Lookups through a const map leave the cache statistics alone
+        const Map &cm = m;
+        typename Map::lookup_stats before = cm.lookup_cache_stats();
+        DIFF_CHECK(cm.count(k) == model.count(k), "count");
+        DIFF_CHECK((cm.find(k) == cm.cend()) == (model.count(k) == 0), "const find");
+        typename Map::lookup_stats after = cm.lookup_cache_stats();
+        DIFF_CHECK(before.hits == after.hits && before.misses == after.misses, "const lookups counted by the cache");
+        break;
+    }
+    case 7: {
+        // and the filter statistics too
+        const Map &cm = m;
+        typename Map::filter_stats before = cm.membership_filter_stats();
+        DIFF_CHECK(cm.count(k) == model.count(k), "count");
+        typename Map::filter_stats after = cm.membership_filter_stats();
+        DIFF_CHECK(before.queries == after.queries && before.rejected == after.rejected &&
+                       before.false_positives == after.false_positives,
+                   "const lookups counted by the filter");
+        break;
+    }
+    case 8: {
+        // The non-throwing calls report what the throwing ones would throw
+        const Map &cm = m;
+        const Counted *found = nullptr;
+        DIFF_CHECK((cm.try_at(k, found) == sjtu::errc::none) == (model.count(k) == 1), "try_at");
+        if (found) DIFF_CHECK(found->v == model.find(k)->second.v, "try_at value");
+        DIFF_CHECK((m.find_ptr(k) != nullptr) == (model.count(k) == 1), "find_ptr");
+        DIFF_CHECK(m.try_erase(m.end()) == sjtu::errc::invalid_iterator, "try_erase(end())");
+        iterator last = m.end();
+        DIFF_CHECK(last.try_increment() == sjtu::errc::invalid_iterator, "try_increment at end()");
+        iterator first = m.begin();
+        DIFF_CHECK(first.try_decrement() == sjtu::errc::invalid_iterator, "try_decrement at begin()");
+        break;
+    }
+    case 9: {
+        // Visitors, whole and ranged, both ways, with an early stop
+        int lo = rnd.below(range), hi = lo + rnd.below(range / 4 + 1);
+        size_t limit = 1 + rnd.below(int(model.size()) + 2);
+        std::vector<int> got, want;
+        for (Model::iterator e = model.lower_bound(lo); e != model.lower_bound(hi) && want.size() < limit; ++e) {
+            want.push_back(e->first);
+        }
+        Collect c = {&got, limit};
+        m.for_each_in_range(lo, hi, c);
+        DIFF_CHECK(got == want, "for_each_in_range");
+        got.clear();
+        want.clear();
+        for (Model::reverse_iterator e = model.rbegin(); e != model.rend() && want.size() < limit; ++e) {
+            want.push_back(e->first);
+        }
+        const Map &cm = m;
+        cm.reverse_for_each(c);
+        DIFF_CHECK(got == want, "reverse_for_each");
+        break;
+    }
+    case 10: {
+        long want = 0;
+        for (Model::iterator e = model.begin(); e != model.end(); ++e) want += e->first;
+        const Map &cm = m;
+        DIFF_CHECK(cm.parallel_reduce(testPool(), 0L, KeyOf(), Sum()) == want, "parallel_reduce");
+        RunOnlyPool runOnly;
+        DIFF_CHECK(cm.parallel_reduce(runOnly, 0L, KeyOf(), Sum()) == want, "parallel_reduce, run() only");
+        std::atomic<long> total(0);
+        AddKeys add = {&total};
+        m.parallel_for_each(testPool(), add);
+        DIFF_CHECK(total == want, "parallel_for_each");
+        break;
+    }
+    case 11: {
+        // The ranges of partition() cover the map in order
+        size_t parts = 1 + rnd.below(9);
+        std::vector<sjtu::pair<iterator, iterator> > out(parts, sjtu::pair<iterator, iterator>(m.end(), m.end()));
+        m.partition(parts, &out[0]);
+        DIFF_CHECK(out[0].first == m.begin() && out[parts - 1].second == m.end(), "partition ends");
+        Model::iterator e = model.begin();
+        for (size_t i = 0; i < parts; ++i) {
+            if (i > 0) DIFF_CHECK(out[i].first == out[i - 1].second, "partition ranges touch");
+            for (iterator it = out[i].first; it != out[i].second; ++it, ++e) {
+                DIFF_CHECK(e != model.end() && it->first == e->first, "partition contents");
+            }
+        }
+        DIFF_CHECK(e == model.end(), "partition misses elements");
+        break;
+    }
+    case 12:
+    case 13: {
+        Map other;
+        Model otherModel;
+        fillRandom(other, otherModel, rnd, rnd.below(2) ? rnd.below(8) : rnd.below(range), range);
+        int op = rnd.below(3);
+        // 0: serial, 1: work_stealing_pool, 2: a pool with only run()
+        int how = rnd.below(3);
+        RunOnlyPool runOnly;
+        if (op == 0) {
+            for (Model::iterator e = otherModel.begin(); e != otherModel.end(); ++e) {
+                Model::iterator mine = model.find(e->first);
+                if (mine == model.end()) model.insert(*e);
+                else mine->second = Add()(mine->second, e->second);
+            }
+            if (how == 0) m.merge_union(other, Add());
+            else if (how == 1) m.merge_union(testPool(), other, Add());
+            else m.merge_union(runOnly, other, Add());
+        } else if (op == 1) {
+            for (Model::iterator e = model.begin(); e != model.end();) {
+                if (otherModel.count(e->first)) ++e;
+                else model.erase(e++);
+            }
+            if (how == 0) m.intersect(other);
+            else if (how == 1) m.intersect(testPool(), other);
+            else m.intersect(runOnly, other);
+        } else {
+            for (Model::iterator e = otherModel.begin(); e != otherModel.end(); ++e) model.erase(e->first);
+            if (how == 0) m.difference(other);
+            else if (how == 1) m.difference(testPool(), other);
+            else m.difference(runOnly, other);
+        }
+        difftest::checkSame(other, otherModel, name, seed);
+        break;
+    }
+    case 14: {
+        size_t erased = 0;
+        for (Model::iterator e = model.begin(); e != model.end();) {
+            if (e->second.v % 2 != 0) {
+                model.erase(e++);
+                ++erased;
+            } else {
+                ++e;
+            }
+        }
+        DIFF_CHECK(m.erase_if(OddValue()) == erased, "erase_if count");
+        break;
+    }
+    case 15: {
+        if (model.empty()) {
+            bool threw = false;
+            try {
+                m.pop_front();
+            } catch (...) {
+                threw = true;
+            }
+            DIFF_CHECK(threw, "pop_front of an empty map must throw");
+        } else if (rnd.below(2)) {
+            m.pop_front();
+            model.erase(model.begin());
+        } else {
+            m.pop_back();
+            model.erase(--model.end());
+        }
+        break;
+    }
+    case 16: {
+        size_t before = model.size();
+        if (rnd.below(2)) {
+            model.erase(model.begin(), model.lower_bound(k));
+            DIFF_CHECK(m.trim_before(k) == before - model.size(), "trim_before count");
+        } else {
+            model.erase(model.upper_bound(k), model.end());
+            DIFF_CHECK(m.trim_after(k) == before - model.size(), "trim_after count");
+        }
+        break;
+    }
+    case 17:
+        m.optimize(typename Map::node_layout(rnd.below(3)));
+        break;
+    case 18:
+        m.rebuild_by_frequency(typename Map::node_layout(rnd.below(3)));
+        break;
+    }
+}
+
+template<class Map>
+void runMap(const char *name, unsigned seed, int rounds, int range) {
+    difftest::runCommon<Map>(name, seed, rounds, range);
+    long liveBefore = Counted::live;
+    {
+        Map m;
+        Model model;
+        Random rnd(seed);
+        for (int i = 0; i < rounds; ++i) {
+            if (rnd.below(4) == 0) mapStep(m, model, rnd, range, name, seed);
+            else difftest::commonStep(m, model, rnd, range, name, seed);
+            if (i % 16 == 0 || i + 1 == rounds) difftest::checkSame(m, model, name, seed);
+        }
+    }
+    DIFF_CHECK(Counted::live == liveBefore, "values leaked or destroyed twice");
+}
+
+/**
+ * A shrink_to_fit() whose copy of an element throws keeps every element
+ * and leaves no block marked for draining: refilled afterwards, the map
+ * takes no more room than one whose shrink went through.
+ */
+template<class Map>
+void runShrinkThrow(const char *name, unsigned seed) {
+    const int n = 20000;
+    long liveBefore = Counted::live;
+    {
+        Map m, control;
+        Model model;
+        for (int i = 0; i < n; ++i) {
+            m[i] = Counted(i);
+            control[i] = Counted(i);
+            model[i] = Counted(i);
+        }
+        for (int i = 0; i < n; i += 2) {
+            m.erase(m.find(i));
+            control.erase(control.find(i));
+            model.erase(i);
+        }
+        bool threw = false;
+        Counted::failAfter = n / 8;
+        try {
+            m.shrink_to_fit();
+        } catch (...) {
+            threw = true;
+        }
+        Counted::failAfter = 0;
+        DIFF_CHECK(threw, "shrink_to_fit must pass on a throwing copy");
+        difftest::checkSame(m, model, name, seed);
+        control.shrink_to_fit();
+        for (int i = 0; i < n; i += 2) {
+            m[i] = Counted(i);
+            control[i] = Counted(i);
+            model[i] = Counted(i);
+        }
+        difftest::checkSame(m, model, name, seed);
+        DIFF_CHECK(m.capacity() == control.capacity(), "blocks left draining after a failed shrink_to_fit");
+    }
+    DIFF_CHECK(Counted::live == liveBefore, "values leaked or destroyed twice");
+}
+
+/**
+ * Set operations on maps large enough for the pool overloads to split
+ * the work, through each kind of pool, and a merge_union() whose copy
+ * of other throws halfway, which must leave the map unchanged.
+ */
+template<class Map>
+void runLargeSetOps(const char *name, unsigned seed, bool splay) {
+    const int range = 200000;
+    long liveBefore = Counted::live;
+    Random rnd(seed);
+    RunOnlyPool runOnly;
+    for (int how = 0; how < 3; ++how) {
+        for (int op = 0; op < 3; ++op) {
+            Map m, other;
+            Model model, otherModel;
+            fillRandom(m, model, rnd, 60000, range);
+            fillRandom(other, otherModel, rnd, 30000 + rnd.below(40000), range);
+            if (op == 0) {
+                for (Model::iterator e = otherModel.begin(); e != otherModel.end(); ++e) {
+                    Model::iterator mine = model.find(e->first);
+                    if (mine == model.end()) model.insert(*e);
+                    else mine->second = Add()(mine->second, e->second);
+                }
+                if (how == 0) m.merge_union(other, Add());
+                else if (how == 1) m.merge_union(testPool(), other, Add());
+                else m.merge_union(runOnly, other, Add());
+            } else if (op == 1) {
+                for (Model::iterator e = model.begin(); e != model.end();) {
+                    if (otherModel.count(e->first)) ++e;
+                    else model.erase(e++);
+                }
+                if (how == 0) m.intersect(other);
+                else if (how == 1) m.intersect(testPool(), other);
+                else m.intersect(runOnly, other);
+            } else {
+                for (Model::iterator e = otherModel.begin(); e != otherModel.end(); ++e) model.erase(e->first);
+                if (how == 0) m.difference(other);
+                else if (how == 1) m.difference(testPool(), other);
+                else m.difference(runOnly, other);
+            }
+            difftest::checkSame(m, model, name, seed);
+            difftest::checkSame(other, otherModel, name, seed);
+        }
+    }
+    {
+        Map m, other;
+        Model model, otherModel;
+        fillRandom(m, model, rnd, 1000, range);
+        fillRandom(other, otherModel, rnd, 1000, range);
+        bool threw = false;
+        Counted::failAfter = long(otherModel.size() / 2);
+        try {
+            m.merge_union(other, Add());
+        } catch (...) {
+            threw = true;
+        }
+        Counted::failAfter = 0;
+        DIFF_CHECK(threw, "merge_union must pass on a throwing copy");
+        // A splay tree keeps what it merged before the throw
+        if (!splay) difftest::checkSame(m, model, name, seed);
+        difftest::checkSame(other, otherModel, name, seed);
+    }
+    DIFF_CHECK(Counted::live == liveBefore, "values leaked or destroyed twice");
+}
+
+// Elements and largest piece seen by parallel_reduce(): map_fn gives
+// {1, 1} per element, so the top-level fold sees each piece's size
+struct PieceSizes {
+    long n;
+    long biggest;
+};
+
+struct OnePiece {
+    PieceSizes operator()(const sjtu::pair<const int, int> &) const {
+        PieceSizes s = {1, 1};
+        return s;
+    }
+};
+
+struct AddPieces {
+    PieceSizes operator()(const PieceSizes &a, const PieceSizes &b) const {
+        PieceSizes s = {a.n + b.n, a.biggest > b.n ? a.biggest : b.n};
+        return s;
+    }
+};
+
+/**
+ * Ascending inserts leave a splay tree a single path, whose shape says
+ * nothing about sizes: partition() must still return ranges of equal
+ * size, and the parallel walks pieces of equal size.
+ */
+void runSplayBalance() {
+    typedef sjtu::map<int, int, std::less<int>, splay_traits> Map;
+    const char *name = "splay_tree partition balance";
+    const unsigned seed = 0;
+    const long n = 100000;
+    Map m;
+    for (int i = 0; i < n; ++i) m.insert(Map::value_type(i, i));
+    DIFF_CHECK(m.tree_depth().maximum == size_t(n), "ascending inserts should leave a path");
+    static const size_t counts[] = {1, 3, 8, 1000};
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        size_t k = counts[c];
+        std::vector<sjtu::pair<Map::iterator, Map::iterator> > out(k);
+        m.partition(k, &out[0]);
+        long covered = 0;
+        for (size_t i = 0; i < k; ++i) {
+            long size = 0;
+            for (Map::iterator it = out[i].first; it != out[i].second; ++it) ++size;
+            DIFF_CHECK(size == long(n / k) || size == long(n / k) + 1, "partition range size");
+            covered += size;
+        }
+        DIFF_CHECK(covered == n, "partition coverage");
+    }
+    PieceSizes none = {0, 0};
+    PieceSizes sizes = m.parallel_reduce(testPool(), none, OnePiece(), AddPieces());
+    DIFF_CHECK(sizes.n == n, "parallel_reduce count");
+    DIFF_CHECK(sizes.biggest <= n / 256 + 1, "parallel piece size");
+    printf("ok  %s\n", name);
+}
+
+template<class Traits>
+void runTraits(const char *name, int rounds) {
+    typedef sjtu::map<int, Counted, std::less<int>, Traits> Map;
+    // Small key ranges stress the erase and rebalance paths, large ones
+    // the node pool and the parallel cut
+    runMap<Map>(name, 1, rounds, 64);
+    runMap<Map>(name, 2, rounds, 1000);
+    runMap<Map>(name, 3, rounds, 20000);
+    runLargeSetOps<Map>(name, 4, Traits::splay_tree);
+    runShrinkThrow<Map>(name, 5);
+    printf("ok  %s\n", name);
+}
+
+int main(int argc, char **argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 4000;
+    runTraits<sjtu::map_traits>("default", rounds);
+    runTraits<compact_traits>("compact_color", rounds);
+    runTraits<index_traits>("index_links", rounds);
+    runTraits<split_traits>("split_values", rounds);
+    runTraits<threaded_traits>("threaded", rounds);
+    runTraits<threaded_index_traits>("threaded index_links", rounds);
+    runTraits<cache_traits>("lookup_cache_slots", rounds);
+    runTraits<filter_traits>("filter_bits_per_key", rounds);
+    runTraits<unchecked_traits>("unchecked iterators", rounds);
+    runTraits<unchecked_threaded_traits>("unchecked threaded compact_color", rounds);
+    runTraits<counted_traits>("access_sample", rounds);
+    runTraits<avl_traits>("avl_balancing", rounds);
+    runTraits<avl_index_traits>("avl_balancing index_links threaded", rounds);
+    runTraits<splay_traits>("splay_tree", rounds);
+    runTraits<splay_everything_traits>("splay_tree with every option", rounds);
+    runTraits<everything_traits>("every option", rounds);
+    runSplayBalance();
+    printf("all passed\n");
+    return 0;
+}